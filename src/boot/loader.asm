@@ -1,6 +1,14 @@
 [org 0x7e00]
 [bits 16]
 
+%ifdef BIOS_KERNEL_LOADING
+KERNEL_EXTENT_TABLE     equ 0x0600      ; sector 3 of the partition, see KernelExtentTableHandle
+KERNEL_FILE_ADDRESS     equ 0x00100000
+KERNEL_FILE_END         equ 0x01000000  ; the kernel's own memory
+BOUNCE_BUFFER_SEGMENT   equ 0x5000      ; disk reads land at 0x50000, below 1 MiB, and are copied from there
+SECTORS_PER_READ        equ 127         ; the most a BIOS has to accept in a single extended read
+%endif
+
 loader:
 setup_stack:
     cli
@@ -10,6 +18,9 @@ setup_stack:
     mov ss, ax
     mov sp, 0x7a00 
     mov bp, 0x7a00      
+%ifdef BIOS_KERNEL_LOADING
+    mov [boot_drive], dl
+%endif
 
 detect_memory:
     xor ax, ax
@@ -47,12 +58,141 @@ enable_a20:
 load_gdt:
     lgdt [gdt_descriptor]
 
+%ifdef BIOS_KERNEL_LOADING
+    call bios_load_kernel
+%endif
+
 enter_protected_mode:
     mov eax, cr0
     or  eax, 1
     mov cr0, eax
     jmp 0x8:protected_mode_entrypoint
 
+%ifdef BIOS_KERNEL_LOADING
+; Reads the kernel file to KERNEL_FILE_ADDRESS with BIOS extended reads of the sectors listed in the kernel extent table,
+; copying each read above 1 MiB in unreal mode. Does nothing if the BIOS has no extended reads, there is no table or
+; a read fails; stage 2 then reads the kernel with its own driver, as it also does if it finds the table invalid.
+bios_load_kernel:
+    mov ah, 0x41            ; check extensions present mode (EDD)
+    mov bx, 0x55aa
+    mov dl, [boot_drive]
+    int 0x13
+    jc .done
+    cmp bx, 0xaa55
+    jne .done
+    test cl, 1              ; packet access (extended read) supported
+    jz .done
+
+    mov eax, [0x7c1c]       ; starting sector of the partition (hidden sectors of the VBR's BPB)
+    add eax, 3
+    mov word [disk_address_packet.count], 1
+    mov word [disk_address_packet.offset], KERNEL_EXTENT_TABLE
+    mov word [disk_address_packet.segment], 0
+    call read_sectors
+    jc .done
+    cmp dword [KERNEL_EXTENT_TABLE], 0x5458454b         ; signature
+    jne .done
+    mov ecx, [KERNEL_EXTENT_TABLE + 20]                 ; number of extents
+    cmp ecx, 60
+    ja .done
+
+    mov word [disk_address_packet.offset], 0
+    mov word [disk_address_packet.segment], BOUNCE_BUFFER_SEGMENT
+    mov edi, KERNEL_FILE_ADDRESS
+    mov bp, KERNEL_EXTENT_TABLE + 24
+    cld
+.next_extent:
+    jcxz .loaded
+    mov eax, [bp]           ; first sector of the extent
+    mov ebx, [bp + 4]       ; number of sectors
+.next_read:
+    test ebx, ebx
+    jz .end_extent
+    mov edx, SECTORS_PER_READ
+    cmp ebx, edx
+    jae .read
+    mov edx, ebx
+.read:
+    mov esi, edx
+    shl esi, 9
+    add esi, edi
+    jc .done
+    cmp esi, KERNEL_FILE_END
+    ja .done
+    mov [disk_address_packet.count], dx
+    call read_sectors
+    jc .done
+    cmp [disk_address_packet.count], dx                 ; sectors actually read, some BIOSes only report a short read here
+    jne .done
+    call enter_unreal_mode
+    push cx
+    mov esi, BOUNCE_BUFFER_SEGMENT * 16
+    mov ecx, edx
+    shl ecx, 7              ; 128 dwords per sector
+    a32 rep movsd           ; DS:ESI to ES:EDI, both segments based at 0
+    pop cx
+    add eax, edx
+    sub ebx, edx
+    jmp .next_read
+.end_extent:
+    add bp, 8
+    dec cx
+    jmp .next_extent
+.loaded:
+    mov eax, [KERNEL_EXTENT_TABLE + 16]                 ; file size
+    mov [preloaded_kernel_size], eax
+.done:
+    ret
+
+; reads the sectors given by disk_address_packet, starting with sector EAX (LBA); CF set on error
+; all registers are preserved, BIOSes may clobber any of them (including the upper halves) in int 0x13;
+; popad leaves the flags alone, so the carry flag still holds the result
+read_sectors:
+    pushad
+    mov [disk_address_packet.lba], eax
+    mov si, disk_address_packet
+    mov dl, [boot_drive]
+    mov ah, 0x42            ; extended read sectors from drive mode
+    int 0x13
+    popad
+    ret
+
+; loads DS and ES in protected mode, so they keep the 4 GiB limit of the data descriptor back in real mode;
+; done before every copy, since the BIOS may reload them in between
+enter_unreal_mode:
+    push eax
+    push ds
+    push es
+    cli
+    mov eax, cr0
+    or  al, 1
+    mov cr0, eax
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov eax, cr0
+    and al, 0xfe
+    mov cr0, eax
+    pop es
+    pop ds
+    pop eax
+    ret
+
+boot_drive:
+    db  0
+disk_address_packet:
+    db  0x10                ; size of the packet
+    db  0
+.count:
+    dw  0                   ; number of sectors to read
+.offset:
+    dw  0                   ; destination offset
+.segment:
+    dw  0                   ; destination segment
+.lba:
+    dq  0                   ; starting sector (LBA)
+%endif
+
 gdt_null_descriptor:
     dd  0
     dd  0
@@ -95,4 +235,7 @@ protected_mode_entrypoint:
 
     jmp 0x8000
 
-times 512-($-$$) db 0
+times 508-($-$$) db 0
+
+preloaded_kernel_size:      ; at 0x7ffc: size of the kernel file read to 0x100000 before stage 2 (0 if not), see kloader()
+    dd  0
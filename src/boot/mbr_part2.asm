@@ -22,6 +22,26 @@ checkActivePartition:
     hlt
 
 loadVBR:
+.check_extensions:
+    mov ah, 0x41            ; check extensions present mode (EDD)
+    mov bx, 0x55aa
+    int 0x13
+    jc .reset               ; no extensions: CHS read
+    cmp bx, 0xaa55
+    jne .reset
+    test cl, 1              ; packet access (extended read) supported
+    jz .reset
+
+.read_lba:
+    mov eax, [si + 8]       ; starting sector of the partition (LBA)
+    mov [disk_address_packet.lba], eax
+    push si
+    mov si, disk_address_packet
+    mov ah, 0x42            ; extended read sectors from drive mode
+    int 0x13
+    pop si
+    jnc .loaded
+
 .reset:
     mov ah, 0               ; reset disk system mode
     int 0x13
@@ -31,7 +51,7 @@ loadVBR:
     mov ah, 0x02            ; read sectors from drive mode
     mov al, 1               ; number of sectors to read
 
-    ; reading sector 2048 (LBA)
+    ; fallback for BIOSes without extensions: reading sector 2048 (LBA)
     ; assuming SPT=63 and HPC=64
     mov ch, 0               ; starting cylinder
     mov dh, 32              ; starting head
@@ -43,9 +63,19 @@ loadVBR:
     int 0x13
     jc .reset
 
+.loaded:
     jmp 0x0000:0x7c00       ; jumping to the loaded VBR
                             ; DS:SI points to the active partition table entry
                             ; CS = 0, DS = 0, ES = 0
                             ; DL = the drive number
 
+disk_address_packet:
+    db  0x10                ; size of the packet
+    db  0
+    dw  1                   ; number of sectors to read
+    dw  0x7c00              ; destination offset
+    dw  0x0000              ; destination segment
+.lba:
+    dq  0                   ; starting sector (LBA)
+
 times 408-($-$$) db 0
@@ -2,6 +2,32 @@
 [bits 16]
 
 loadBootloader:
+.check_extensions:
+    mov ah, 0x41            ; check extensions present mode (EDD)
+    mov bx, 0x55aa
+    int 0x13
+    jc .reset               ; no extensions: CHS read
+    cmp bx, 0xaa55
+    jne .reset
+    test cl, 1              ; packet access (extended read) supported
+    jz .reset
+
+.read_lba:
+    ; kloader.bin is the first file copied to the volume: it starts at cluster 3, right after the root directory
+    ; hidden sectors + reserved sectors + number of FATs * sectors per FAT + sectors per cluster (BPB)
+    movzx eax, byte [0x7c10]
+    imul eax, dword [0x7c24]
+    movzx ebx, word [0x7c0e]
+    add eax, ebx
+    add eax, dword [0x7c1c]
+    movzx ebx, byte [0x7c0d]
+    add eax, ebx
+    mov [disk_address_packet.lba], eax
+    mov si, disk_address_packet
+    mov ah, 0x42            ; extended read sectors from drive mode
+    int 0x13
+    jnc .loaded
+
 .reset:
     mov ah, 0               ; reset disk system mode
     int 0x13
@@ -11,7 +37,7 @@ loadBootloader:
     mov ah, 0x02            ; read sectors from drive mode
     mov al, 49              ; number of sectors to read (dest. 0x7e00-0xdfff)
 
-    ; starting with sector 6184 (LBA) - first file cluster
+    ; fallback for BIOSes without extensions: starting with sector 6184 (LBA) - first file cluster
     ; assuming SPT=63 and HPC=64
     mov ch, 1               ; starting cylinder
     mov dh, 34              ; starting head
@@ -23,6 +49,16 @@ loadBootloader:
     int 0x13
     jc .reset
 
-    jmp 0x0000:0x7e00
+.loaded:
+    jmp 0x0000:0x7e00       ; DL = the drive number
+
+disk_address_packet:
+    db  0x10                ; size of the packet
+    db  0
+    dw  49                  ; number of sectors to read (dest. 0x7e00-0xdfff)
+    dw  0x7e00              ; destination offset
+    dw  0x0000              ; destination segment
+.lba:
+    dq  0                   ; starting sector (LBA)
 
 times 420-($-$$) db 0
@@ -0,0 +1,333 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "block_cache.hpp"
+#include "block_device.hpp"
+#include "bpb.hpp"
+#include "cluster_allocator.hpp"
+#include "directory_sector.hpp"
+#include "fat_cache.hpp"
+#include "fat_directory.hpp"
+#include "fat_file.hpp"
+#include "fat_path.hpp"
+#include "file_extent_map.hpp"
+#include "mapped_disk_image.hpp"
+#include "mbr.hpp"
+
+// Runs the kernel's FAT32 code against a disk image on the build host:
+// lists the root directory of the active partition, then times repeated lookups of a file in it
+// (by scanning the directory and through the dentry cache), resolutions of a path given as the
+// fourth argument ("/Documents Folder/ReadMe Long Name.txt" by default) and reads of KERNEL.BIN through the file API
+// and walks of the file's cluster chain, cluster by cluster and run by run, and random seeks into it.
+// Results that disagree between the methods compared make it exit with 1.
+//
+// Usage: fat_bench [image] [iterations] [path] [--cached] [--write]
+//   image       disk image, hd.img by default
+//   iterations  number of timed lookups, 1000 by default
+//   path        absolute path resolved in the timed path lookups
+//   --cached    access the image as a driver-backed device, i.e. through the block cache,
+//               instead of in place (zero-copy)
+//   --write     first check the write path: creates files in the root directory of the image (use a copy),
+//               writes them in several ways, syncs and reads them back, and compares the FAT with its mirrors
+
+namespace {
+
+    const LiOS86::Host::MappedDiskImage* driverImage = nullptr;
+
+    // driver functions for the --cached mode, copying from the mapped image like a disk driver would
+    auto hostReadSectors(uint32_t logicalBlockAddress, uint16_t numberOfSectors, LiOS86::xstd::span<uint8_t> destination) -> LiOS86::xstd::expected<uint32_t, LiOS86::DiskError> {
+        return driverImage->blockDevice().read(logicalBlockAddress, numberOfSectors, destination);
+    }
+
+    auto hostWriteSectors(uint32_t logicalBlockAddress, uint16_t numberOfSectors, LiOS86::xstd::span<const uint8_t> source) -> LiOS86::xstd::expected<uint32_t, LiOS86::DiskError> {
+        return driverImage->blockDevice().write(logicalBlockAddress, numberOfSectors, source);
+    }
+
+    auto hostFlush() -> bool {
+        return true;
+    }
+
+    // visits every directory entry of the chain starting at the given cluster until the callback returns true
+    auto forEachDirectoryEntry(const LiOS86::BPBHandle& bpb, uint32_t partitionStart, uint32_t startingCluster, auto callback) -> bool {
+        const auto dataStart = partitionStart + bpb.getDataSectionOffsetInSectors();
+        const auto sectorsPerCluster = bpb.getSectorsPerCluster();
+
+        auto cluster = startingCluster;
+        while(LiOS86::isChainCluster(cluster)) {
+            for(uint32_t i = 0; i < sectorsPerCluster; ++i) {
+                const auto sector = LiOS86::DirectorySectorHandle(dataStart + (cluster - 2) * sectorsPerCluster + i);
+                for(const auto entry : sector) {
+                    if(callback(entry)) return true;
+                }
+            }
+            const auto next = LiOS86::FATCache::nextCluster(cluster);
+            if(!next) return false;
+            cluster = *next;
+        }
+        return false;
+    }
+
+    auto fail(const char* what) -> bool {
+        std::fprintf(stderr, "Write check failed: %s\n", what);
+        return false;
+    }
+
+    // reopens the file and compares its size and contents with the expected ones
+    auto contentsMatch(const char* path, const std::vector<uint8_t>& expected) -> bool {
+        const auto fd = LiOS86::FileTable::open(path);
+        if(!fd) return false;
+        const auto size = LiOS86::FileTable::getFileSize(*fd);
+        std::vector<uint8_t> contents(expected.size() + 1);
+        const auto read = LiOS86::FileTable::pread(*fd, LiOS86::xstd::span<uint8_t>(contents.data(), contents.size()), 0);
+        LiOS86::FileTable::close(*fd);
+        return size && *size == expected.size() && read && *read == expected.size() && std::memcmp(contents.data(), expected.data(), expected.size()) == 0;
+    }
+
+    auto fatMirrorsMatch(const LiOS86::BPBHandle& bpb, uint32_t partitionStart) -> bool {
+        if(!bpb.isFATMirrored()) return true;
+        LiOS86::xstd::array<uint8_t, LiOS86::ATA_SECTOR_SIZE> primary{};
+        LiOS86::xstd::array<uint8_t, LiOS86::ATA_SECTOR_SIZE> mirror{};
+        for(uint32_t sector = 0; sector < bpb.getFATSizeInSectors(); ++sector) {
+            if(!LiOS86::BlockCache::read(partitionStart + bpb.getFATOffsetInSectors(0) + sector, 1, primary)) return false;
+            for(uint8_t fat = 1; fat < bpb.getNumberOfFATs(); ++fat) {
+                if(!LiOS86::BlockCache::read(partitionStart + bpb.getFATOffsetInSectors(fat) + sector, 1, mirror)) return false;
+                if(std::memcmp(primary.data(), mirror.data(), primary.size()) != 0) return false;
+            }
+        }
+        return true;
+    }
+
+    // Appends to a new file in odd-sized pieces, overwrites part of it, writes past its end (leaving a zero-filled gap)
+    // and shrinks it, mirroring every change in memory; then fills the root directory with small files until it needs
+    // another cluster. Everything is synced and read back, and the FAT mirrors have to match the primary FAT.
+    auto checkWrites(const LiOS86::BPBHandle& bpb, uint32_t partitionStart) -> bool {
+        std::vector<uint8_t> expected;
+        uint32_t seed = 1;
+        const auto nextByte = [&seed]() {
+            seed = seed * 1103515245 + 12345;
+            return static_cast<uint8_t>(seed >> 16);
+        };
+
+        const auto fd = LiOS86::FileTable::create("/BENCHWR.TMP");
+        if(!fd) return fail("cannot create /BENCHWR.TMP");
+        std::vector<uint8_t> piece(777);
+        for(int i = 0; i < 100; ++i) {
+            for(auto& byte : piece) byte = nextByte();
+            const auto written = LiOS86::FileTable::write(*fd, LiOS86::xstd::span<const uint8_t>(piece.data(), piece.size()));
+            if(!written || *written != piece.size()) return fail("append");
+            expected.insert(expected.end(), piece.begin(), piece.end());
+        }
+
+        for(auto& byte : piece) byte = nextByte();
+        if(!LiOS86::FileTable::pwrite(*fd, LiOS86::xstd::span<const uint8_t>(piece.data(), piece.size()), 1000)) return fail("overwrite");
+        std::memcpy(expected.data() + 1000, piece.data(), piece.size());
+
+        const auto gapStart = static_cast<uint32_t>(expected.size()) + 5000;
+        if(!LiOS86::FileTable::pwrite(*fd, LiOS86::xstd::span<const uint8_t>(piece.data(), piece.size()), gapStart)) return fail("write past the end");
+        expected.resize(gapStart, 0);
+        expected.insert(expected.end(), piece.begin(), piece.end());
+
+        const auto truncatedSize = static_cast<uint32_t>(expected.size()) - 3000;
+        const auto truncated = LiOS86::FileTable::truncate(*fd, truncatedSize);
+        if(!truncated || *truncated != truncatedSize) return fail("truncate");
+        expected.resize(truncatedSize);
+        LiOS86::FileTable::close(*fd);
+
+        // with 512-byte clusters (16 entries each), the root directory gets at least one more cluster
+        constexpr int SMALL_FILES = 20;
+        char name[] = "/BENCH00.TMP";
+        for(int i = 0; i < SMALL_FILES; ++i) {
+            name[6] = static_cast<char>('0' + i / 10);
+            name[7] = static_cast<char>('0' + i % 10);
+            const auto small = LiOS86::FileTable::create(name);
+            if(!small) return fail("cannot create a file while extending the root directory");
+            const auto written = LiOS86::FileTable::write(*small, LiOS86::xstd::span<const uint8_t>(reinterpret_cast<const uint8_t*>(name), sizeof(name)));
+            LiOS86::FileTable::close(*small);
+            if(!written) return fail("write to a small file");
+        }
+
+        if(!LiOS86::FileTable::sync()) return fail("sync");
+        if(!contentsMatch("/BENCHWR.TMP", expected)) return fail("/BENCHWR.TMP read back differs");
+        for(int i = 0; i < SMALL_FILES; ++i) {
+            name[6] = static_cast<char>('0' + i / 10);
+            name[7] = static_cast<char>('0' + i % 10);
+            if(!contentsMatch(name, std::vector<uint8_t>(name, name + sizeof(name)))) return fail("small file read back differs");
+        }
+        if(!fatMirrorsMatch(bpb, partitionStart)) return fail("FAT mirrors differ from the primary FAT");
+        std::printf("Write check passed: %zu bytes and %d small files written and read back, FAT mirrors match\n", expected.size(), SMALL_FILES);
+        return true;
+    }
+
+    template<typename Function>
+    auto nanosecondsPerIteration(long iterations, Function function) -> double {
+        const auto start = std::chrono::steady_clock::now();
+        for(long i = 0; i < iterations; ++i) {
+            function();
+        }
+        const auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        return iterations > 0 ? elapsed / static_cast<double>(iterations) : 0.0;
+    }
+
+}
+
+auto main(int argc, char** argv) -> int {
+    const char* imagePath = "hd.img";
+    const char* path = "/Documents Folder/ReadMe Long Name.txt";
+    long iterations = 1000;
+    bool cached = false;
+    bool writePass = false;
+    int positional = 0;
+    for(int i = 1; i < argc; ++i) {
+        if(std::strcmp(argv[i], "--cached") == 0) {
+            cached = true;
+        } else if(std::strcmp(argv[i], "--write") == 0) {
+            writePass = true;
+        } else if(positional == 0) {
+            imagePath = argv[i];
+            ++positional;
+        } else if(positional == 1) {
+            iterations = std::atol(argv[i]);
+            ++positional;
+        } else {
+            path = argv[i];
+        }
+    }
+
+    const LiOS86::Host::MappedDiskImage image(imagePath, writePass);
+    if(!image.isValid()) {
+        std::fprintf(stderr, "Cannot map %s\n", imagePath);
+        return 1;
+    }
+    driverImage = &image;
+    if(cached) {
+        LiOS86::selectBlockDevice(LiOS86::BlockDevice::fromDriver("host file", hostReadSectors, hostWriteSectors, hostFlush));
+    } else {
+        LiOS86::selectBlockDevice(image.blockDevice());
+    }
+
+    const auto mbr = LiOS86::MBRHandle();
+    const auto partitionStart = mbr.getActivePartitionTableEntryHandle().getStartSector();
+    const auto bpb = LiOS86::BPBHandle(partitionStart);
+    LiOS86::FATCache::mount(bpb, partitionStart);
+    std::printf("%s: partition at sector %u, %u bytes per sector, %u sectors per cluster, root directory at cluster %u\n",
+                imagePath, partitionStart, bpb.getBytesPerSector(), bpb.getSectorsPerCluster(), bpb.getRootDirectoryStartingCluster());
+
+    const auto rootCluster = bpb.getRootDirectoryStartingCluster();
+    forEachDirectoryEntry(bpb, partitionStart, rootCluster, [](const auto& entry) {
+        const auto name = entry.getShortFileName();
+        if(name.c_str()[0] == '\0') return true;
+        if(static_cast<uint8_t>(name.c_str()[0]) == 0xE5 || entry.isLongFileNameEntry()) return false;
+        std::printf("  %s %10u bytes, cluster %u\n", name.c_str(), entry.getFileSizeInBytes(), entry.getFirstClusterNumber());
+        return false;
+    });
+
+    if(writePass) {
+        LiOS86::ClusterAllocator::mount(bpb, partitionStart);
+        if(!checkWrites(bpb, partitionStart)) return 1;
+    }
+
+    uint32_t foundCluster = 0;
+    const auto lookupTime = nanosecondsPerIteration(iterations, [&]() {
+        forEachDirectoryEntry(bpb, partitionStart, rootCluster, [&foundCluster](const auto& entry) {
+            if(entry.getShortFileName() == "KERNEL  BIN") {
+                foundCluster = entry.getFirstClusterNumber();
+                return true;
+            }
+            return false;
+        });
+    });
+    std::printf("KERNEL.BIN lookup (%s): cluster %u, %.0f ns\n", cached ? "through the block cache" : "zero-copy", foundCluster, lookupTime);
+    if(!LiOS86::isChainCluster(foundCluster)) return 0;
+
+    bool lookupsMatch = true;
+    const auto cachedLookupTime = nanosecondsPerIteration(iterations, [&]() {
+        const auto info = LiOS86::findDirectoryEntry(rootCluster, "kernel.bin", 10);
+        lookupsMatch = lookupsMatch && info && info->firstCluster == foundCluster;
+    });
+    const auto negativeLookupTime = nanosecondsPerIteration(iterations, [&]() {
+        lookupsMatch = lookupsMatch && !LiOS86::findDirectoryEntry(rootCluster, "missing.txt", 11);
+    });
+    std::printf("kernel.bin lookup through the dentry cache: %.0f ns, missing.txt: %.0f ns%s\n",
+                cachedLookupTime, negativeLookupTime, lookupsMatch ? "" : " (MISMATCH)");
+    bool mismatch = !lookupsMatch;
+
+    const auto resolved = LiOS86::resolvePath(path);
+    const auto pathTime = nanosecondsPerIteration(iterations, [path]() {
+        static_cast<void>(LiOS86::resolvePath(path));
+    });
+    if(resolved) {
+        std::printf("%s: cluster %u, %u bytes, resolved in %.0f ns\n", path, resolved->firstCluster, resolved->fileSize, pathTime);
+    } else {
+        std::printf("%s: not resolved (error %u), %.0f ns\n", path, static_cast<unsigned>(resolved.error()), pathTime);
+    }
+
+    uint32_t clusters = 0;
+    const auto clusterWalkTime = nanosecondsPerIteration(iterations, [&]() {
+        clusters = 0;
+        for(auto cluster = foundCluster; LiOS86::isChainCluster(cluster); ++clusters) {
+            const auto next = LiOS86::FATCache::nextCluster(cluster);
+            if(!next) break;
+            cluster = *next;
+        }
+    });
+    uint32_t runs = 0;
+    const auto runWalkTime = nanosecondsPerIteration(iterations, [&]() {
+        runs = 0;
+        for(auto cluster = foundCluster; LiOS86::isChainCluster(cluster); ++runs) {
+            const auto run = LiOS86::FATCache::runAt(cluster);
+            if(!run) break;
+            cluster = run->nextCluster;
+        }
+    });
+    std::printf("KERNEL.BIN chain: %u clusters in %u runs, %.0f ns per cluster walk, %.0f ns per run walk (%ld iterations)\n",
+                clusters, runs, clusterWalkTime, runWalkTime, iterations);
+
+    // seeks to pseudo-random cluster indices, by walking the chain and through the file's extent map
+    uint32_t seed = 1;
+    const auto randomFileCluster = [&seed, clusters]() {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 8) % clusters;
+    };
+    uint32_t walkChecksum = 0;
+    const auto walkSeekTime = nanosecondsPerIteration(iterations, [&]() {
+        auto cluster = foundCluster;
+        for(auto remaining = randomFileCluster(); remaining > 0; --remaining) {
+            const auto next = LiOS86::FATCache::nextCluster(cluster);
+            cluster = next ? *next : 0;
+        }
+        walkChecksum += cluster;
+    });
+    seed = 1;
+    uint32_t mapChecksum = 0;
+    const auto mapSeekTime = nanosecondsPerIteration(iterations, [&]() {
+        const auto cluster = LiOS86::FileExtentMapCache::get(foundCluster).clusterAt(randomFileCluster());
+        mapChecksum += cluster ? *cluster : 0;
+    });
+    std::printf("KERNEL.BIN random seeks: %.0f ns by chain walk, %.0f ns by extent map%s\n",
+                walkSeekTime, mapSeekTime, walkChecksum == mapChecksum ? "" : " (MISMATCH)");
+    mismatch = mismatch || walkChecksum != mapChecksum;
+
+    const auto fd = LiOS86::FileTable::open("/kernel.bin");
+    if(!fd) return mismatch ? 1 : 0;
+    const auto fileSize = LiOS86::FileTable::getFileSize(*fd);
+    const auto size = fileSize ? *fileSize : 0;
+    std::vector<uint8_t> whole(size);
+    std::vector<uint8_t> pieces(size);
+    const auto wholeReadTime = nanosecondsPerIteration(iterations, [&]() {
+        static_cast<void>(LiOS86::FileTable::pread(*fd, LiOS86::xstd::span<uint8_t>(whole.data(), whole.size()), 0));
+    });
+    // odd-sized sequential reads, so most of them start and end within a sector
+    static_cast<void>(LiOS86::FileTable::seek(*fd, 0));
+    for(uint32_t done = 0; done < size;) {
+        const auto result = LiOS86::FileTable::read(*fd, LiOS86::xstd::span<uint8_t>(pieces.data() + done, size - done < 1000 ? size - done : 1000));
+        if(!result || *result == 0) break;
+        done += *result;
+    }
+    const auto readsMatch = std::memcmp(whole.data(), pieces.data(), size) == 0;
+    std::printf("KERNEL.BIN read: %u bytes in %.0f ns as a whole%s\n", size, wholeReadTime, readsMatch ? "" : " (MISMATCH with 1000-byte reads)");
+    LiOS86::FileTable::close(*fd);
+    return mismatch || !readsMatch ? 1 : 0;
+}
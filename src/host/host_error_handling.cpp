@@ -0,0 +1,24 @@
+#include "utils/error_handling.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+// Host replacements for the kernel's error handling, which writes to the VGA text buffer.
+
+namespace LiOS86 {
+
+    [[noreturn]] void kassert_impl(const char* expressionText, const char* filename, int lineNumber) {
+        std::fprintf(stderr, "Assertion %s failed (%s:%d).\n", expressionText, filename, lineNumber);
+        std::abort();
+    }
+
+    [[noreturn]] void kpanic(const char* message) {
+        std::fprintf(stderr, "%s\n", message);
+        std::abort();
+    }
+
+    [[noreturn]] void kpanic() {
+        std::abort();
+    }
+
+}
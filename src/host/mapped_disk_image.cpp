@@ -0,0 +1,30 @@
+#include "mapped_disk_image.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace LiOS86::Host {
+
+    MappedDiskImage::MappedDiskImage(const char* path, bool writeable) {
+        fileDescriptor = open(path, writeable ? O_RDWR : O_RDONLY);
+        if(fileDescriptor < 0) return;
+
+        struct stat fileStatus{};
+        if(fstat(fileDescriptor, &fileStatus) != 0 || fileStatus.st_size < static_cast<off_t>(ATA_SECTOR_SIZE)) return;
+        size = static_cast<std::size_t>(fileStatus.st_size);
+
+        // a read-only image is mapped copy-on-write, so writes made by the block layer never reach the file
+        const auto flags = writeable ? MAP_SHARED : MAP_PRIVATE;
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, fileDescriptor, 0);
+        if(mapping == MAP_FAILED) return;
+        image = static_cast<uint8_t*>(mapping);
+    }
+
+    MappedDiskImage::~MappedDiskImage() {
+        if(image != nullptr) munmap(image, size);
+        if(fileDescriptor >= 0) close(fileDescriptor);
+    }
+
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "block_device.hpp"
+
+namespace LiOS86::Host {
+
+    // Disk image file (e.g. hd.img) mapped into memory with mmap, for running the kernel's
+    // block layer and FAT code on the build host. Sectors are accessed in place through
+    // a memory-mapped BlockDevice; with writeable mapping, writes go straight to the file.
+    class MappedDiskImage {
+        public:
+            MappedDiskImage(const char* path, bool writeable);
+            ~MappedDiskImage();
+
+            MappedDiskImage(const MappedDiskImage&) = delete;
+            MappedDiskImage& operator=(const MappedDiskImage&) = delete;
+            MappedDiskImage(MappedDiskImage&&) = delete;
+            MappedDiskImage& operator=(MappedDiskImage&&) = delete;
+
+            auto isValid() const -> bool {
+                return image != nullptr;
+            }
+
+            auto getNumberOfSectors() const -> uint32_t {
+                return static_cast<uint32_t>(size / ATA_SECTOR_SIZE);
+            }
+
+            auto blockDevice() const -> BlockDevice {
+                return BlockDevice::fromMemory(image, getNumberOfSectors());
+            }
+
+        private:
+            int fileDescriptor{-1};
+            uint8_t* image{nullptr};
+            std::size_t size{0};
+    };
+
+}
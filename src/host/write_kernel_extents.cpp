@@ -0,0 +1,89 @@
+#include <cstdio>
+
+#include "block_cache.hpp"
+#include "block_device.hpp"
+#include "bpb.hpp"
+#include "fat_cache.hpp"
+#include "fat_path.hpp"
+#include "kernel_extent_table.hpp"
+#include "mapped_disk_image.hpp"
+#include "mbr.hpp"
+
+// Build step run after KERNEL.BIN has been copied to the disk image: stores the sectors of the file
+// in the kernel extent table of the active partition (see KernelExtentTableHandle), which the stage 2
+// loader reads instead of looking the kernel up. A file too fragmented for the table gets no table,
+// and the loader falls back to the directory walk.
+//
+// Usage: write_kernel_extents [image]
+//   image       disk image, hd.img by default
+
+auto main(int argc, char** argv) -> int {
+    const char* imagePath = argc > 1 ? argv[1] : "hd.img";
+    const LiOS86::Host::MappedDiskImage image(imagePath, true);
+    if(!image.isValid()) {
+        std::fprintf(stderr, "Cannot map %s\n", imagePath);
+        return 1;
+    }
+    LiOS86::selectBlockDevice(image.blockDevice());
+
+    const auto mbr = LiOS86::MBRHandle();
+    const auto partitionStart = mbr.getActivePartitionTableEntryHandle().getStartSector();
+    const auto bpb = LiOS86::BPBHandle(partitionStart);
+    LiOS86::FATCache::mount(bpb, partitionStart);
+
+    // the table must not end up in the boot sectors, their backup or the FSInfo sector
+    constexpr auto tableInPartition = LiOS86::KernelExtentTableHandle::SECTOR_IN_PARTITION;
+    const auto backupBootSector = bpb.getBackupBootSectorNumber();
+    if(tableInPartition >= bpb.getReservedSectorCount() || tableInPartition == bpb.getFSInfoSectorNumber()
+        || (backupBootSector != 0 && tableInPartition >= backupBootSector && tableInPartition < backupBootSector + 3u)) {
+        std::fprintf(stderr, "%s: reserved sector %u is not available for the kernel extent table\n", imagePath, tableInPartition);
+        return 1;
+    }
+    auto table = LiOS86::KernelExtentTableHandle(partitionStart + tableInPartition);
+    if(!table.isUnused()) {
+        std::fprintf(stderr, "%s: reserved sector %u is already in use, not writing the kernel extent table\n", imagePath, tableInPartition);
+        return 1;
+    }
+
+    const auto kernel = LiOS86::resolvePath("/KERNEL.BIN");
+    if(!kernel) {
+        std::fprintf(stderr, "%s: KERNEL.BIN not found\n", imagePath);
+        table.clear();
+        return LiOS86::BlockCache::flush() ? 1 : 2;
+    }
+
+    // the file's sectors, run by run, up to the last sector holding its data
+    table.reset(kernel->entrySector, kernel->entryIndex, kernel->firstCluster, kernel->fileSize);
+    const auto sectorsPerCluster = LiOS86::FATCache::getSectorsPerCluster();
+    const auto sectorSize = static_cast<uint32_t>(LiOS86::ATA_SECTOR_SIZE);
+    auto remainingSectors = (kernel->fileSize + sectorSize - 1) / sectorSize;
+    auto cluster = kernel->firstCluster;
+    bool complete = true;
+    while(remainingSectors > 0) {
+        // runAt() rejects end-of-chain and other markers, which are not clusters of the volume
+        const auto run = LiOS86::FATCache::runAt(cluster);
+        if(!run) {
+            std::fprintf(stderr, "%s: the cluster chain of KERNEL.BIN is broken\n", imagePath);
+            complete = false;
+            break;
+        }
+        const auto runSectors = run->length * sectorsPerCluster;
+        const auto length = remainingSectors < runSectors ? remainingSectors : runSectors;
+        if(!table.addExtent(LiOS86::FATCache::clusterToSector(cluster), length)) {
+            std::printf("%s: KERNEL.BIN has more than %u fragments, the loader will look it up instead\n", imagePath, LiOS86::KernelExtentTableHandle::MAX_EXTENTS);
+            complete = false;
+            break;
+        }
+        remainingSectors -= length;
+        cluster = run->nextCluster;
+    }
+    if(!complete) table.clear();
+    if(!LiOS86::BlockCache::flush()) {
+        std::fprintf(stderr, "%s: error writing the kernel extent table\n", imagePath);
+        return 2;
+    }
+    if(complete) {
+        std::printf("%s: kernel extent table in sector %u: %u extents, %u bytes\n", imagePath, partitionStart + tableInPartition, table.getNumberOfExtents(), kernel->fileSize);
+    }
+    return 0;
+}
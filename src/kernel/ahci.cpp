@@ -0,0 +1,367 @@
+#include "ahci.hpp"
+
+#include "interrupt_manager.hpp"
+#include "mmio.hpp"
+#include "pci.hpp"
+#include "xstd/cstring.hpp"
+
+namespace LiOS86 {
+
+    namespace {
+        constexpr std::size_t NUMBER_OF_SLOTS = 32;
+        constexpr std::size_t PRDT_ENTRIES_PER_TABLE = 8;
+        constexpr std::size_t MAX_PRDT_ENTRY_SIZE = 4 * 1024 * 1024;
+
+        class CommandHeader {
+            public:
+                uint16_t flags;                 // bits 4:0 - command FIS length in dwords, bit 6 - write
+                uint16_t prdtLength;
+                uint32_t prdByteCount;
+                uint32_t commandTableBaseLow;
+                uint32_t commandTableBaseHigh;
+                uint32_t reserved[4];
+        } __attribute__((packed));
+        static_assert( sizeof(CommandHeader) == 32, "CommandHeader has incorrect size" );
+
+        class PRDTEntry {
+            public:
+                uint32_t dataBaseLow;
+                uint32_t dataBaseHigh;
+                uint32_t reserved;
+                uint32_t byteCount;             // bits 21:0 - byte count minus 1
+        } __attribute__((packed));
+        static_assert( sizeof(PRDTEntry) == 16, "PRDTEntry has incorrect size" );
+
+        class CommandTable {
+            public:
+                uint8_t commandFIS[64];
+                uint8_t atapiCommand[16];
+                uint8_t reserved[48];
+                PRDTEntry prdt[PRDT_ENTRIES_PER_TABLE];
+        } __attribute__((packed));
+        static_assert( sizeof(CommandTable) % 128 == 0, "CommandTable has incorrect size" );
+
+        // memory shared with the HBA; addresses are handed out as physical (identity mapping)
+        CommandHeader commandList[NUMBER_OF_SLOTS] __attribute__((aligned(1024)));
+        uint8_t receivedFIS[256] __attribute__((aligned(256)));
+        CommandTable commandTables[NUMBER_OF_SLOTS] __attribute__((aligned(128)));
+
+        // generic host control register offsets
+        constexpr uint32_t HBA_CAP = 0x00;
+        constexpr uint32_t HBA_GHC = 0x04;
+        constexpr uint32_t HBA_IS = 0x08;
+        constexpr uint32_t HBA_PI = 0x0c;
+
+        constexpr uint32_t CAP_SNCQ = 1u << 30;
+        constexpr uint32_t GHC_AE = 1u << 31;
+        constexpr uint32_t GHC_IE = 1u << 1;
+
+        // port register offsets
+        constexpr uint32_t PORT_REGISTERS_OFFSET = 0x100;
+        constexpr uint32_t PORT_REGISTERS_SIZE = 0x80;
+        constexpr uint32_t PX_CLB = 0x00;
+        constexpr uint32_t PX_CLBU = 0x04;
+        constexpr uint32_t PX_FB = 0x08;
+        constexpr uint32_t PX_FBU = 0x0c;
+        constexpr uint32_t PX_IS = 0x10;
+        constexpr uint32_t PX_IE = 0x14;
+        constexpr uint32_t PX_CMD = 0x18;
+        constexpr uint32_t PX_TFD = 0x20;
+        constexpr uint32_t PX_SIG = 0x24;
+        constexpr uint32_t PX_SSTS = 0x28;
+        constexpr uint32_t PX_SERR = 0x30;
+        constexpr uint32_t PX_SACT = 0x34;
+        constexpr uint32_t PX_CI = 0x38;
+
+        constexpr uint32_t CMD_ST = 1u << 0;
+        constexpr uint32_t CMD_FRE = 1u << 4;
+        constexpr uint32_t CMD_FR = 1u << 14;
+        constexpr uint32_t CMD_CR = 1u << 15;
+
+        constexpr uint32_t TFD_DRQ = 1u << 3;
+        constexpr uint32_t TFD_BSY = 1u << 7;
+
+        constexpr uint32_t IS_DHRS = 1u << 0;           // D2H register FIS received
+        constexpr uint32_t IS_SDBS = 1u << 3;           // Set Device Bits FIS received (NCQ completions)
+        constexpr uint32_t IS_DPS = 1u << 5;
+        constexpr uint32_t IS_TFES = 1u << 30;          // task file error
+        constexpr uint32_t IS_ERRORS = 0x7d800010u;     // task file, bus, interface and fatal errors
+
+        constexpr uint32_t SATA_DISK_SIGNATURE = 0x00000101;
+
+        enum class Command : uint8_t {
+            READ_DMA_EXT = 0x25,
+            WRITE_DMA_EXT = 0x35,
+            FLUSH_CACHE_EXT = 0xea,
+            READ_FPDMA_QUEUED = 0x60,
+            WRITE_FPDMA_QUEUED = 0x61,
+            IDENTIFY_DEVICE = 0xec
+        };
+
+        auto isPortWithDisk(volatile uint32_t* port) -> bool {
+            const auto sataStatus = readRegister(port, PX_SSTS);
+            const auto deviceDetection = sataStatus & 0x0f;
+            const auto powerManagement = (sataStatus >> 8) & 0x0f;
+            return deviceDetection == 3 && powerManagement == 1 && readRegister(port, PX_SIG) == SATA_DISK_SIGNATURE;
+        }
+    }
+
+    AHCIController::AHCIController() {
+        constexpr uint8_t MASS_STORAGE_CLASS = 0x01;
+        constexpr uint8_t SATA_SUBCLASS = 0x06;
+        constexpr uint8_t AHCI_PROG_IF = 0x01;
+
+        const auto controller = findPCIDevice([](const PCIDeviceHandle& handle) {
+            return handle.getClassCode() == MASS_STORAGE_CLASS && handle.getSubclass() == SATA_SUBCLASS &&
+                    handle.getProgIF() == AHCI_PROG_IF;
+        });
+        if(!controller) return;
+        controller->enableMemorySpace();
+        controller->enableBusMastering();
+
+        hbaRegisters = reinterpret_cast<volatile uint32_t*>(controller->getBARAddress(5));
+        writeRegister(hbaRegisters, HBA_GHC, readRegister(hbaRegisters, HBA_GHC) | GHC_AE);
+
+        const auto capabilities = readRegister(hbaRegisters, HBA_CAP);
+        const auto numberOfSlots = ((capabilities >> 8) & 0x1f) + 1;
+        usableTagsMask = (numberOfSlots == 32) ? 0xffffffffu : ((1u << numberOfSlots) - 1);
+
+        const auto portsImplemented = readRegister(hbaRegisters, HBA_PI);
+        for(uint8_t i = 0; i < 32; ++i) {
+            if(!(portsImplemented & (1u << i))) continue;
+            const auto port = hbaRegisters + (PORT_REGISTERS_OFFSET + i * PORT_REGISTERS_SIZE) / 4;
+            if(isPortWithDisk(port)) {
+                portRegisters = port;
+                portNumber = i;
+                break;
+            }
+        }
+        if(portRegisters == nullptr) return;
+
+        if(!initializePort() || !identifyDevice()) {
+            portRegisters = nullptr;
+            return;
+        }
+        nativeCommandQueuing = nativeCommandQueuing && (capabilities & CAP_SNCQ);
+
+        writeRegister(portRegisters, PX_IS, 0xffffffff);
+        writeRegister(hbaRegisters, HBA_IS, 1u << portNumber);
+        // without an interrupt line the port's interrupt status is polled for completions instead
+        writeRegister(portRegisters, PX_IE, IS_DHRS | IS_SDBS | IS_DPS | IS_ERRORS);
+        if(!controller->hasInterruptLine()) return;
+        InterruptManager::set_interrupt_handler(InterruptManager::irq_to_interrupt_number(controller->getInterruptLine()), interrupt_handler);
+        interruptDriven = true;
+        writeRegister(hbaRegisters, HBA_GHC, readRegister(hbaRegisters, HBA_GHC) | GHC_IE);
+    }
+
+    auto AHCIController::stopPort() -> void {
+        writeRegister(portRegisters, PX_CMD, readRegister(portRegisters, PX_CMD) & ~CMD_ST);
+        while(readRegister(portRegisters, PX_CMD) & CMD_CR) { }
+        writeRegister(portRegisters, PX_CMD, readRegister(portRegisters, PX_CMD) & ~CMD_FRE);
+        while(readRegister(portRegisters, PX_CMD) & CMD_FR) { }
+    }
+
+    auto AHCIController::startPort() -> void {
+        writeRegister(portRegisters, PX_CMD, readRegister(portRegisters, PX_CMD) | CMD_FRE);
+        while(readRegister(portRegisters, PX_TFD) & (TFD_BSY | TFD_DRQ)) { }
+        writeRegister(portRegisters, PX_SERR, 0xffffffff);
+        writeRegister(portRegisters, PX_CMD, readRegister(portRegisters, PX_CMD) | CMD_ST);
+    }
+
+    auto AHCIController::initializePort() -> bool {
+        stopPort();
+
+        for(std::size_t i = 0; i < NUMBER_OF_SLOTS; ++i) {
+            commandList[i] = CommandHeader{};
+            commandList[i].commandTableBaseLow = reinterpret_cast<uint32_t>(&commandTables[i]);
+        }
+        compilerBarrier();
+
+        writeRegister(portRegisters, PX_CLB, reinterpret_cast<uint32_t>(&commandList[0]));
+        writeRegister(portRegisters, PX_CLBU, 0);
+        writeRegister(portRegisters, PX_FB, reinterpret_cast<uint32_t>(&receivedFIS[0]));
+        writeRegister(portRegisters, PX_FBU, 0);
+        writeRegister(portRegisters, PX_IE, 0);
+        writeRegister(portRegisters, PX_IS, 0xffffffff);
+
+        startPort();
+        return true;
+    }
+
+    // Issues IDENTIFY DEVICE through slot 0 (before port interrupts are enabled, so it is polled)
+    // to learn whether the drive supports native command queuing and how deep its queue is.
+    auto AHCIController::identifyDevice() -> bool {
+        uint16_t identifyData[ATA_SECTOR_SIZE / 2] __attribute__((aligned(4)));
+        buildCommand(0, static_cast<uint8_t>(Command::IDENTIFY_DEVICE), 0, 0,
+                        reinterpret_cast<const uint8_t*>(identifyData), sizeof(identifyData), false);
+        writeRegister(portRegisters, PX_CI, 1u);
+        while(readRegister(portRegisters, PX_CI) & 1u) {
+            if(readRegister(portRegisters, PX_IS) & IS_TFES) return false;
+        }
+        compilerBarrier();
+
+        // word 76, bit 8 - NCQ supported; word 75, bits 4:0 - maximum queue depth minus 1
+        nativeCommandQueuing = identifyData[76] & (1 << 8);
+        if(nativeCommandQueuing) {
+            const auto queueDepth = (identifyData[75] & 0x1f) + 1u;
+            const auto depthMask = (queueDepth == 32) ? 0xffffffffu : ((1u << queueDepth) - 1);
+            usableTagsMask &= depthMask;
+        }
+        return true;
+    }
+
+    auto AHCIController::allocateTag() -> xstd::expected<Tag, DiskError> {
+        const auto freeTags = usableTagsMask & ~allocatedTags;
+        if(freeTags == 0) return xstd::unexpected(DiskError::QUEUE_FULL);
+        const auto tag = static_cast<Tag>(__builtin_ctz(freeTags));
+        allocatedTags |= (1u << tag);
+        return tag;
+    }
+
+    auto AHCIController::buildCommand(Tag tag, uint8_t command, uint32_t logicalBlockAddress, uint16_t numberOfSectors,
+                                        const uint8_t* buffer, std::size_t size, bool write) -> void {
+        auto& table = commandTables[tag];
+        xstd::memset(table.commandFIS, 0, sizeof(table.commandFIS));
+
+        const bool queued = command == static_cast<uint8_t>(Command::READ_FPDMA_QUEUED) ||
+                            command == static_cast<uint8_t>(Command::WRITE_FPDMA_QUEUED);
+        auto fis = table.commandFIS;
+        fis[0] = 0x27;                                  // Register FIS - host to device
+        fis[1] = 0x80;                                  // command (not device control) update
+        fis[2] = command;
+        fis[4] = static_cast<uint8_t>(logicalBlockAddress);
+        fis[5] = static_cast<uint8_t>(logicalBlockAddress >> 8);
+        fis[6] = static_cast<uint8_t>(logicalBlockAddress >> 16);
+        fis[7] = 0x40;                                  // LBA mode
+        fis[8] = static_cast<uint8_t>(logicalBlockAddress >> 24);
+        if(queued) {
+            // FPDMA commands carry the sector count in the features field and the tag in the count field
+            fis[3] = static_cast<uint8_t>(numberOfSectors);
+            fis[11] = static_cast<uint8_t>(numberOfSectors >> 8);
+            fis[12] = static_cast<uint8_t>(tag << 3);
+        } else {
+            fis[12] = static_cast<uint8_t>(numberOfSectors);
+            fis[13] = static_cast<uint8_t>(numberOfSectors >> 8);
+        }
+
+        auto address = reinterpret_cast<uint32_t>(buffer);
+        uint16_t entries = 0;
+        while(size > 0) {
+            const auto chunk = (size < MAX_PRDT_ENTRY_SIZE) ? size : MAX_PRDT_ENTRY_SIZE;
+            table.prdt[entries] = PRDTEntry{address, 0, 0, static_cast<uint32_t>(chunk - 1)};
+            address += static_cast<uint32_t>(chunk);
+            size -= chunk;
+            ++entries;
+        }
+
+        auto& header = commandList[tag];
+        constexpr uint16_t COMMAND_FIS_LENGTH = 5;
+        constexpr uint16_t WRITE_FLAG = 1 << 6;
+        header.flags = static_cast<uint16_t>(COMMAND_FIS_LENGTH | (write ? WRITE_FLAG : 0));
+        header.prdtLength = entries;
+        header.prdByteCount = 0;
+        compilerBarrier();
+    }
+
+    auto AHCIController::issueCommand(Tag tag, bool queued) -> void {
+        const auto bit = 1u << tag;
+        InterruptGuard guard;
+        outstandingTags = outstandingTags | bit;
+        if(queued) writeRegister(portRegisters, PX_SACT, bit);
+        writeRegister(portRegisters, PX_CI, bit);
+    }
+
+    auto AHCIController::submitImpl(uint32_t logicalBlockAddress, uint16_t numberOfSectors, const uint8_t* buffer, std::size_t size, bool write) -> xstd::expected<Tag, DiskError> {
+        if(portRegisters == nullptr) return xstd::unexpected(DiskError::NO_DEVICE);
+        const auto transferSize = numberOfSectors * ATA_SECTOR_SIZE;
+        if(size < transferSize) return xstd::unexpected(DiskError::BUFFER_TOO_SMALL);
+        if(reinterpret_cast<uint32_t>(buffer) % 2 != 0) return xstd::unexpected(DiskError::MISALIGNED_BUFFER);
+        if(numberOfSectors == 0 || transferSize > PRDT_ENTRIES_PER_TABLE * MAX_PRDT_ENTRY_SIZE) {
+            return xstd::unexpected(DiskError::BUFFER_TOO_SMALL);
+        }
+
+        const auto tag = allocateTag();
+        if(!tag) return tag;
+
+        const auto command = nativeCommandQueuing ?
+                                (write ? Command::WRITE_FPDMA_QUEUED : Command::READ_FPDMA_QUEUED) :
+                                (write ? Command::WRITE_DMA_EXT : Command::READ_DMA_EXT);
+        buildCommand(*tag, static_cast<uint8_t>(command), logicalBlockAddress, numberOfSectors, buffer, transferSize, write);
+        sectorCounts[*tag] = numberOfSectors;
+        issueCommand(*tag, nativeCommandQueuing);
+        return tag;
+    }
+
+    auto AHCIController::waitForCompletionImpl(Tag tag) -> xstd::expected<uint32_t, DiskError> {
+        const auto bit = 1u << tag;
+        if(!(allocatedTags & bit)) return xstd::unexpected(DiskError::DEVICE_ERROR);
+
+        InterruptManager::wait_until([this, bit]() { return ((completedTags | failedTags) & bit) != 0; },
+                                        [this]() { processCompletions(); }, interruptDriven);
+        compilerBarrier();
+
+        InterruptGuard guard;
+        const bool failed = failedTags & bit;
+        completedTags = completedTags & ~bit;
+        failedTags = failedTags & ~bit;
+        allocatedTags &= ~bit;
+        if(failed) return xstd::unexpected(DiskError::DEVICE_ERROR);
+        return sectorCounts[tag];
+    }
+
+    auto AHCIController::readSectors(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<uint8_t> destination) -> xstd::expected<uint32_t, DiskError> {
+        const auto tag = submitRead(logicalBlockAddress, numberOfSectors, destination);
+        if(!tag) return xstd::unexpected(tag.error());
+        return waitForCompletion(*tag);
+    }
+
+    auto AHCIController::writeSectors(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<const uint8_t> source) -> xstd::expected<uint32_t, DiskError> {
+        const auto tag = submitWrite(logicalBlockAddress, numberOfSectors, source);
+        if(!tag) return xstd::unexpected(tag.error());
+        return waitForCompletion(*tag);
+    }
+
+    // FLUSH CACHE EXT is not a queued command, and a non-queued command may only be issued while no queued
+    // ones are outstanding, so it waits for those first; it transfers no data and uses no PRDT entries.
+    auto AHCIController::flushCacheImpl() -> bool {
+        if(portRegisters == nullptr) return false;
+        InterruptManager::wait_until([this]() { return outstandingTags == 0; }, [this]() { processCompletions(); }, interruptDriven);
+
+        const auto tag = allocateTag();
+        if(!tag) return false;
+        buildCommand(*tag, static_cast<uint8_t>(Command::FLUSH_CACHE_EXT), 0, 0, nullptr, 0, false);
+        sectorCounts[*tag] = 0;
+        issueCommand(*tag, false);
+        return waitForCompletion(*tag).has_value();
+    }
+
+    auto AHCIController::interrupt_handler() -> void {
+        instance().processCompletions();
+    }
+
+    // Moves commands the HBA has finished (cleared from PxCI and PxSACT) from outstanding to completed.
+    // On a task file error every outstanding command is failed and the port is restarted; the drive
+    // aborts its whole queue on an NCQ error anyway.
+    auto AHCIController::processCompletions() -> void {
+        if(portRegisters == nullptr) return;
+        InterruptGuard guard;
+
+        const auto interruptStatus = readRegister(portRegisters, PX_IS);
+        writeRegister(portRegisters, PX_IS, interruptStatus);
+
+        if(interruptStatus & IS_ERRORS) {
+            failedTags = failedTags | outstandingTags;
+            outstandingTags = 0;
+            stopPort();
+            writeRegister(portRegisters, PX_IS, 0xffffffff);
+            startPort();
+        } else {
+            const auto stillActive = readRegister(portRegisters, PX_CI) | readRegister(portRegisters, PX_SACT);
+            const auto finished = outstandingTags & ~stillActive;
+            completedTags = completedTags | finished;
+            outstandingTags = outstandingTags & ~finished;
+        }
+        writeRegister(hbaRegisters, HBA_IS, 1u << portNumber);
+    }
+
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "ata.hpp"
+#include "xstd/array.hpp"
+#include "xstd/expected.hpp"
+#include "xstd/span.hpp"
+
+namespace LiOS86 {
+
+    // Driver for an AHCI host bus adapter, using the first port with a SATA disk attached.
+    // Up to 32 commands can be outstanding at once. If the drive supports native command queuing
+    // they are issued as READ/WRITE FPDMA QUEUED, so the drive may overlap and reorder them,
+    // otherwise as READ/WRITE DMA EXT executed in slot order. Completions are signalled by the
+    // controller's interrupt, or polled for if the firmware routed no interrupt line to it.
+    class AHCIController {
+        public:
+            AHCIController(const AHCIController&) = delete;
+            AHCIController& operator=(const AHCIController&) = delete;
+            AHCIController(AHCIController&&) = delete;
+            AHCIController& operator=(AHCIController&&) = delete;
+
+            static auto& instance() {
+                static AHCIController ahci_controller;
+                return ahci_controller;
+            }
+
+            using Tag = uint8_t;
+
+            static auto isAvailable() -> bool {
+                return instance().portRegisters != nullptr;
+            }
+
+            // queues a read into the (word-aligned) destination buffer without waiting for it;
+            // returns the tag to pass to waitForCompletion
+            static auto submitRead(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<uint8_t> destination) -> xstd::expected<Tag, DiskError> {
+                return instance().submitImpl(logicalBlockAddress, numberOfSectors, destination.data(), destination.size(), false);
+            }
+
+            static auto submitWrite(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<const uint8_t> source) -> xstd::expected<Tag, DiskError> {
+                return instance().submitImpl(logicalBlockAddress, numberOfSectors, source.data(), source.size(), true);
+            }
+
+            // waits until the command completes and releases its tag; returns the number of sectors transferred
+            static auto waitForCompletion(Tag tag) -> xstd::expected<uint32_t, DiskError> {
+                return instance().waitForCompletionImpl(tag);
+            }
+
+            // submit and wait for a single command, the PRDT covers the whole buffer
+            static auto readSectors(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<uint8_t> destination) -> xstd::expected<uint32_t, DiskError>;
+            static auto writeSectors(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<const uint8_t> source) -> xstd::expected<uint32_t, DiskError>;
+
+            // writes the drive's volatile cache to the media (FLUSH CACHE EXT), like flushCache in ata.hpp
+            static auto flushCache() -> bool {
+                return instance().flushCacheImpl();
+            }
+
+        private:
+            AHCIController();
+
+            auto initializePort() -> bool;
+            auto stopPort() -> void;
+            auto startPort() -> void;
+            auto identifyDevice() -> bool;
+
+            auto allocateTag() -> xstd::expected<Tag, DiskError>;
+            auto buildCommand(Tag tag, uint8_t command, uint32_t logicalBlockAddress, uint16_t numberOfSectors,
+                                const uint8_t* buffer, std::size_t size, bool write) -> void;
+            auto issueCommand(Tag tag, bool queued) -> void;
+
+            auto submitImpl(uint32_t logicalBlockAddress, uint16_t numberOfSectors, const uint8_t* buffer, std::size_t size, bool write) -> xstd::expected<Tag, DiskError>;
+            auto waitForCompletionImpl(Tag tag) -> xstd::expected<uint32_t, DiskError>;
+            auto flushCacheImpl() -> bool;
+
+            static auto interrupt_handler() -> void;
+            auto processCompletions() -> void;
+
+            volatile uint32_t* hbaRegisters{nullptr};
+            volatile uint32_t* portRegisters{nullptr};
+            uint8_t portNumber{0};
+
+            uint32_t usableTagsMask{0};
+            bool nativeCommandQueuing{false};
+            bool interruptDriven{false};        // an interrupt line is routed to the controller, otherwise completions are polled
+
+            // tags handed out by submit and not yet released by waitForCompletion
+            uint32_t allocatedTags{0};
+            // issued to the controller; updated from the interrupt handler as well
+            volatile uint32_t outstandingTags{0};
+            volatile uint32_t completedTags{0};
+            volatile uint32_t failedTags{0};
+            xstd::array<uint16_t, 32> sectorCounts{};
+    };
+
+}
@@ -1,5 +1,7 @@
 #include "ata.hpp"
 
+#include "ata_dma.hpp"
+#include "interrupt_manager.hpp"
 #include "ports.hpp"
 
 namespace LiOS86 {
@@ -14,45 +16,345 @@ namespace LiOS86 {
                 [[nodiscard]] constexpr auto dataTransferRequested() const -> bool {
                     return value & 0x08;
                 }
+                [[nodiscard]] constexpr auto deviceFault() const -> bool {
+                    return value & 0x20;
+                }
                 [[nodiscard]] constexpr auto deviceReady() const -> bool {
                     return value & 0x40;
                 }
                 [[nodiscard]] constexpr auto busy() const -> bool {
                     return value & 0x80;
                 }
+                [[nodiscard]] constexpr auto noDevice() const -> bool {
+                    return value == 0x00 || value == 0xff;
+                }
             private:
                 uint8_t value;
         };
         auto checkStatus() -> StatusRegisterValue {
             return inb(Port::ATA_PRIMARY_STATUS_REG);
-        }   
+        }
+
+        enum class Command : uint8_t {
+            READ_SECTORS = 0x20,
+            READ_SECTORS_EXT = 0x24,
+            READ_DMA_EXT = 0x25,
+            READ_MULTIPLE_EXT = 0x29,
+            WRITE_SECTORS = 0x30,
+            WRITE_SECTORS_EXT = 0x34,
+            WRITE_DMA_EXT = 0x35,
+            WRITE_MULTIPLE_EXT = 0x39,
+            READ_MULTIPLE = 0xc4,
+            WRITE_MULTIPLE = 0xc5,
+            SET_MULTIPLE_MODE = 0xc6,
+            READ_DMA = 0xc8,
+            WRITE_DMA = 0xca,
+            FLUSH_CACHE = 0xe7,
+            FLUSH_CACHE_EXT = 0xea,
+            IDENTIFY_DEVICE = 0xec,
+            SET_FEATURES = 0xef
+        };
+
+        constexpr std::size_t WORDS_PER_SECTOR = ATA_SECTOR_SIZE / 2;
+        constexpr uint32_t LBA28_SECTOR_LIMIT = 0x10000000;
+        constexpr uint32_t MAX_SECTORS_PER_LBA28_COMMAND = 256;        // written as 0 to the sector count register
+
+        // IDENTIFY DEVICE data, read once when the drive is initialized
+        uint16_t identifyData[WORDS_PER_SECTOR];
+
+        // number of sectors the drive transfers per DRQ block (0 until the drive has been initialized)
+        uint8_t sectorsPerBlock = 0;
+        bool dmaEnabled = false;
+        bool lba48Supported = false;
+
+        // set once IRQ 14 is routed to ataInterruptHandler; until then the status register is polled
+        bool interruptCompletion = false;
+        // set by the interrupt handler, cleared whenever a command is issued
+        volatile bool interruptReceived = false;
+
+        // reading the alternate status register takes ~100ns, the drive needs 400ns to update BSY after a command
+        auto delay400ns() -> void {
+            for(int i = 0; i < 4; ++i) {
+                inb(Port::ATA_PRIMARY_ALTERNATE_STATUS_REG);
+            }
+        }
+
+        auto waitWhileBusy() -> StatusRegisterValue {
+            while(true) {
+                const auto status = checkStatus();
+                if(!status.busy()) return status;
+            }
+        }
+
+        // Halts until the drive raises INTRQ (at the end of a command and whenever a PIO data block is ready).
+        // With interrupts disabled (e.g. inside the keyboard handler) the pending IRQ cannot be taken,
+        // so the alternate status register, which does not acknowledge the interrupt, is polled instead.
+        auto waitForInterrupt() -> void {
+            if(!interruptCompletion) return;
+            InterruptManager::wait_until([]() { return interruptReceived; }, []() {
+                if(!StatusRegisterValue{inb(Port::ATA_PRIMARY_ALTERNATE_STATUS_REG)}.busy()) interruptReceived = true;
+            });
+            interruptReceived = false;
+        }
+
+        // returns false if the drive reported an error instead of requesting a data transfer
+        auto waitForDataRequest() -> bool {
+            while(true) {
+                const auto status = waitWhileBusy();
+                if(status.error() || status.deviceFault()) return false;
+                if(status.dataTransferRequested()) return true;
+            }
+        }
+
+        // waits for a command without (further) data transfer to complete; returns false on error
+        auto waitForCompletion() -> bool {
+            waitForInterrupt();
+            const auto status = waitWhileBusy();
+            return !status.error() && !status.deviceFault();
+        }
+
+        // LBA28 command: 28-bit address, up to 256 sectors
+        auto issueCommand(Command command, uint32_t logicalBlockAddress, uint8_t sectorCount, uint8_t features = 0x00) -> void {
+            waitWhileBusy();
+
+            constexpr uint8_t slaveBit = 0;
+            outb(Port::ATA_PRIMARY_FEATURES_REG, features);
+            outb(Port::ATA_PRIMARY_SECTOR_COUNT_REG, sectorCount);
+            outb(Port::ATA_PRIMARY_LBA_LO, static_cast<uint8_t>(logicalBlockAddress));
+            outb(Port::ATA_PRIMARY_LBA_MID, static_cast<uint8_t>(logicalBlockAddress >> 8));
+            outb(Port::ATA_PRIMARY_LBA_HI, static_cast<uint8_t>(logicalBlockAddress >> 16));
+            outb(Port::ATA_PRIMARY_DRIVE_REG, 0xE0 | (slaveBit << 4) | ((logicalBlockAddress >> 24) & 0x0f));
+            interruptReceived = false;
+            outb(Port::ATA_PRIMARY_COMMAND_REG, static_cast<uint8_t>(command));
+            delay400ns();
+        }
+
+        // LBA48 (EXT) command: 48-bit address, up to 65536 sectors
+        auto issueCommandExt(Command command, uint32_t logicalBlockAddress, uint16_t sectorCount) -> void {
+            waitWhileBusy();
+
+            // the registers are two bytes deep: the high-order bytes are written first, then the low-order ones
+            constexpr uint8_t slaveBit = 0;
+            outb(Port::ATA_PRIMARY_SECTOR_COUNT_REG, static_cast<uint8_t>(sectorCount >> 8));
+            outb(Port::ATA_PRIMARY_LBA_LO, static_cast<uint8_t>(logicalBlockAddress >> 24));
+            outb(Port::ATA_PRIMARY_LBA_MID, 0);
+            outb(Port::ATA_PRIMARY_LBA_HI, 0);
+            outb(Port::ATA_PRIMARY_SECTOR_COUNT_REG, static_cast<uint8_t>(sectorCount));
+            outb(Port::ATA_PRIMARY_LBA_LO, static_cast<uint8_t>(logicalBlockAddress));
+            outb(Port::ATA_PRIMARY_LBA_MID, static_cast<uint8_t>(logicalBlockAddress >> 8));
+            outb(Port::ATA_PRIMARY_LBA_HI, static_cast<uint8_t>(logicalBlockAddress >> 16));
+            outb(Port::ATA_PRIMARY_DRIVE_REG, 0x40 | (slaveBit << 4));
+            interruptReceived = false;
+            outb(Port::ATA_PRIMARY_COMMAND_REG, static_cast<uint8_t>(command));
+            delay400ns();
+        }
+
+        // The EXT commands take twice as many register writes, so they are only used when the transfer
+        // reaches beyond the 28-bit address range or more than 256 sectors are transferred at once.
+        auto needsLBA48(uint32_t logicalBlockAddress, uint32_t numberOfSectors) -> bool {
+            return logicalBlockAddress + numberOfSectors > LBA28_SECTOR_LIMIT || numberOfSectors > MAX_SECTORS_PER_LBA28_COMMAND;
+        }
+
+        auto issueTransferCommand(Command command, Command extCommand, uint32_t logicalBlockAddress, uint16_t numberOfSectors) -> void {
+            if(needsLBA48(logicalBlockAddress, numberOfSectors)) {
+                issueCommandExt(extCommand, logicalBlockAddress, numberOfSectors);
+            } else {
+                issueCommand(command, logicalBlockAddress, static_cast<uint8_t>(numberOfSectors));
+            }
+        }
+
+        // index of the highest set bit in the low byte of an IDENTIFY word (-1 if none is set)
+        auto highestSupportedMode(uint16_t identifyWord) -> int {
+            for(int mode = 7; mode >= 0; --mode) {
+                if(identifyWord & (1 << mode)) return mode;
+            }
+            return -1;
+        }
+
+        // selects the fastest (Ultra or multiword) DMA mode reported by IDENTIFY DEVICE
+        auto enableDMAMode() -> bool {
+            // word 49, bit 8 - DMA supported
+            if(!(identifyData[49] & (1 << 8))) return false;
+
+            constexpr uint8_t SET_TRANSFER_MODE = 0x03;
+            constexpr uint8_t ULTRA_DMA_MODE = 0x40;
+            constexpr uint8_t MULTIWORD_DMA_MODE = 0x20;
+
+            // word 53, bit 2 - word 88 (Ultra DMA modes) is valid; word 63 - multiword DMA modes
+            const auto ultraMode = (identifyData[53] & (1 << 2)) ? highestSupportedMode(identifyData[88]) : -1;
+            const auto multiwordMode = highestSupportedMode(identifyData[63] & 0x07);
+            uint8_t transferMode;
+            if(ultraMode >= 0) {
+                transferMode = static_cast<uint8_t>(ULTRA_DMA_MODE | ultraMode);
+            } else if(multiwordMode >= 0) {
+                transferMode = static_cast<uint8_t>(MULTIWORD_DMA_MODE | multiwordMode);
+            } else {
+                return false;
+            }
+
+            issueCommand(Command::SET_FEATURES, 0, transferMode, SET_TRANSFER_MODE);
+            if(!waitForCompletion()) return false;
+            return IDEBusMaster::initialize();
+        }
+
+        // Reads and caches the IDENTIFY DEVICE data, enables the largest READ/WRITE MULTIPLE block size the drive supports
+        // and bus-master DMA if both the drive and the controller support it.
+        // Falls back to single-sector blocks (plain READ/WRITE SECTORS) if multiple mode is not available.
+        auto initializeDrive() -> void {
+            sectorsPerBlock = 1;
+
+            issueCommand(Command::IDENTIFY_DEVICE, 0, 0);
+            if(checkStatus().noDevice()) return;
+            waitForInterrupt();
+            if(!waitForDataRequest()) return;
+
+            insw(Port::ATA_PRIMARY_DATA_REG, identifyData, WORDS_PER_SECTOR);
+
+            // word 86, bit 10 - 48-bit Address feature set enabled
+            lba48Supported = identifyData[86] & (1 << 10);
+            dmaEnabled = enableDMAMode();
+
+            // word 47, bits 7:0 - maximum number of sectors per DRQ block for READ/WRITE MULTIPLE
+            const auto maxSectorsPerBlock = static_cast<uint8_t>(identifyData[47]);
+            if(maxSectorsPerBlock <= 1) return;
+
+            issueCommand(Command::SET_MULTIPLE_MODE, 0, maxSectorsPerBlock);
+            if(!waitForCompletion()) return;
+            sectorsPerBlock = maxSectorsPerBlock;
+        }
+
+        auto transferDMA(Command command, Command extCommand, uint32_t logicalBlockAddress, uint16_t numberOfSectors,
+                            const uint8_t* buffer, IDEBusMaster::Direction direction) -> bool {
+            IDEBusMaster::prepareTransfer(buffer, numberOfSectors * ATA_SECTOR_SIZE, direction);
+            issueTransferCommand(command, extCommand, logicalBlockAddress, numberOfSectors);
+            IDEBusMaster::startTransfer();
+            const auto commandSucceeded = waitForCompletion();
+            const auto dmaSucceeded = IDEBusMaster::finishTransfer();
+            return commandSucceeded && dmaSucceeded;
+        }
+
+        // transfers at most one command's worth of sectors; returns false on error
+        auto readCommand(uint32_t logicalBlockAddress, uint16_t numberOfSectors, uint8_t* destinationPtr) -> bool {
+            if(dmaEnabled && IDEBusMaster::canTransfer(destinationPtr, numberOfSectors * ATA_SECTOR_SIZE)) {
+                return transferDMA(Command::READ_DMA, Command::READ_DMA_EXT, logicalBlockAddress, numberOfSectors,
+                                    destinationPtr, IDEBusMaster::Direction::TO_MEMORY);
+            }
+
+            if(sectorsPerBlock > 1) {
+                issueTransferCommand(Command::READ_MULTIPLE, Command::READ_MULTIPLE_EXT, logicalBlockAddress, numberOfSectors);
+            } else {
+                issueTransferCommand(Command::READ_SECTORS, Command::READ_SECTORS_EXT, logicalBlockAddress, numberOfSectors);
+            }
+
+            std::size_t remainingSectors = numberOfSectors;
+            while(remainingSectors > 0) {
+                waitForInterrupt();
+                if(!waitForDataRequest()) return false;
+                const std::size_t blockSectors = (remainingSectors < sectorsPerBlock) ? remainingSectors : sectorsPerBlock;
+                insw(Port::ATA_PRIMARY_DATA_REG, destinationPtr, blockSectors * WORDS_PER_SECTOR);
+                destinationPtr += blockSectors * ATA_SECTOR_SIZE;
+                remainingSectors -= blockSectors;
+            }
+            return true;
+        }
+
+        auto writeCommand(uint32_t logicalBlockAddress, uint16_t numberOfSectors, const uint8_t* sourcePtr) -> bool {
+            if(dmaEnabled && IDEBusMaster::canTransfer(sourcePtr, numberOfSectors * ATA_SECTOR_SIZE)) {
+                return transferDMA(Command::WRITE_DMA, Command::WRITE_DMA_EXT, logicalBlockAddress, numberOfSectors,
+                                    sourcePtr, IDEBusMaster::Direction::FROM_MEMORY);
+            }
+
+            if(sectorsPerBlock > 1) {
+                issueTransferCommand(Command::WRITE_MULTIPLE, Command::WRITE_MULTIPLE_EXT, logicalBlockAddress, numberOfSectors);
+            } else {
+                issueTransferCommand(Command::WRITE_SECTORS, Command::WRITE_SECTORS_EXT, logicalBlockAddress, numberOfSectors);
+            }
+
+            std::size_t remainingSectors = numberOfSectors;
+            while(remainingSectors > 0) {
+                // the drive requests the first block without an interrupt, every following one with
+                if(remainingSectors < numberOfSectors) waitForInterrupt();
+                if(!waitForDataRequest()) return false;
+                const std::size_t blockSectors = (remainingSectors < sectorsPerBlock) ? remainingSectors : sectorsPerBlock;
+                outsw(Port::ATA_PRIMARY_DATA_REG, sourcePtr, blockSectors * WORDS_PER_SECTOR);
+                sourcePtr += blockSectors * ATA_SECTOR_SIZE;
+                remainingSectors -= blockSectors;
+            }
+            return waitForCompletion();
+        }
+
+        // largest number of sectors a single command can transfer
+        auto maxSectorsPerCommand() -> uint32_t {
+            return lba48Supported ? 0xffff : MAX_SECTORS_PER_LBA28_COMMAND;
+        }
     }
 
-    auto readSectors(uint32_t logicalBlockAddress, uint8_t numberOfSectors) -> xstd::expected<xstd::array<uint8_t, 512>, int> {
-        while(checkStatus().busy()) { }
-        
-        constexpr uint8_t slaveBit = 0;
-        outb(Port::ATA_PRIMARY_FEATURES_REG, 0x00);
-        outb(Port::ATA_PRIMARY_SECTOR_COUNT_REG, numberOfSectors);
-        outb(Port::ATA_PRIMARY_LBA_LO, static_cast<uint8_t>(logicalBlockAddress));
-        outb(Port::ATA_PRIMARY_LBA_MID, static_cast<uint8_t>(logicalBlockAddress >> 8));
-        outb(Port::ATA_PRIMARY_LBA_HI, static_cast<uint8_t>(logicalBlockAddress >> 16));
-        outb(Port::ATA_PRIMARY_DRIVE_REG, 0xE0 | (slaveBit << 4) | ((logicalBlockAddress >> 24) & 0x0f));
-        outb(Port::ATA_PRIMARY_COMMAND_REG, 0x20);
-
-        while(true) {
-            auto status = checkStatus();
-            if(status.error()) return xstd::unexpected<int>{-1};
-            if(status.dataTransferRequested()) break;
-        }
-
-        xstd::expected<xstd::array<uint8_t, 512>, int> result;
-        for(int i = 0; i < 256; ++i) {
-            auto word = inw(Port::ATA_PRIMARY_DATA_REG);
-            (*result)[2*i] = static_cast<uint8_t>(word);
-            (*result)[2*i + 1] = static_cast<uint8_t>(word >> 8);
-        }
-        return result;
-    }  
+    auto readSectors(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<uint8_t> destination) -> xstd::expected<uint32_t, DiskError> {
+        if(destination.size() < numberOfSectors * ATA_SECTOR_SIZE) {
+            return xstd::unexpected(DiskError::BUFFER_TOO_SMALL);
+        }
+        if(sectorsPerBlock == 0) initializeDrive();
+
+        uint32_t sectorsRead = 0;
+        while(sectorsRead < numberOfSectors) {
+            const auto remainingSectors = numberOfSectors - sectorsRead;
+            const auto commandSectors = static_cast<uint16_t>((remainingSectors < maxSectorsPerCommand()) ? remainingSectors : maxSectorsPerCommand());
+            if(!readCommand(logicalBlockAddress + sectorsRead, commandSectors, destination.data() + sectorsRead * ATA_SECTOR_SIZE)) {
+                return xstd::unexpected(DiskError::DEVICE_ERROR);
+            }
+            sectorsRead += commandSectors;
+        }
+        return sectorsRead;
+    }
+
+    auto writeSectors(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<const uint8_t> source) -> xstd::expected<uint32_t, DiskError> {
+        if(source.size() < numberOfSectors * ATA_SECTOR_SIZE) {
+            return xstd::unexpected(DiskError::BUFFER_TOO_SMALL);
+        }
+        if(sectorsPerBlock == 0) initializeDrive();
+
+        uint32_t sectorsWritten = 0;
+        while(sectorsWritten < numberOfSectors) {
+            const auto remainingSectors = numberOfSectors - sectorsWritten;
+            const auto commandSectors = static_cast<uint16_t>((remainingSectors < maxSectorsPerCommand()) ? remainingSectors : maxSectorsPerCommand());
+            if(!writeCommand(logicalBlockAddress + sectorsWritten, commandSectors, source.data() + sectorsWritten * ATA_SECTOR_SIZE)) {
+                return xstd::unexpected(DiskError::DEVICE_ERROR);
+            }
+            sectorsWritten += commandSectors;
+        }
+        return sectorsWritten;
+    }
+
+    auto getDiskSizeInSectors() -> uint64_t {
+        if(sectorsPerBlock == 0) initializeDrive();
+        // words 100-103 - number of sectors addressable with LBA48, words 60-61 - with LBA28
+        if(lba48Supported) {
+            return static_cast<uint64_t>(identifyData[100]) | static_cast<uint64_t>(identifyData[101]) << 16 |
+                    static_cast<uint64_t>(identifyData[102]) << 32 | static_cast<uint64_t>(identifyData[103]) << 48;
+        }
+        return static_cast<uint64_t>(identifyData[60]) | static_cast<uint64_t>(identifyData[61]) << 16;
+    }
+
+    auto ataInterruptHandler() -> void {
+        // reading the status register acknowledges the interrupt
+        checkStatus();
+        interruptReceived = true;
+    }
+
+    auto enableInterruptCompletion() -> void {
+        // clear nIEN so the drive asserts INTRQ
+        outb(Port::ATA_PRIMARY_DEVICE_CONTROL_REG, 0x00);
+        interruptCompletion = true;
+    }
+
+    auto flushCache() -> bool {
+        if(sectorsPerBlock == 0) initializeDrive();
+        if(lba48Supported) {
+            issueCommandExt(Command::FLUSH_CACHE_EXT, 0, 0);
+        } else {
+            issueCommand(Command::FLUSH_CACHE, 0, 0);
+        }
+        return waitForCompletion();
+    }
 
 }
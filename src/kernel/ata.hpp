@@ -1,13 +1,42 @@
 #pragma once
 
 #include <stdint.h>
+#include <cstddef>
 
 #include "xstd/expected.hpp"
-#include "xstd/array.hpp"
+#include "xstd/span.hpp"
 
 namespace LiOS86 {
 
-    // uses PIO to read sectors from the primary master ATA disk (LBA24 addressing)
-    auto readSectors(uint32_t logicalBlockAddress, uint8_t numberOfSectors) -> xstd::expected<xstd::array<uint8_t, 512>, int>;
+    constexpr std::size_t ATA_SECTOR_SIZE = 512;
+
+    enum class DiskError : uint8_t { DEVICE_ERROR, BUFFER_TOO_SMALL, MISALIGNED_BUFFER, QUEUE_FULL, NO_DEVICE, CACHE_FULL };
+
+    // reads sectors from the primary master ATA disk straight into the destination buffer,
+    // which has to hold at least numberOfSectors sectors;
+    // LBA48 (EXT) commands are used if the drive supports them and the transfer needs them (addresses beyond
+    // 28 bits or more than 256 sectors), so all sectors are read with a single command; drives without LBA48
+    // get one command per 256 sectors
+    // uses bus-master DMA if the controller supports it and the buffer is word-aligned,
+    // otherwise PIO with sectors transferred in blocks (READ MULTIPLE) if the drive supports it
+    // returns the number of sectors read
+    auto readSectors(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<uint8_t> destination) -> xstd::expected<uint32_t, DiskError>;
+
+    // writes sectors to the primary master ATA disk, selecting DMA or PIO the same way readSectors does
+    // returns the number of sectors written
+    auto writeSectors(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<const uint8_t> source) -> xstd::expected<uint32_t, DiskError>;
+
+    // disk capacity from the IDENTIFY DEVICE data cached when the drive was initialized
+    auto getDiskSizeInSectors() -> uint64_t;
+
+    // IRQ 14 handler of the primary ATA channel (interrupt 0x2e)
+    auto ataInterruptHandler() -> void;
+
+    // makes disk accesses halt the CPU until the drive raises its interrupt instead of spinning on the status register;
+    // ataInterruptHandler has to be registered first (the loader, without an IDT, never calls this and keeps polling)
+    auto enableInterruptCompletion() -> void;
+
+    // commits the drive's write cache to the medium; returns false if the drive reported an error
+    auto flushCache() -> bool;
 
 }
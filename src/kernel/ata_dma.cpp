@@ -0,0 +1,124 @@
+#include "ata_dma.hpp"
+
+#include "mmio.hpp"
+#include "pci.hpp"
+#include "ports.hpp"
+
+namespace LiOS86::IDEBusMaster {
+
+    namespace {
+        // Physical Region Descriptor, describes one physically contiguous chunk of the transfer buffer
+        struct PRDEntry {
+            uint32_t physicalAddress;
+            uint16_t byteCount;             // 0 means 64 KiB
+            uint16_t flags;
+        } __attribute__((packed));
+        static_assert( sizeof(PRDEntry) == 8, "PRDEntry has incorrect size" );
+
+        constexpr uint16_t PRD_END_OF_TABLE = 0x8000;
+        constexpr uint32_t PRD_BOUNDARY = 0x10000;     // a single entry may not cross a 64 KiB boundary
+        // enough for the largest LBA48 command (65535 sectors) in a buffer that does not start on a 64 KiB boundary
+        constexpr std::size_t MAX_PRD_ENTRIES = 0xffff * 512 / PRD_BOUNDARY + 2;
+        constexpr std::size_t PRD_TABLE_ALIGNMENT = 0x2000;
+
+        // the table itself has to be dword-aligned and may not cross a 64 KiB boundary either
+        PRDEntry prdTable[MAX_PRD_ENTRIES] __attribute__((aligned(PRD_TABLE_ALIGNMENT)));
+        static_assert( sizeof(prdTable) <= PRD_TABLE_ALIGNMENT, "PRD table could cross a 64 KiB boundary" );
+
+        // bus master register offsets for the primary channel (relative to BAR4)
+        constexpr uint16_t COMMAND_REG_OFFSET = 0;
+        constexpr uint16_t STATUS_REG_OFFSET = 2;
+        constexpr uint16_t PRDT_ADDRESS_REG_OFFSET = 4;
+
+        constexpr uint8_t COMMAND_START = 0x01;
+        constexpr uint8_t COMMAND_READ_TO_MEMORY = 0x08;
+
+        constexpr uint8_t STATUS_ACTIVE = 0x01;
+        constexpr uint8_t STATUS_ERROR = 0x02;
+        constexpr uint8_t STATUS_INTERRUPT = 0x04;
+
+        uint16_t busMasterBase = 0;
+
+        auto busMasterPort(uint16_t offset) -> Port {
+            return static_cast<Port>(busMasterBase + offset);
+        }
+
+        auto numberOfPRDEntries(uint32_t address, std::size_t size) -> std::size_t {
+            std::size_t entries = 0;
+            while(size > 0) {
+                const std::size_t toBoundary = PRD_BOUNDARY - (address % PRD_BOUNDARY);
+                const auto chunk = (size < toBoundary) ? size : toBoundary;
+                address += static_cast<uint32_t>(chunk);
+                size -= chunk;
+                ++entries;
+            }
+            return entries;
+        }
+    }
+
+    auto initialize() -> bool {
+        constexpr uint8_t MASS_STORAGE_CLASS = 0x01;
+        constexpr uint8_t IDE_SUBCLASS = 0x01;
+        constexpr uint8_t PROG_IF_BUS_MASTER = 0x80;
+
+        const auto controller = findPCIDevice(MASS_STORAGE_CLASS, IDE_SUBCLASS);
+        if(!controller) return false;
+        if(!(controller->getProgIF() & PROG_IF_BUS_MASTER) || !controller->isIOSpaceBAR(4)) return false;
+
+        busMasterBase = static_cast<uint16_t>(controller->getBARAddress(4));
+        if(busMasterBase == 0) return false;
+        controller->enableIOSpace();
+        controller->enableBusMastering();
+
+        outb(busMasterPort(COMMAND_REG_OFFSET), 0);
+        outb(busMasterPort(STATUS_REG_OFFSET), STATUS_ERROR | STATUS_INTERRUPT);
+        return true;
+    }
+
+    auto canTransfer(const uint8_t* buffer, std::size_t size) -> bool {
+        const auto address = reinterpret_cast<uint32_t>(buffer);
+        if(busMasterBase == 0 || size == 0) return false;
+        if((address % 2) != 0 || (size % 2) != 0) return false;
+        return numberOfPRDEntries(address, size) <= MAX_PRD_ENTRIES;
+    }
+
+    auto prepareTransfer(const uint8_t* buffer, std::size_t size, Direction direction) -> void {
+        auto address = reinterpret_cast<uint32_t>(buffer);
+        std::size_t entry = 0;
+        while(size > 0) {
+            const std::size_t toBoundary = PRD_BOUNDARY - (address % PRD_BOUNDARY);
+            const auto chunk = (size < toBoundary) ? size : toBoundary;
+            prdTable[entry] = PRDEntry{address, static_cast<uint16_t>(chunk), 0};
+            address += static_cast<uint32_t>(chunk);
+            size -= chunk;
+            ++entry;
+        }
+        prdTable[entry - 1].flags = PRD_END_OF_TABLE;
+        compilerBarrier();
+
+        outl(busMasterPort(PRDT_ADDRESS_REG_OFFSET), reinterpret_cast<uint32_t>(&prdTable[0]));
+        outb(busMasterPort(COMMAND_REG_OFFSET), (direction == Direction::TO_MEMORY) ? COMMAND_READ_TO_MEMORY : uint8_t{0});
+        outb(busMasterPort(STATUS_REG_OFFSET), STATUS_ERROR | STATUS_INTERRUPT);
+    }
+
+    auto startTransfer() -> void {
+        const auto command = inb(busMasterPort(COMMAND_REG_OFFSET));
+        outb(busMasterPort(COMMAND_REG_OFFSET), static_cast<uint8_t>(command | COMMAND_START));
+    }
+
+    auto finishTransfer() -> bool {
+        uint8_t status;
+        do {
+            status = inb(busMasterPort(STATUS_REG_OFFSET));
+        } while(!(status & (STATUS_INTERRUPT | STATUS_ERROR)) && (status & STATUS_ACTIVE));
+
+        const auto command = inb(busMasterPort(COMMAND_REG_OFFSET));
+        outb(busMasterPort(COMMAND_REG_OFFSET), static_cast<uint8_t>(command & ~COMMAND_START));
+        // interrupt and error bits are cleared by writing 1s, the other bits are preserved
+        outb(busMasterPort(STATUS_REG_OFFSET), status);
+        compilerBarrier();
+
+        return !(status & STATUS_ERROR);
+    }
+
+}
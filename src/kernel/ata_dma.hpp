@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+
+// Bus-master DMA engine of the primary channel of a PCI IDE controller (PIIX3/PIIX4).
+// The engine only moves data; ATA commands (READ DMA/WRITE DMA) are issued by ata.cpp.
+// Buffers are handed to the controller by address, which relies on the kernel
+// running with identity-mapped physical memory (no paging).
+
+namespace LiOS86::IDEBusMaster {
+
+    enum class Direction : bool { TO_MEMORY, FROM_MEMORY };
+
+    // locates the PCI IDE controller and enables bus mastering; returns false if there is none
+    auto initialize() -> bool;
+
+    // a buffer can be transferred if it is word-aligned and its PRD table fits the preallocated one
+    auto canTransfer(const uint8_t* buffer, std::size_t size) -> bool;
+
+    // builds the PRD table for the buffer and sets the transfer direction;
+    // the ATA command has to be issued after preparing and before starting the transfer
+    auto prepareTransfer(const uint8_t* buffer, std::size_t size, Direction direction) -> void;
+    auto startTransfer() -> void;
+
+    // waits for the drive to raise its interrupt and stops the engine;
+    // returns false if the controller reported a DMA error
+    auto finishTransfer() -> bool;
+
+}
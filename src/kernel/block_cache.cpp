@@ -0,0 +1,248 @@
+#include "block_cache.hpp"
+
+#include "block_device.hpp"
+#include "block_queue.hpp"
+#include "utils/error_handling.hpp"
+#include "xstd/cstring.hpp"
+
+namespace LiOS86 {
+
+    namespace {
+        // Sector-aligned so the blocks can be handed to the DMA-capable drivers directly. Kept out of the
+        // singleton so it is zeroed with .bss instead of by a memset call in the constructor (no libc to provide it).
+        alignas(ATA_SECTOR_SIZE) xstd::array<xstd::array<uint8_t, ATA_SECTOR_SIZE>, BlockCache::CAPACITY> blockBuffers;
+    }
+
+    BlockCache::BlockCache() {
+        buckets.fill(NO_BLOCK);
+    }
+
+    auto BlockCache::blockData(BlockIndex block) -> uint8_t* {
+        return blockBuffers[block].data();
+    }
+
+    auto BlockCache::lookup(uint32_t sectorNumber) -> BlockIndex {
+        auto block = buckets[bucketOf(sectorNumber)];
+        while(block != NO_BLOCK && blocks[block].sectorNumber != sectorNumber) {
+            block = blocks[block].nextInBucket;
+        }
+        return block;
+    }
+
+    auto BlockCache::insertIntoBucket(BlockIndex block) -> void {
+        auto& bucket = buckets[bucketOf(blocks[block].sectorNumber)];
+        blocks[block].nextInBucket = bucket;
+        bucket = block;
+    }
+
+    auto BlockCache::removeFromBucket(BlockIndex block) -> void {
+        auto* link = &buckets[bucketOf(blocks[block].sectorNumber)];
+        while(*link != block) {
+            link = &blocks[*link].nextInBucket;
+        }
+        *link = blocks[block].nextInBucket;
+        blocks[block].nextInBucket = NO_BLOCK;
+    }
+
+    auto BlockCache::writeBack(BlockIndex block) -> bool {
+        const auto result = activeBlockDevice().write(blocks[block].sectorNumber, 1, xstd::span<const uint8_t>(blockBuffers[block]));
+        if(!result) return false;
+        blocks[block].dirty = false;
+        return true;
+    }
+
+    // Picks a block with CLOCK: the hand skips pinned blocks and gives recently used ones a second chance.
+    // The returned block is already indexed under the new sector number; its contents have to be filled by the caller.
+    auto BlockCache::allocateBlock(uint32_t sectorNumber) -> xstd::expected<BlockIndex, DiskError> {
+        for(std::size_t step = 0; step < 2 * CAPACITY; ++step) {
+            const auto block = clockHand;
+            clockHand = static_cast<BlockIndex>((clockHand + 1) % CAPACITY);
+
+            auto& candidate = blocks[block];
+            if(candidate.valid) {
+                if(candidate.referenceCount > 0) continue;
+                if(candidate.recentlyUsed) {
+                    candidate.recentlyUsed = false;
+                    continue;
+                }
+                if(candidate.dirty && !writeBack(block)) return xstd::unexpected(DiskError::DEVICE_ERROR);
+                removeFromBucket(block);
+            }
+
+            candidate.sectorNumber = sectorNumber;
+            candidate.valid = true;
+            candidate.dirty = false;
+            candidate.recentlyUsed = true;
+            insertIntoBucket(block);
+            return block;
+        }
+        return xstd::unexpected(DiskError::CACHE_FULL);
+    }
+
+    auto BlockCache::acquireImpl(uint32_t sectorNumber) -> xstd::expected<BlockIndex, DiskError> {
+        const auto cached = lookup(sectorNumber);
+        if(cached != NO_BLOCK) {
+            blocks[cached].recentlyUsed = true;
+            ++blocks[cached].referenceCount;
+            return cached;
+        }
+
+        const auto block = allocateBlock(sectorNumber);
+        if(!block) return block;
+        const auto result = activeBlockDevice().read(sectorNumber, 1, xstd::span<uint8_t>(blockBuffers[*block]));
+        if(!result) {
+            removeFromBucket(*block);
+            blocks[*block].valid = false;
+            return xstd::unexpected(result.error());
+        }
+        ++blocks[*block].referenceCount;
+        return block;
+    }
+
+    auto BlockCache::readImpl(uint32_t firstSector, uint16_t numberOfSectors, xstd::span<uint8_t> destination, bool cacheRead) -> xstd::expected<uint32_t, DiskError> {
+        if(destination.size() < numberOfSectors * ATA_SECTOR_SIZE) {
+            return xstd::unexpected(DiskError::BUFFER_TOO_SMALL);
+        }
+        // a memory-mapped image is as fast as the cache itself
+        if(activeBlockDevice().isMemoryMapped()) return activeBlockDevice().read(firstSector, numberOfSectors, destination);
+
+        uint32_t i = 0;
+        while(i < numberOfSectors) {
+            const auto cached = lookup(firstSector + i);
+            if(cached != NO_BLOCK) {
+                xstd::memcpy(destination.data() + i * ATA_SECTOR_SIZE, blockBuffers[cached].data(), ATA_SECTOR_SIZE);
+                blocks[cached].recentlyUsed = true;
+                ++i;
+                continue;
+            }
+
+            uint32_t runEnd = i + 1;
+            while(runEnd < numberOfSectors && lookup(firstSector + runEnd) == NO_BLOCK) {
+                ++runEnd;
+            }
+            const auto runLength = static_cast<uint16_t>(runEnd - i);
+            const auto result = activeBlockDevice().read(firstSector + i, runLength, destination.subspan(i * ATA_SECTOR_SIZE, runLength * ATA_SECTOR_SIZE));
+            if(!result) return xstd::unexpected(result.error());
+            if(!cacheRead) {
+                i = runEnd;
+                continue;
+            }
+
+            for(; i < runEnd; ++i) {
+                const auto block = allocateBlock(firstSector + i);
+                // the data has been read already, it just does not get cached
+                if(!block) continue;
+                xstd::memcpy(blockBuffers[*block].data(), destination.data() + i * ATA_SECTOR_SIZE, ATA_SECTOR_SIZE);
+            }
+        }
+        return numberOfSectors;
+    }
+
+    auto BlockCache::writeImpl(uint32_t firstSector, uint16_t numberOfSectors, xstd::span<const uint8_t> source, bool cacheWrite) -> xstd::expected<uint32_t, DiskError> {
+        if(source.size() < numberOfSectors * ATA_SECTOR_SIZE) {
+            return xstd::unexpected(DiskError::BUFFER_TOO_SMALL);
+        }
+        if(activeBlockDevice().isMemoryMapped()) return activeBlockDevice().write(firstSector, numberOfSectors, source);
+
+        if(!cacheWrite) {
+            const auto result = activeBlockDevice().write(firstSector, numberOfSectors, source);
+            if(!result) return xstd::unexpected(result.error());
+            // the disk now holds the newest data, including that of dirty copies
+            for(uint32_t i = 0; i < numberOfSectors; ++i) {
+                const auto block = lookup(firstSector + i);
+                if(block == NO_BLOCK) continue;
+                xstd::memcpy(blockBuffers[block].data(), source.data() + i * ATA_SECTOR_SIZE, ATA_SECTOR_SIZE);
+                blocks[block].dirty = false;
+            }
+            return numberOfSectors;
+        }
+
+        for(uint32_t i = 0; i < numberOfSectors; ++i) {
+            const auto sectorSource = source.subspan(i * ATA_SECTOR_SIZE, ATA_SECTOR_SIZE);
+            auto block = lookup(firstSector + i);
+            if(block == NO_BLOCK) {
+                const auto allocated = allocateBlock(firstSector + i);
+                if(!allocated) {
+                    // no block can be evicted, write through instead
+                    const auto result = activeBlockDevice().write(firstSector + i, 1, sectorSource);
+                    if(!result) return xstd::unexpected(result.error());
+                    continue;
+                }
+                block = *allocated;
+            }
+            xstd::memcpy(blockBuffers[block].data(), sectorSource.data(), ATA_SECTOR_SIZE);
+            blocks[block].dirty = true;
+            blocks[block].recentlyUsed = true;
+        }
+        return numberOfSectors;
+    }
+
+    // The blocks are pinned until the request queue has filled them, so a long prefetch cannot evict its own blocks;
+    // the queue merges adjacent sectors into single commands.
+    auto BlockCache::prefetchImpl(uint32_t firstSector, uint16_t numberOfSectors) -> bool {
+        if(activeBlockDevice().isMemoryMapped()) return true;
+
+        xstd::array<BlockIndex, CAPACITY> fetchedBlocks{};
+        std::size_t numberOfFetched = 0;
+        bool succeeded = true;
+
+        for(uint32_t i = 0; i < numberOfSectors && numberOfFetched < CAPACITY; ++i) {
+            if(lookup(firstSector + i) != NO_BLOCK) continue;
+            const auto block = allocateBlock(firstSector + i);
+            if(!block) break;
+            ++blocks[*block].referenceCount;
+            fetchedBlocks[numberOfFetched++] = *block;
+            succeeded = BlockRequestQueue::submitRead(firstSector + i, 1, xstd::span<uint8_t>(blockBuffers[*block])).has_value() && succeeded;
+        }
+        succeeded = BlockRequestQueue::dispatch().has_value() && succeeded;
+
+        for(std::size_t i = 0; i < numberOfFetched; ++i) {
+            auto& block = blocks[fetchedBlocks[i]];
+            --block.referenceCount;
+            // not used yet, so unused readahead is the first to go
+            block.recentlyUsed = false;
+            if(!succeeded) {
+                removeFromBucket(fetchedBlocks[i]);
+                block.valid = false;
+            }
+        }
+        return succeeded;
+    }
+
+    // The dirty blocks go through the request queue, which sorts them and merges adjacent sectors into single writes.
+    // If any write fails, all blocks stay dirty and are simply written again on the next flush.
+    auto BlockCache::flushImpl() -> bool {
+        bool succeeded = true;
+        for(BlockIndex block = 0; block < CAPACITY; ++block) {
+            if(!blocks[block].valid || !blocks[block].dirty) continue;
+            const auto result = BlockRequestQueue::submitWrite(blocks[block].sectorNumber, 1, xstd::span<const uint8_t>(blockBuffers[block]));
+            succeeded = result.has_value() && succeeded;
+        }
+        succeeded = BlockRequestQueue::dispatch().has_value() && succeeded;
+
+        if(succeeded) {
+            for(auto& block : blocks) {
+                block.dirty = false;
+            }
+        }
+        return activeBlockDevice().flush() && succeeded;
+    }
+
+    auto BlockCache::invalidateImpl() -> void {
+        for(BlockIndex block = 0; block < CAPACITY; ++block) {
+            if(blocks[block].valid) removeFromBucket(block);
+            blocks[block].valid = false;
+            blocks[block].dirty = false;
+        }
+    }
+
+    // sectors of a memory-mapped device are accessed in place, without a cache block
+    CachedSector::CachedSector(uint32_t sectorNumber) : data{activeBlockDevice().mappedSector(sectorNumber)}, block{BlockCache::NO_BLOCK} {
+        if(data != nullptr) return;
+        const auto acquired = BlockCache::acquire(sectorNumber);
+        if(!acquired) kpanic("Error reading from the disk. Halting.");
+        block = *acquired;
+        data = BlockCache::blockData(block);
+    }
+
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "ata.hpp"
+#include "xstd/array.hpp"
+#include "xstd/expected.hpp"
+#include "xstd/span.hpp"
+
+namespace LiOS86 {
+
+    // Global write-back cache of disk sectors, indexed by a hash table on the sector number.
+    // Blocks are evicted with the CLOCK algorithm (an approximation of LRU); blocks that are
+    // referenced (pinned) by a CachedSector are never evicted, dirty ones are written back first.
+    // All disk accesses that may touch cached sectors have to go through the cache,
+    // a write straight to the disk would leave a stale copy behind.
+    class BlockCache {
+        public:
+            BlockCache(const BlockCache&) = delete;
+            BlockCache& operator=(const BlockCache&) = delete;
+            BlockCache(BlockCache&&) = delete;
+            BlockCache& operator=(BlockCache&&) = delete;
+
+            static auto& instance() {
+                static BlockCache block_cache;
+                return block_cache;
+            }
+
+            using BlockIndex = uint16_t;
+            static constexpr std::size_t CAPACITY = 64;
+
+            // copies the sectors into the destination buffer; runs of uncached sectors are read
+            // from the disk with a single command each and then added to the cache
+            static auto read(uint32_t firstSector, uint16_t numberOfSectors, xstd::span<uint8_t> destination) -> xstd::expected<uint32_t, DiskError> {
+                return instance().readImpl(firstSector, numberOfSectors, destination, true);
+            }
+
+            // like read, but sectors that are not cached are read straight into the destination and not added to the cache,
+            // for bulk file data that would only evict more useful blocks
+            static auto readUncached(uint32_t firstSector, uint16_t numberOfSectors, xstd::span<uint8_t> destination) -> xstd::expected<uint32_t, DiskError> {
+                return instance().readImpl(firstSector, numberOfSectors, destination, false);
+            }
+
+            // updates the cached copies of the sectors and marks them dirty; the disk is only written on flush or eviction
+            static auto write(uint32_t firstSector, uint16_t numberOfSectors, xstd::span<const uint8_t> source) -> xstd::expected<uint32_t, DiskError> {
+                return instance().writeImpl(firstSector, numberOfSectors, source, true);
+            }
+
+            // writes the sectors straight to the disk with a single request, for bulk file data; cached copies of them
+            // are refreshed and left clean instead of blocks being allocated for the rest
+            static auto writeUncached(uint32_t firstSector, uint16_t numberOfSectors, xstd::span<const uint8_t> source) -> xstd::expected<uint32_t, DiskError> {
+                return instance().writeImpl(firstSector, numberOfSectors, source, false);
+            }
+
+            // best-effort readahead: loads the uncached ones among the sectors into the cache without copying them
+            // anywhere, merged into as few commands as possible; returns false if the disk reported an error
+            static auto prefetch(uint32_t firstSector, uint16_t numberOfSectors) -> bool {
+                return instance().prefetchImpl(firstSector, numberOfSectors);
+            }
+
+            // writes all dirty blocks back, adjacent sectors merged by the request queue; returns false if any write failed
+            static auto flush() -> bool {
+                return instance().flushImpl();
+            }
+
+            // drops all blocks, including dirty ones, e.g. when switching to another block device
+            static auto invalidate() -> void {
+                instance().invalidateImpl();
+            }
+
+            // finds or loads the block holding the sector and pins it
+            static auto acquire(uint32_t sectorNumber) -> xstd::expected<BlockIndex, DiskError> {
+                return instance().acquireImpl(sectorNumber);
+            }
+
+            static constexpr BlockIndex NO_BLOCK = 0xffff;
+
+            static auto pin(BlockIndex block) -> void {
+                if(block != NO_BLOCK) ++instance().blocks[block].referenceCount;
+            }
+
+            static auto release(BlockIndex block) -> void {
+                if(block != NO_BLOCK) --instance().blocks[block].referenceCount;
+            }
+
+            static auto markDirty(BlockIndex block) -> void {
+                if(block != NO_BLOCK) instance().blocks[block].dirty = true;
+            }
+
+            static auto blockData(BlockIndex block) -> uint8_t*;
+
+        private:
+            BlockCache();
+
+            static constexpr std::size_t NUMBER_OF_BUCKETS = 128;
+
+            class Block {
+                public:
+                    uint32_t sectorNumber{0};
+                    BlockIndex nextInBucket{NO_BLOCK};
+                    uint16_t referenceCount{0};
+                    bool valid{false};
+                    bool dirty{false};
+                    bool recentlyUsed{false};      // CLOCK reference bit
+            };
+
+            static auto bucketOf(uint32_t sectorNumber) -> std::size_t {
+                return sectorNumber % NUMBER_OF_BUCKETS;
+            }
+
+            auto lookup(uint32_t sectorNumber) -> BlockIndex;
+            auto insertIntoBucket(BlockIndex block) -> void;
+            auto removeFromBucket(BlockIndex block) -> void;
+            auto writeBack(BlockIndex block) -> bool;
+            auto allocateBlock(uint32_t sectorNumber) -> xstd::expected<BlockIndex, DiskError>;
+
+            auto acquireImpl(uint32_t sectorNumber) -> xstd::expected<BlockIndex, DiskError>;
+            auto readImpl(uint32_t firstSector, uint16_t numberOfSectors, xstd::span<uint8_t> destination, bool cacheRead) -> xstd::expected<uint32_t, DiskError>;
+            auto writeImpl(uint32_t firstSector, uint16_t numberOfSectors, xstd::span<const uint8_t> source, bool cacheWrite) -> xstd::expected<uint32_t, DiskError>;
+            auto prefetchImpl(uint32_t firstSector, uint16_t numberOfSectors) -> bool;
+            auto flushImpl() -> bool;
+            auto invalidateImpl() -> void;
+
+            xstd::array<Block, CAPACITY> blocks{};
+            xstd::array<BlockIndex, NUMBER_OF_BUCKETS> buckets{};
+            BlockIndex clockHand{0};
+    };
+
+    // Pinned reference to a single cached sector of the active block device; the sector stays in the cache
+    // as long as a reference exists. On a memory-mapped device it refers to the sector in place instead.
+    class CachedSector {
+        public:
+            explicit CachedSector(uint32_t sectorNumber);
+            CachedSector(const CachedSector& other) : data{other.data}, block{other.block} {
+                BlockCache::pin(block);
+            }
+            CachedSector& operator=(const CachedSector& other) {
+                BlockCache::pin(other.block);
+                BlockCache::release(block);
+                data = other.data;
+                block = other.block;
+                return *this;
+            }
+            ~CachedSector() {
+                BlockCache::release(block);
+            }
+
+        protected:
+            auto bufferData() const -> const uint8_t* {
+                return data;
+            }
+
+            // gives write access to the sector and marks it dirty
+            auto mutableBufferData() -> uint8_t* {
+                BlockCache::markDirty(block);
+                return data;
+            }
+
+        private:
+            uint8_t* data;
+            BlockCache::BlockIndex block;
+    };
+
+}
@@ -0,0 +1,49 @@
+#include "block_device.hpp"
+
+#include "block_cache.hpp"
+#include "xstd/cstring.hpp"
+
+namespace LiOS86 {
+
+    namespace {
+        BlockDevice activeDevice{};
+    }
+
+    auto BlockDevice::read(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<uint8_t> destination) const -> xstd::expected<uint32_t, DiskError> {
+        if(!isMemoryMapped()) {
+            if(readFunction == nullptr) return xstd::unexpected(DiskError::NO_DEVICE);
+            return readFunction(logicalBlockAddress, numberOfSectors, destination);
+        }
+        if(destination.size() < numberOfSectors * ATA_SECTOR_SIZE) return xstd::unexpected(DiskError::BUFFER_TOO_SMALL);
+        if(static_cast<uint64_t>(logicalBlockAddress) + numberOfSectors > mappedSectors) return xstd::unexpected(DiskError::DEVICE_ERROR);
+        xstd::memcpy(destination.data(), mappedSector(logicalBlockAddress), numberOfSectors * ATA_SECTOR_SIZE);
+        return numberOfSectors;
+    }
+
+    auto BlockDevice::write(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<const uint8_t> source) const -> xstd::expected<uint32_t, DiskError> {
+        if(!isMemoryMapped()) {
+            if(writeFunction == nullptr) return xstd::unexpected(DiskError::NO_DEVICE);
+            return writeFunction(logicalBlockAddress, numberOfSectors, source);
+        }
+        if(source.size() < numberOfSectors * ATA_SECTOR_SIZE) return xstd::unexpected(DiskError::BUFFER_TOO_SMALL);
+        if(static_cast<uint64_t>(logicalBlockAddress) + numberOfSectors > mappedSectors) return xstd::unexpected(DiskError::DEVICE_ERROR);
+        xstd::memcpy(mappedSector(logicalBlockAddress), source.data(), numberOfSectors * ATA_SECTOR_SIZE);
+        return numberOfSectors;
+    }
+
+    auto BlockDevice::flush() const -> bool {
+        if(isMemoryMapped()) return true;
+        return flushFunction != nullptr && flushFunction();
+    }
+
+    auto activeBlockDevice() -> const BlockDevice& {
+        return activeDevice;
+    }
+
+    auto selectBlockDevice(const BlockDevice& device) -> void {
+        BlockCache::flush();
+        BlockCache::invalidate();
+        activeDevice = device;
+    }
+
+}
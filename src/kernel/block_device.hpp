@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "ata.hpp"
+#include "xstd/expected.hpp"
+#include "xstd/span.hpp"
+
+namespace LiOS86 {
+
+    // A disk the block cache, the request queue and the FAT code work on.
+    // It is either driven by a disk driver through its read/write/flush functions (the ATA driver and the
+    // AHCI, virtio and NVMe ones all provide readSectors/writeSectors with the same signature) or it is
+    // a disk image mapped into memory (a RAM disk, or hd.img mapped by the host-side build),
+    // whose sectors are accessed in place.
+    class BlockDevice {
+        public:
+            using ReadFunction = xstd::expected<uint32_t, DiskError> (*)(uint32_t, uint16_t, xstd::span<uint8_t>);
+            using WriteFunction = xstd::expected<uint32_t, DiskError> (*)(uint32_t, uint16_t, xstd::span<const uint8_t>);
+            using FlushFunction = bool (*)();
+
+            // a device without a backend, every access fails with NO_DEVICE
+            constexpr BlockDevice() = default;
+
+            // the name says which driver the disk is accessed through, e.g. for the shell to report
+            static constexpr auto fromDriver(const char* driverName, ReadFunction read, WriteFunction write, FlushFunction flush) -> BlockDevice {
+                BlockDevice device{};
+                device.name = driverName;
+                device.readFunction = read;
+                device.writeFunction = write;
+                device.flushFunction = flush;
+                return device;
+            }
+
+            static constexpr auto fromMemory(uint8_t* image, uint32_t numberOfSectors) -> BlockDevice {
+                BlockDevice device{};
+                device.name = "memory-mapped image";
+                device.mappedImage = image;
+                device.mappedSectors = numberOfSectors;
+                return device;
+            }
+
+            auto read(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<uint8_t> destination) const -> xstd::expected<uint32_t, DiskError>;
+            auto write(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<const uint8_t> source) const -> xstd::expected<uint32_t, DiskError>;
+            auto flush() const -> bool;
+
+            auto getName() const -> const char* {
+                return name;
+            }
+
+            auto isMemoryMapped() const -> bool {
+                return mappedImage != nullptr;
+            }
+
+            // the sector within the mapped image, nullptr if the device is not memory-mapped or the sector is out of range
+            auto mappedSector(uint32_t logicalBlockAddress) const -> uint8_t* {
+                if(mappedImage == nullptr || logicalBlockAddress >= mappedSectors) return nullptr;
+                return mappedImage + static_cast<std::size_t>(logicalBlockAddress) * ATA_SECTOR_SIZE;
+            }
+
+        private:
+            const char* name{"none"};
+            ReadFunction readFunction{nullptr};
+            WriteFunction writeFunction{nullptr};
+            FlushFunction flushFunction{nullptr};
+            uint8_t* mappedImage{nullptr};
+            uint32_t mappedSectors{0};
+    };
+
+    // the device all block-layer accesses go to; none until one is selected
+    auto activeBlockDevice() -> const BlockDevice&;
+
+    // flushes and empties the block cache, then switches to the given device
+    auto selectBlockDevice(const BlockDevice& device) -> void;
+
+}
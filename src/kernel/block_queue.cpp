@@ -0,0 +1,123 @@
+#include "block_queue.hpp"
+
+#include "block_device.hpp"
+#include "xstd/cstring.hpp"
+
+namespace LiOS86 {
+
+    namespace {
+        constexpr uint32_t MAX_SECTORS_PER_COMMAND = 0xffff;
+        constexpr uint32_t BOUNCE_BUFFER_SECTORS = 64;
+
+        // merged requests whose buffers are scattered in memory are transferred through here
+        uint8_t bounceBuffer[BOUNCE_BUFFER_SECTORS * ATA_SECTOR_SIZE] __attribute__((aligned(ATA_SECTOR_SIZE)));
+    }
+
+    auto BlockRequestQueue::conflictsWithPending(uint32_t logicalBlockAddress, uint16_t numberOfSectors, bool write) const -> bool {
+        for(std::size_t i = 0; i < numberOfPending; ++i) {
+            const auto& request = pending[i];
+            if(!request.write && !write) continue;
+            const auto overlaps = request.logicalBlockAddress < logicalBlockAddress + numberOfSectors &&
+                                    logicalBlockAddress < request.logicalBlockAddress + request.numberOfSectors;
+            if(overlaps) return true;
+        }
+        return false;
+    }
+
+    auto BlockRequestQueue::submitImpl(uint32_t logicalBlockAddress, uint16_t numberOfSectors, const uint8_t* buffer, std::size_t size, bool write) -> xstd::expected<uint32_t, DiskError> {
+        if(size < numberOfSectors * ATA_SECTOR_SIZE) {
+            return xstd::unexpected(DiskError::BUFFER_TOO_SMALL);
+        }
+        if(numberOfSectors == 0) return 0u;
+
+        if(numberOfPending == CAPACITY || conflictsWithPending(logicalBlockAddress, numberOfSectors, write)) {
+            const auto result = dispatchImpl();
+            if(!result) return result;
+        }
+
+        // insertion sort, after any request with the same LBA
+        auto position = numberOfPending;
+        while(position > 0 && pending[position - 1].logicalBlockAddress > logicalBlockAddress) {
+            pending[position] = pending[position - 1];
+            --position;
+        }
+        pending[position] = Request{logicalBlockAddress, numberOfSectors, write, buffer};
+        ++numberOfPending;
+        return numberOfSectors;
+    }
+
+    auto BlockRequestQueue::dispatchImpl() -> xstd::expected<uint32_t, DiskError> {
+        // the sweep starts at the first request at or above the current position
+        std::size_t start = 0;
+        while(start < numberOfPending && pending[start].logicalBlockAddress < headPosition) {
+            ++start;
+        }
+        if(start == numberOfPending) start = 0;
+
+        uint32_t sectorsTransferred = 0;
+        std::size_t issued = 0;
+        while(issued < numberOfPending) {
+            const auto first = (start + issued) % numberOfPending;
+            auto last = first;
+            uint32_t totalSectors = pending[first].numberOfSectors;
+            bool contiguous = true;
+
+            // wrapping around never continues a run, the request at index 0 has the lowest LBA
+            while(last + 1 < numberOfPending && issued + (last - first) + 1 < numberOfPending) {
+                const auto& previous = pending[last];
+                const auto& next = pending[last + 1];
+                if(next.write != previous.write || next.logicalBlockAddress != previous.logicalBlockAddress + previous.numberOfSectors) break;
+                if(totalSectors + next.numberOfSectors > MAX_SECTORS_PER_COMMAND) break;
+                const auto nextContiguous = contiguous && next.buffer == previous.buffer + previous.numberOfSectors * ATA_SECTOR_SIZE;
+                if(!nextContiguous && totalSectors + next.numberOfSectors > BOUNCE_BUFFER_SECTORS) break;
+                contiguous = nextContiguous;
+                totalSectors += next.numberOfSectors;
+                ++last;
+            }
+
+            const auto result = issueMerged(first, last, totalSectors, contiguous);
+            if(!result) {
+                numberOfPending = 0;
+                return result;
+            }
+            headPosition = pending[first].logicalBlockAddress + totalSectors;
+            sectorsTransferred += totalSectors;
+            issued += last - first + 1;
+        }
+        numberOfPending = 0;
+        return sectorsTransferred;
+    }
+
+    auto BlockRequestQueue::issueMerged(std::size_t first, std::size_t last, uint32_t totalSectors, bool contiguous) -> xstd::expected<uint32_t, DiskError> {
+        const auto logicalBlockAddress = pending[first].logicalBlockAddress;
+        const auto numberOfSectors = static_cast<uint16_t>(totalSectors);
+        const auto size = totalSectors * ATA_SECTOR_SIZE;
+
+        if(contiguous) {
+            if(pending[first].write) {
+                return activeBlockDevice().write(logicalBlockAddress, numberOfSectors, xstd::span<const uint8_t>(pending[first].buffer, size));
+            }
+            // read requests were submitted with a writeable buffer
+            return activeBlockDevice().read(logicalBlockAddress, numberOfSectors, xstd::span<uint8_t>(const_cast<uint8_t*>(pending[first].buffer), size));
+        }
+
+        if(pending[first].write) {
+            auto bouncePtr = bounceBuffer;
+            for(auto i = first; i <= last; ++i) {
+                xstd::memcpy(bouncePtr, pending[i].buffer, pending[i].numberOfSectors * ATA_SECTOR_SIZE);
+                bouncePtr += pending[i].numberOfSectors * ATA_SECTOR_SIZE;
+            }
+            return activeBlockDevice().write(logicalBlockAddress, numberOfSectors, xstd::span<const uint8_t>(bounceBuffer, size));
+        }
+
+        const auto result = activeBlockDevice().read(logicalBlockAddress, numberOfSectors, xstd::span<uint8_t>(bounceBuffer, size));
+        if(!result) return result;
+        const uint8_t* bouncePtr = bounceBuffer;
+        for(auto i = first; i <= last; ++i) {
+            xstd::memcpy(const_cast<uint8_t*>(pending[i].buffer), bouncePtr, pending[i].numberOfSectors * ATA_SECTOR_SIZE);
+            bouncePtr += pending[i].numberOfSectors * ATA_SECTOR_SIZE;
+        }
+        return result;
+    }
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "ata.hpp"
+#include "xstd/array.hpp"
+#include "xstd/expected.hpp"
+#include "xstd/span.hpp"
+
+namespace LiOS86 {
+
+    // Queue of block requests in front of the active block device. Submitted requests are kept sorted by LBA
+    // and only issued on dispatch(), in one elevator sweep (C-LOOK: ascending from the position of
+    // the last command, then wrapping around to the lowest LBA). Adjacent requests in the same
+    // direction are merged into a single multi-sector command; if their buffers are not contiguous
+    // in memory the merged transfer goes through a bounce buffer.
+    // A request that overlaps a pending one (unless both are reads) dispatches the queue first, so reordering
+    // never changes what ends up in memory or on the disk; so does a request submitted to a full queue.
+    class BlockRequestQueue {
+        public:
+            BlockRequestQueue(const BlockRequestQueue&) = delete;
+            BlockRequestQueue& operator=(const BlockRequestQueue&) = delete;
+            BlockRequestQueue(BlockRequestQueue&&) = delete;
+            BlockRequestQueue& operator=(BlockRequestQueue&&) = delete;
+
+            static auto& instance() {
+                static BlockRequestQueue block_request_queue;
+                return block_request_queue;
+            }
+
+            static constexpr std::size_t CAPACITY = 32;
+
+            // queues a read into the destination buffer, which has to stay valid until the queue is dispatched;
+            // returns the number of sectors queued or the error of a dispatch it had to trigger
+            static auto submitRead(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<uint8_t> destination) -> xstd::expected<uint32_t, DiskError> {
+                return instance().submitImpl(logicalBlockAddress, numberOfSectors, destination.data(), destination.size(), false);
+            }
+
+            static auto submitWrite(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<const uint8_t> source) -> xstd::expected<uint32_t, DiskError> {
+                return instance().submitImpl(logicalBlockAddress, numberOfSectors, source.data(), source.size(), true);
+            }
+
+            // issues all pending requests; returns the number of sectors transferred
+            // or the error of the first failing command (the remaining requests are dropped)
+            static auto dispatch() -> xstd::expected<uint32_t, DiskError> {
+                return instance().dispatchImpl();
+            }
+
+            static auto isEmpty() -> bool {
+                return instance().numberOfPending == 0;
+            }
+
+        private:
+            BlockRequestQueue() = default;
+
+            class Request {
+                public:
+                    uint32_t logicalBlockAddress{0};
+                    uint16_t numberOfSectors{0};
+                    bool write{false};
+                    const uint8_t* buffer{nullptr};
+            };
+
+            auto conflictsWithPending(uint32_t logicalBlockAddress, uint16_t numberOfSectors, bool write) const -> bool;
+            auto submitImpl(uint32_t logicalBlockAddress, uint16_t numberOfSectors, const uint8_t* buffer, std::size_t size, bool write) -> xstd::expected<uint32_t, DiskError>;
+            auto dispatchImpl() -> xstd::expected<uint32_t, DiskError>;
+            auto issueMerged(std::size_t first, std::size_t last, uint32_t totalSectors, bool contiguous) -> xstd::expected<uint32_t, DiskError>;
+
+            // sorted by LBA; requests with equal LBAs stay in submission order
+            xstd::array<Request, CAPACITY> pending{};
+            std::size_t numberOfPending{0};
+            uint32_t headPosition{0};       // LBA following the last issued command
+    };
+
+}
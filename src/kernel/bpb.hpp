@@ -2,16 +2,16 @@
 
 #include <stdint.h>
 
+#include "block_cache.hpp"
 #include "utils/data_manipulation.hpp"
-#include "utils/disk_buffer.hpp"
 #include "xstd/expected.hpp"
 #include "xstd/utility.hpp"
 
 namespace LiOS86 {
 
-    class BPBHandle : ReadonlyDiskBuffer<1> {
+    class BPBHandle : CachedSector {
         public:
-            BPBHandle(std::size_t startingSectorNumber) : ReadonlyDiskBuffer<1>(startingSectorNumber) { }
+            BPBHandle(std::size_t startingSectorNumber) : CachedSector(static_cast<uint32_t>(startingSectorNumber)) { }
 
             auto getBytesPerSector() const -> uint16_t {
                 return readFromMemoryAndPun<uint16_t>(bufferData(), 11);
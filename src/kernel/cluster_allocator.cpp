@@ -0,0 +1,106 @@
+#include "cluster_allocator.hpp"
+
+#include "fat_cache.hpp"
+#include "fsinfo.hpp"
+
+namespace LiOS86 {
+
+    auto ClusterAllocator::mountImpl(const BPBHandle& bpb, uint32_t partitionStartingSector) -> void {
+        usedClusters.fill(0);
+        loadedGroups.fill(0);
+        const auto clustersInVolume = FATCache::getNumberOfClusters() + 2;
+        clusterLimit = clustersInVolume < MAX_CLUSTERS ? clustersInVolume : MAX_CLUSTERS;
+        nextFreeHint = 2;
+        freeClusterCount = FSInfoHandle::UNKNOWN;
+        fsInfoOutdated = false;
+
+        // 0 and 0xFFFF both mean that the volume has no FSInfo sector
+        const auto fsInfoSectorNumber = bpb.getFSInfoSectorNumber();
+        hasFSInfo = false;
+        if(fsInfoSectorNumber == 0 || fsInfoSectorNumber == 0xFFFF) return;
+        fsInfoSector = partitionStartingSector + fsInfoSectorNumber;
+        const auto fsInfo = FSInfoHandle(fsInfoSector);
+        if(!fsInfo.isValid()) return;
+        hasFSInfo = true;
+
+        const auto hint = fsInfo.getNextFreeCluster();
+        if(hint >= 2 && hint < clusterLimit) nextFreeHint = hint;
+        const auto count = fsInfo.getFreeClusterCount();
+        if(count <= clustersInVolume - 2) freeClusterCount = count;
+    }
+
+    // fills the bitmap bits of the clusters whose entries share a FAT sector
+    auto ClusterAllocator::loadGroup(uint32_t group) -> void {
+        if(loadedGroups[group / 32] & (1u << (group % 32))) return;
+        const auto firstCluster = group * CLUSTERS_PER_GROUP;
+        const auto sector = FATSectorHandle(FATCache::entrySector(firstCluster));
+        for(uint32_t i = 0; i < CLUSTERS_PER_GROUP; ++i) {
+            const auto cluster = firstCluster + i;
+            setUsed(cluster, cluster < 2 || cluster >= clusterLimit || sector.getEntry(i) != 0);
+        }
+        loadedGroups[group / 32] |= 1u << (group % 32);
+    }
+
+    // First free cluster at or after the start cluster, wrapping around at the end of the volume; 0 if there is none.
+    // Groups are only loaded as the search reaches them.
+    auto ClusterAllocator::findFreeCluster(uint32_t startCluster) -> uint32_t {
+        const auto numberOfGroups = (clusterLimit + CLUSTERS_PER_GROUP - 1) / CLUSTERS_PER_GROUP;
+        const auto startGroup = startCluster / CLUSTERS_PER_GROUP;
+        // the start group is visited twice, the second time for the clusters before the start cluster
+        for(uint32_t i = 0; i <= numberOfGroups; ++i) {
+            const auto group = (startGroup + i) % numberOfGroups;
+            loadGroup(group);
+            for(uint32_t word = group * WORDS_PER_GROUP; word < (group + 1) * WORDS_PER_GROUP; ++word) {
+                auto freeBits = ~usedClusters[word];
+                const auto wordStart = word * 32;
+                if(i == 0 && wordStart + 32 <= startCluster) continue;
+                if(i == 0 && wordStart < startCluster) freeBits &= ~0u << (startCluster - wordStart);
+                if(freeBits != 0) return wordStart + static_cast<uint32_t>(__builtin_ctz(freeBits));
+            }
+        }
+        return 0;
+    }
+
+    auto ClusterAllocator::allocateImpl(uint32_t maxLength, uint32_t preferredCluster) -> xstd::expected<ClusterExtent, AllocationError> {
+        if(clusterLimit <= 2 || maxLength == 0) return xstd::unexpected(AllocationError::VOLUME_FULL);
+        const auto start = preferredCluster >= 2 && preferredCluster < clusterLimit ? preferredCluster : nextFreeHint;
+        const auto firstCluster = findFreeCluster(start);
+        if(firstCluster == 0) return xstd::unexpected(AllocationError::VOLUME_FULL);
+
+        uint32_t length = 1;
+        setUsed(firstCluster, true);
+        while(length < maxLength && firstCluster + length < clusterLimit) {
+            const auto cluster = firstCluster + length;
+            loadGroup(cluster / CLUSTERS_PER_GROUP);
+            if(isUsed(cluster)) break;
+            setUsed(cluster, true);
+            ++length;
+        }
+
+        nextFreeHint = firstCluster + length < clusterLimit ? firstCluster + length : 2;
+        if(freeClusterCount != FSInfoHandle::UNKNOWN) freeClusterCount = freeClusterCount >= length ? freeClusterCount - length : 0;
+        fsInfoOutdated = true;
+        return ClusterExtent{firstCluster, length};
+    }
+
+    auto ClusterAllocator::releaseImpl(uint32_t cluster) -> void {
+        if(cluster < 2 || cluster >= clusterLimit) return;
+        // an unloaded group picks the change up from the FAT when it is loaded
+        const auto group = cluster / CLUSTERS_PER_GROUP;
+        if(loadedGroups[group / 32] & (1u << (group % 32))) {
+            if(!isUsed(cluster)) return;
+            setUsed(cluster, false);
+        }
+        if(freeClusterCount != FSInfoHandle::UNKNOWN) ++freeClusterCount;
+        fsInfoOutdated = true;
+    }
+
+    auto ClusterAllocator::syncImpl() -> void {
+        if(!hasFSInfo || !fsInfoOutdated) return;
+        auto fsInfo = FSInfoHandle(fsInfoSector);
+        fsInfo.setFreeClusterCount(freeClusterCount);
+        fsInfo.setNextFreeCluster(nextFreeHint);
+        fsInfoOutdated = false;
+    }
+
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "bpb.hpp"
+#include "xstd/array.hpp"
+#include "xstd/expected.hpp"
+
+namespace LiOS86 {
+
+    // Consecutive free clusters handed out by the allocator.
+    class ClusterExtent {
+        public:
+            uint32_t firstCluster;
+            uint32_t length;
+    };
+
+    // Free-cluster bitmap of the mounted volume. The bitmap is filled lazily, one FAT sector (128 clusters)
+    // at a time, when the search for free clusters reaches it; the search starts at FSInfo's next-free hint
+    // and continues from the last allocation, so the FAT is never scanned as a whole up front.
+    // The allocator only tracks which clusters are in use, linking them into chains is up to the caller.
+    // Volumes with more than MAX_CLUSTERS clusters only have their first MAX_CLUSTERS allocated from.
+    class ClusterAllocator {
+        public:
+            ClusterAllocator(const ClusterAllocator&) = delete;
+            ClusterAllocator& operator=(const ClusterAllocator&) = delete;
+            ClusterAllocator(ClusterAllocator&&) = delete;
+            ClusterAllocator& operator=(ClusterAllocator&&) = delete;
+
+            static auto& instance() {
+                static ClusterAllocator cluster_allocator;
+                return cluster_allocator;
+            }
+
+            static constexpr uint32_t MAX_CLUSTERS = 1 << 20;
+
+            enum class AllocationError : uint8_t { VOLUME_FULL };
+
+            // forgets the bitmap and reads the hints of the volume's FSInfo sector; the FAT cache has to be mounted first
+            static auto mount(const BPBHandle& bpb, uint32_t partitionStartingSector) -> void {
+                instance().mountImpl(bpb, partitionStartingSector);
+            }
+
+            // Marks up to maxLength consecutive free clusters as used and returns them. The first free cluster
+            // at or after preferredCluster (0 for none) is taken, so files extended with it stay contiguous where possible.
+            static auto allocate(uint32_t maxLength, uint32_t preferredCluster) -> xstd::expected<ClusterExtent, AllocationError> {
+                return instance().allocateImpl(maxLength, preferredCluster);
+            }
+
+            // marks a cluster as free again; the FAT entry itself has to be cleared by the caller
+            static auto release(uint32_t cluster) -> void {
+                instance().releaseImpl(cluster);
+            }
+
+            // stores the free cluster count and the next-free hint in the FSInfo sector (through the block cache)
+            static auto sync() -> void {
+                instance().syncImpl();
+            }
+
+        private:
+            ClusterAllocator() = default;
+
+            static constexpr uint32_t CLUSTERS_PER_GROUP = 128;     // FAT entries per sector
+            static constexpr uint32_t NUMBER_OF_GROUPS = MAX_CLUSTERS / CLUSTERS_PER_GROUP;
+            static constexpr uint32_t WORDS_PER_GROUP = CLUSTERS_PER_GROUP / 32;
+
+            auto isUsed(uint32_t cluster) const -> bool {
+                return usedClusters[cluster / 32] & (1u << (cluster % 32));
+            }
+
+            auto setUsed(uint32_t cluster, bool used) -> void {
+                if(used) {
+                    usedClusters[cluster / 32] |= 1u << (cluster % 32);
+                } else {
+                    usedClusters[cluster / 32] &= ~(1u << (cluster % 32));
+                }
+            }
+
+            auto mountImpl(const BPBHandle& bpb, uint32_t partitionStartingSector) -> void;
+            auto loadGroup(uint32_t group) -> void;
+            auto findFreeCluster(uint32_t startCluster) -> uint32_t;
+            auto allocateImpl(uint32_t maxLength, uint32_t preferredCluster) -> xstd::expected<ClusterExtent, AllocationError>;
+            auto releaseImpl(uint32_t cluster) -> void;
+            auto syncImpl() -> void;
+
+            xstd::array<uint32_t, MAX_CLUSTERS / 32> usedClusters{};
+            xstd::array<uint32_t, NUMBER_OF_GROUPS / 32> loadedGroups{};
+            uint32_t clusterLimit{0};           // one past the last allocatable cluster
+            uint32_t nextFreeHint{2};
+            uint32_t freeClusterCount{0};       // FSInfo's count kept up to date, unless it was unknown
+            uint32_t fsInfoSector{0};
+            bool hasFSInfo{false};
+            bool fsInfoOutdated{false};
+    };
+
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "block_cache.hpp"
+
+namespace LiOS86 {
+
+    // Adaptive readahead for a file or directory read by following its FAT cluster chain.
+    // Each cluster is reported with access() before it is read. An access to the cluster that follows
+    // the previous one in the chain is sequential and doubles the readahead window, any other access
+    // halves it. Whenever less than half a window is prefetched ahead of the current position, the
+    // following clusters (found by walking the in-memory FAT with nextCluster) are loaded into the
+    // block cache, runs of physically contiguous clusters with a single prefetch each.
+    // The window is limited to half the block cache, so readahead never evicts the data it is for; with clusters
+    // larger than that (32 KiB and up) it is a single cluster, of which only the first half cache's worth is prefetched.
+    // Repeated accesses to the same cluster (small reads within it) count once. A default-constructed
+    // readahead does nothing, e.g. for a closed file or while no volume is mounted.
+    template<typename NextCluster, typename ClusterToSector>
+    class ClusterReadahead {
+        public:
+            ClusterReadahead() = default;
+            ClusterReadahead(NextCluster next, ClusterToSector toSector, uint8_t clusterSectors) :
+                nextCluster{next}, clusterToSector{toSector}, sectorsPerCluster{clusterSectors},
+                maxWindow{static_cast<uint32_t>(clusterSectors == 0 ? 0 : (clusterSectors < MAX_PREFETCH_SECTORS ? MAX_PREFETCH_SECTORS / clusterSectors : 1))} { }
+
+            auto access(uint32_t cluster) -> void;
+
+        private:
+            static constexpr uint32_t INITIAL_WINDOW = 2;
+            static constexpr uint32_t MAX_PREFETCH_SECTORS = BlockCache::CAPACITY / 2;
+
+            static auto isChainCluster(uint32_t cluster) -> bool {
+                return cluster > 0x00000001 && cluster < 0x0FFFFFF7;
+            }
+
+            auto prefetchAhead() -> void;
+
+            NextCluster nextCluster{};
+            ClusterToSector clusterToSector{};
+            uint8_t sectorsPerCluster{0};
+            uint32_t maxWindow{0};
+            uint32_t window{INITIAL_WINDOW};
+            uint32_t lastCluster{0};            // last accessed cluster
+            uint32_t expectedCluster{0};        // cluster following the last accessed one
+            uint32_t prefetchCluster{0};        // first cluster of the chain not prefetched yet
+            uint32_t clustersAhead{0};          // clusters prefetched beyond the last accessed one
+    };
+
+    template<typename NextCluster, typename ClusterToSector>
+    auto ClusterReadahead<NextCluster, ClusterToSector>::access(uint32_t cluster) -> void {
+        if(maxWindow == 0 || cluster == lastCluster) return;
+        lastCluster = cluster;
+
+        if(cluster == expectedCluster) {
+            window = (2 * window < maxWindow) ? 2 * window : maxWindow;
+            if(clustersAhead > 0) --clustersAhead;
+        } else {
+            // the first access of the chain is neither a hit nor a miss
+            if(expectedCluster != 0) window = (window > 1) ? window / 2 : 1;
+            clustersAhead = 0;
+        }
+        if(window > maxWindow) window = maxWindow;
+
+        expectedCluster = static_cast<uint32_t>(nextCluster(cluster));
+        if(clustersAhead == 0) prefetchCluster = expectedCluster;
+        if(clustersAhead < (window + 1) / 2) prefetchAhead();
+    }
+
+    template<typename NextCluster, typename ClusterToSector>
+    auto ClusterReadahead<NextCluster, ClusterToSector>::prefetchAhead() -> void {
+        const auto target = window - clustersAhead;
+        uint32_t prefetched = 0;
+        while(prefetched < target && isChainCluster(prefetchCluster)) {
+            const auto runStart = prefetchCluster;
+            uint32_t runLength = 0;
+            do {
+                ++runLength;
+                prefetchCluster = static_cast<uint32_t>(nextCluster(prefetchCluster));
+            } while(prefetched + runLength < target && prefetchCluster == runStart + runLength);
+
+            const auto runSectors = runLength * sectorsPerCluster;
+            BlockCache::prefetch(static_cast<uint32_t>(clusterToSector(runStart)),
+                                    static_cast<uint16_t>(runSectors < MAX_PREFETCH_SECTORS ? runSectors : MAX_PREFETCH_SECTORS));
+            prefetched += runLength;
+        }
+        clustersAhead += prefetched;
+    }
+
+}
@@ -0,0 +1,109 @@
+#include "dentry_cache.hpp"
+
+namespace LiOS86 {
+
+    // FNV-1a over the upper-cased name
+    NormalizedName::NormalizedName(const char* name, std::size_t nameLength) : length{nameLength}, hash{2166136261u} {
+        if(!isCacheable()) return;
+        for(std::size_t i = 0; i < length; ++i) {
+            auto c = name[i];
+            if(c >= 'a' && c <= 'z') c = static_cast<char>(c - 'a' + 'A');
+            characters[i] = c;
+            hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+        }
+    }
+
+    auto operator==(const NormalizedName& lhs, const NormalizedName& rhs) -> bool {
+        if(lhs.hash != rhs.hash || lhs.length != rhs.length) return false;
+        for(std::size_t i = 0; i < lhs.length; ++i) {
+            if(lhs.characters[i] != rhs.characters[i]) return false;
+        }
+        return true;
+    }
+
+    DentryCache::DentryCache() {
+        buckets.fill(NO_ENTRY);
+    }
+
+    auto DentryCache::find(uint32_t parentCluster, const NormalizedName& name) -> EntryIndex {
+        auto entry = buckets[bucketOf(parentCluster, name)];
+        while(entry != NO_ENTRY && (entries[entry].parentCluster != parentCluster || !(entries[entry].name == name))) {
+            entry = entries[entry].nextInBucket;
+        }
+        return entry;
+    }
+
+    auto DentryCache::removeFromBucket(EntryIndex entry) -> void {
+        auto* link = &buckets[bucketOf(entries[entry].parentCluster, entries[entry].name)];
+        while(*link != entry) {
+            link = &entries[*link].nextInBucket;
+        }
+        *link = entries[entry].nextInBucket;
+        entries[entry].nextInBucket = NO_ENTRY;
+        entries[entry].valid = false;
+    }
+
+    // CLOCK, like the block cache; nothing is pinned here, so the second pass always finds an entry
+    auto DentryCache::allocateEntry() -> EntryIndex {
+        while(true) {
+            const auto entry = clockHand;
+            clockHand = static_cast<EntryIndex>((clockHand + 1) % CAPACITY);
+            auto& candidate = entries[entry];
+            if(candidate.valid && candidate.recentlyUsed) {
+                candidate.recentlyUsed = false;
+                continue;
+            }
+            if(candidate.valid) removeFromBucket(entry);
+            return entry;
+        }
+    }
+
+    auto DentryCache::lookupImpl(uint32_t parentCluster, const NormalizedName& name) -> xstd::expected<DirectoryEntryInfo, LookupError> {
+        if(!name.isCacheable()) return xstd::unexpected(LookupError::NOT_CACHED);
+        const auto entry = find(parentCluster, name);
+        if(entry == NO_ENTRY) return xstd::unexpected(LookupError::NOT_CACHED);
+        entries[entry].recentlyUsed = true;
+        if(entries[entry].negative) return xstd::unexpected(LookupError::DOES_NOT_EXIST);
+        return entries[entry].info;
+    }
+
+    auto DentryCache::insertImpl(uint32_t parentCluster, const NormalizedName& name, const DirectoryEntryInfo& info, bool negative) -> void {
+        if(!name.isCacheable()) return;
+        auto entry = find(parentCluster, name);
+        if(entry == NO_ENTRY) {
+            entry = allocateEntry();
+            auto& allocated = entries[entry];
+            allocated.parentCluster = parentCluster;
+            allocated.name = name;
+            allocated.valid = true;
+            auto& bucket = buckets[bucketOf(parentCluster, name)];
+            allocated.nextInBucket = bucket;
+            bucket = entry;
+        }
+        entries[entry].info = info;
+        entries[entry].negative = negative;
+        entries[entry].recentlyUsed = true;
+    }
+
+    // entries are not indexed by their location, but this is only needed when a file's entry is written back
+    auto DentryCache::updateImpl(uint32_t entrySector, uint8_t entryIndex, uint32_t firstCluster, uint32_t fileSize) -> void {
+        for(auto& entry : entries) {
+            if(!entry.valid || entry.negative || entry.info.entrySector != entrySector || entry.info.entryIndex != entryIndex) continue;
+            entry.info.firstCluster = firstCluster;
+            entry.info.fileSize = fileSize;
+        }
+    }
+
+    auto DentryCache::invalidateImpl(uint32_t parentCluster, const NormalizedName& name) -> void {
+        if(!name.isCacheable()) return;
+        const auto entry = find(parentCluster, name);
+        if(entry != NO_ENTRY) removeFromBucket(entry);
+    }
+
+    auto DentryCache::invalidateAllImpl() -> void {
+        for(EntryIndex entry = 0; entry < CAPACITY; ++entry) {
+            if(entries[entry].valid) removeFromBucket(entry);
+        }
+    }
+
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "xstd/array.hpp"
+#include "xstd/expected.hpp"
+
+namespace LiOS86 {
+
+    // What a lookup needs to know about a directory entry.
+    class DirectoryEntryInfo {
+        public:
+            uint32_t firstCluster;
+            uint32_t fileSize;
+            uint8_t attributes;
+            uint32_t entrySector;       // where the entry is stored, 0 for the root directory which has none
+            uint8_t entryIndex;
+
+            auto isDirectory() const -> bool {
+                return attributes & 0x10;
+            }
+    };
+
+    // File name as the dentry cache keys it: upper-cased (FAT names are case-insensitive) and hashed once.
+    // Names longer than MAX_LENGTH are not cacheable.
+    class NormalizedName {
+        public:
+            static constexpr std::size_t MAX_LENGTH = 39;
+
+            NormalizedName(const char* name, std::size_t nameLength);
+
+            auto isCacheable() const -> bool {
+                return length <= MAX_LENGTH;
+            }
+
+            auto getHash() const -> uint32_t {
+                return hash;
+            }
+
+            auto getLength() const -> std::size_t {
+                return length;
+            }
+
+            auto data() const -> const char* {
+                return characters.data();
+            }
+
+            friend auto operator==(const NormalizedName& lhs, const NormalizedName& rhs) -> bool;
+
+        private:
+            xstd::array<char, MAX_LENGTH> characters{};
+            std::size_t length;
+            uint32_t hash;
+    };
+
+    // Results of directory lookups, hashed by (parent directory cluster, normalized name).
+    // Negative entries record names that do not exist, so repeated misses do not rescan the directory either.
+    // Entries are replaced with CLOCK. Anything that creates, renames or removes a directory entry,
+    // or changes a file's first cluster or size, has to invalidate (or update) the affected entries.
+    class DentryCache {
+        public:
+            DentryCache(const DentryCache&) = delete;
+            DentryCache& operator=(const DentryCache&) = delete;
+            DentryCache(DentryCache&&) = delete;
+            DentryCache& operator=(DentryCache&&) = delete;
+
+            static auto& instance() {
+                static DentryCache dentry_cache;
+                return dentry_cache;
+            }
+
+            static constexpr std::size_t CAPACITY = 128;
+
+            enum class LookupError : uint8_t { NOT_CACHED, DOES_NOT_EXIST };
+
+            static auto lookup(uint32_t parentCluster, const NormalizedName& name) -> xstd::expected<DirectoryEntryInfo, LookupError> {
+                return instance().lookupImpl(parentCluster, name);
+            }
+
+            static auto insert(uint32_t parentCluster, const NormalizedName& name, const DirectoryEntryInfo& info) -> void {
+                instance().insertImpl(parentCluster, name, info, false);
+            }
+
+            static auto insertNegative(uint32_t parentCluster, const NormalizedName& name) -> void {
+                instance().insertImpl(parentCluster, name, DirectoryEntryInfo{0, 0, 0, 0, 0}, true);
+            }
+
+            // keeps the cached copy of a directory entry in line with an update of its first cluster and size
+            static auto update(uint32_t entrySector, uint8_t entryIndex, uint32_t firstCluster, uint32_t fileSize) -> void {
+                instance().updateImpl(entrySector, entryIndex, firstCluster, fileSize);
+            }
+
+            static auto invalidate(uint32_t parentCluster, const NormalizedName& name) -> void {
+                instance().invalidateImpl(parentCluster, name);
+            }
+
+            static auto invalidateAll() -> void {
+                instance().invalidateAllImpl();
+            }
+
+        private:
+            DentryCache();
+
+            using EntryIndex = uint8_t;
+            static constexpr EntryIndex NO_ENTRY = 0xff;
+            static constexpr std::size_t NUMBER_OF_BUCKETS = 64;
+            static_assert(CAPACITY < NO_ENTRY);
+
+            class Entry {
+                public:
+                    uint32_t parentCluster{0};
+                    DirectoryEntryInfo info{0, 0, 0, 0, 0};
+                    NormalizedName name{nullptr, 0};
+                    EntryIndex nextInBucket{NO_ENTRY};
+                    bool valid{false};
+                    bool negative{false};
+                    bool recentlyUsed{false};
+            };
+
+            static auto bucketOf(uint32_t parentCluster, const NormalizedName& name) -> std::size_t {
+                return (name.getHash() ^ (parentCluster * 0x9E3779B1u)) % NUMBER_OF_BUCKETS;
+            }
+
+            auto find(uint32_t parentCluster, const NormalizedName& name) -> EntryIndex;
+            auto removeFromBucket(EntryIndex entry) -> void;
+            auto allocateEntry() -> EntryIndex;
+
+            auto lookupImpl(uint32_t parentCluster, const NormalizedName& name) -> xstd::expected<DirectoryEntryInfo, LookupError>;
+            auto insertImpl(uint32_t parentCluster, const NormalizedName& name, const DirectoryEntryInfo& info, bool negative) -> void;
+            auto updateImpl(uint32_t entrySector, uint8_t entryIndex, uint32_t firstCluster, uint32_t fileSize) -> void;
+            auto invalidateImpl(uint32_t parentCluster, const NormalizedName& name) -> void;
+            auto invalidateAllImpl() -> void;
+
+            xstd::array<Entry, CAPACITY> entries{};
+            xstd::array<EntryIndex, NUMBER_OF_BUCKETS> buckets{};
+            EntryIndex clockHand{0};
+    };
+
+}
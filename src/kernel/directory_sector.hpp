@@ -9,9 +9,20 @@
 
 namespace LiOS86 {
     
-    class DirectorySectorHandle : ReadonlyDiskBuffer<1> {
+    constexpr std::size_t DIRECTORY_WINDOW_SECTORS = 16;
+
+    // Window of up to MAX_SECTORS directory sectors, normally a whole cluster (or run of clusters), read at once.
+    // A scan moves one handle along the directory with repoint() instead of constructing one per sector.
+    class DirectorySectorHandle : ReadWriteDiskBuffer<DIRECTORY_WINDOW_SECTORS> {
         public:
-            explicit DirectorySectorHandle(std::size_t startingSectorNumber) : ReadonlyDiskBuffer<1>(startingSectorNumber) { }
+            static constexpr std::size_t MAX_SECTORS = DIRECTORY_WINDOW_SECTORS;
+
+            explicit DirectorySectorHandle(std::size_t startingSectorNumber, std::size_t numberOfSectors = 1)
+                : ReadWriteDiskBuffer<MAX_SECTORS>(startingSectorNumber, numberOfSectors) { }
+
+            using ReadWriteDiskBuffer<MAX_SECTORS>::repoint;
+            using ReadWriteDiskBuffer<MAX_SECTORS>::getStartingSectorNumber;
+            using ReadWriteDiskBuffer<MAX_SECTORS>::getWindowLength;
 
             class ShortFileName {
                 public:
@@ -52,6 +63,14 @@ namespace LiOS86 {
                         return ShortFileName(entryPtr, sfnFlags);
                     }
 
+                    // compares the raw, space-padded 11-character name field in place
+                    auto hasShortFileName(const char* sfnField) const -> bool {
+                        for(int i = 0; i < SFN_FIELD_LENGTH; ++i) {
+                            if(entryPtr[i] != static_cast<uint8_t>(sfnField[i])) return false;
+                        }
+                        return true;
+                    }
+
                     auto getFileSizeInBytes() const -> uint32_t {
                         return readFromMemoryAndPun<uint32_t>(entryPtr, 28);
                     }
@@ -62,6 +81,19 @@ namespace LiOS86 {
                         return (clusterNumberHighBits << 16) + clusterNumberLowBits;
                     }
 
+                    auto getAttributes() const -> uint8_t {
+                        return entryPtr[11];
+                    }
+
+                    // marks the end of the directory, no entries in use follow
+                    auto isEndOfDirectory() const -> bool {
+                        return entryPtr[0] == 0x00;
+                    }
+
+                    auto isFree() const -> bool {
+                        return entryPtr[0] == 0xE5;
+                    }
+
                     auto isReadOnly() const -> bool {
                         return entryPtr[11] & 0x01;
                     }
@@ -89,8 +121,40 @@ namespace LiOS86 {
                     auto isLongFileNameEntry() const -> bool {
                         return entryPtr[11] == 0x0F;
                     }
+
+                    // checksum of the raw 11-character name, stored in each long file name entry belonging to it
+                    auto getShortFileNameChecksum() const -> uint8_t {
+                        uint8_t checksum = 0;
+                        for(int i = 0; i < SFN_FIELD_LENGTH; ++i) {
+                            checksum = static_cast<uint8_t>(((checksum & 1) << 7) + (checksum >> 1) + entryPtr[i]);
+                        }
+                        return checksum;
+                    }
+
+                    // Long file name entries precede the short name entry they belong to, in reverse order:
+                    // the one with order number 1 holds characters 0 to 12 of the name and comes last.
+                    auto getLongNameOrder() const -> uint8_t {
+                        return entryPtr[0] & 0x1F;
+                    }
+
+                    auto isLastLongNameEntry() const -> bool {
+                        return entryPtr[0] & 0x40;
+                    }
+
+                    auto getLongNameChecksum() const -> uint8_t {
+                        return entryPtr[13];
+                    }
+
+                    // UCS-2 code unit i (0 to 12) of the entry's part of the name, read in place
+                    auto getLongNameCharacter(std::size_t i) const -> uint16_t {
+                        static constexpr uint8_t CHARACTER_OFFSETS[LONG_NAME_CHARACTERS_PER_ENTRY] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+                        return readFromMemoryAndPun<uint16_t>(entryPtr, CHARACTER_OFFSETS[i]);
+                    }
+
+                    static constexpr std::size_t LONG_NAME_CHARACTERS_PER_ENTRY = 13;
                 
                 private:
+                    static constexpr auto SFN_FIELD_LENGTH = 11;
                     const uint8_t* entryPtr;
             };
 
@@ -136,13 +200,51 @@ namespace LiOS86 {
                     const uint8_t* entryPtr; 
             };
 
+            static constexpr std::size_t ENTRIES_PER_SECTOR = 16;
+
+            auto getNumberOfEntries() const -> std::size_t {
+                return getWindowLength() * ENTRIES_PER_SECTOR;
+            }
+
+            // entries are indexed from the start of the window
+            auto entryAt(std::size_t index) const -> DirectoryEntryHandle {
+                return DirectoryEntryHandle(bufferData() + index * ENTRY_SIZE);
+            }
+
+            // Fills the entry with a new short name entry. There is no clock to take timestamps from,
+            // so the dates are set to the FAT epoch (1980-01-01) and the times to midnight.
+            auto writeShortNameEntry(std::size_t index, const char* sfnField, uint8_t attributes, uint32_t firstCluster, uint32_t fileSize) -> void {
+                static constexpr uint16_t EPOCH_DATE = (1 << 5) | 1;
+                auto entryPtr = mutableSectorData(index / ENTRIES_PER_SECTOR) + (index % ENTRIES_PER_SECTOR) * ENTRY_SIZE;
+                xstd::memset(entryPtr, 0, ENTRY_SIZE);
+                xstd::memcpy(entryPtr, sfnField, SFN_FIELD_LENGTH);
+                entryPtr[11] = attributes;
+                writeToMemory(entryPtr, 16, EPOCH_DATE);
+                writeToMemory(entryPtr, 18, EPOCH_DATE);
+                writeToMemory(entryPtr, 24, EPOCH_DATE);
+                writeLocation(entryPtr, firstCluster, fileSize);
+            }
+
+            auto updateEntry(std::size_t index, uint32_t firstCluster, uint32_t fileSize) -> void {
+                writeLocation(mutableSectorData(index / ENTRIES_PER_SECTOR) + (index % ENTRIES_PER_SECTOR) * ENTRY_SIZE, firstCluster, fileSize);
+            }
+
             auto begin() const -> DirectoryEntryIterator {
                 return DirectoryEntryIterator(bufferData());
             }
 
             auto end() const -> DirectoryEntryIterator {
-                static constexpr auto SECTOR_SIZE = 512;
-                return DirectoryEntryIterator(bufferData() + SECTOR_SIZE);
+                return DirectoryEntryIterator(bufferData() + getNumberOfEntries() * ENTRY_SIZE);
+            }
+
+        private:
+            static constexpr std::size_t ENTRY_SIZE = 32;
+            static constexpr std::size_t SFN_FIELD_LENGTH = 11;
+
+            static auto writeLocation(uint8_t* entryPtr, uint32_t firstCluster, uint32_t fileSize) -> void {
+                writeToMemory(entryPtr, 20, static_cast<uint16_t>(firstCluster >> 16));
+                writeToMemory(entryPtr, 26, static_cast<uint16_t>(firstCluster & 0xFFFF));
+                writeToMemory(entryPtr, 28, fileSize);
             }
 
     };
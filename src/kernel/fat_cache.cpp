@@ -0,0 +1,153 @@
+#include "fat_cache.hpp"
+
+namespace LiOS86 {
+
+    auto FATCache::mountImpl(const BPBHandle& bpb, uint32_t partitionStartingSector) -> void {
+        fatStartingSector = partitionStartingSector + bpb.getFirstActiveFATOffsetInSectors();
+        fatSizeInSectors = bpb.getFATSizeInSectors();
+        firstFATSector = partitionStartingSector + bpb.getFATOffsetInSectors(0);
+        numberOfFATs = bpb.getNumberOfFATs();
+        mirrored = bpb.isFATMirrored();
+        dataStartingSector = partitionStartingSector + bpb.getDataSectionOffsetInSectors();
+        sectorsPerCluster = bpb.getSectorsPerCluster();
+        rootDirectoryCluster = bpb.getRootDirectoryStartingCluster();
+        const auto dataSectors = bpb.getNumberOfSectorsInVolume() - bpb.getDataSectionOffsetInSectors();
+        const auto clustersInVolume = dataSectors / bpb.getSectorsPerCluster() + 2;
+        const auto entriesInFAT = bpb.getFATSizeInSectors() * FATSectorHandle::ENTRIES_PER_SECTOR;
+        clusterLimit = clustersInVolume < entriesInFAT ? clustersInVolume : entriesInFAT;
+        numberOfRuns = 0;
+        clockHand = 0;
+        numberOfDirtySectors = 0;
+    }
+
+    // index of the first run starting after the cluster
+    auto FATCache::upperBound(uint32_t cluster) const -> std::size_t {
+        std::size_t low = 0;
+        std::size_t high = numberOfRuns;
+        while(low < high) {
+            const auto middle = low + (high - low) / 2;
+            if(runs[middle].run.firstCluster <= cluster) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return low;
+    }
+
+    auto FATCache::runAtImpl(uint32_t cluster) -> xstd::expected<ClusterRun, FATError> {
+        if(cluster < 2 || cluster >= clusterLimit) return xstd::unexpected(FATError::INVALID_CLUSTER);
+
+        const auto index = upperBound(cluster);
+        if(index > 0) {
+            auto& cached = runs[index - 1];
+            const auto runEnd = cached.run.firstCluster + cached.run.length;
+            if(cluster < runEnd) {
+                cached.recentlyUsed = true;
+                return ClusterRun{cluster, runEnd - cluster, cached.run.nextCluster};
+            }
+        }
+        return scanRun(cluster, index);
+    }
+
+    // Reads FAT entries from the cluster on for as long as each one points to the following cluster,
+    // a whole FAT sector per block cache access. Reaching the start of a remembered run extends that run instead.
+    auto FATCache::scanRun(uint32_t cluster, std::size_t insertionIndex) -> ClusterRun {
+        const auto followingRunStart = insertionIndex < numberOfRuns ? runs[insertionIndex].run.firstCluster : clusterLimit;
+        auto current = cluster;
+        while(true) {
+            const auto sector = FATSectorHandle(fatStartingSector + current / FATSectorHandle::ENTRIES_PER_SECTOR);
+            do {
+                const auto entry = sector.getEntry(current % FATSectorHandle::ENTRIES_PER_SECTOR);
+                if(entry != current + 1 || entry >= clusterLimit) {
+                    const auto run = ClusterRun{cluster, current - cluster + 1, entry};
+                    insertRun(run, insertionIndex);
+                    return run;
+                }
+                ++current;
+                if(current == followingRunStart) {
+                    auto& following = runs[insertionIndex];
+                    following.run.length += following.run.firstCluster - cluster;
+                    following.run.firstCluster = cluster;
+                    following.recentlyUsed = true;
+                    return following.run;
+                }
+            } while(current % FATSectorHandle::ENTRIES_PER_SECTOR != 0);
+        }
+    }
+
+    auto FATCache::insertRun(const ClusterRun& run, std::size_t insertionIndex) -> void {
+        if(numberOfRuns == RUN_CAPACITY && evictRun() < insertionIndex) --insertionIndex;
+        for(auto i = numberOfRuns; i > insertionIndex; --i) {
+            runs[i] = runs[i - 1];
+        }
+        runs[insertionIndex] = CachedRun{run, true};
+        ++numberOfRuns;
+    }
+
+    // removes a run picked with CLOCK and returns its former index
+    auto FATCache::evictRun() -> std::size_t {
+        while(true) {
+            if(clockHand >= numberOfRuns) clockHand = 0;
+            if(runs[clockHand].recentlyUsed) {
+                runs[clockHand].recentlyUsed = false;
+                ++clockHand;
+                continue;
+            }
+            const auto evicted = clockHand;
+            for(auto i = evicted; i + 1 < numberOfRuns; ++i) {
+                runs[i] = runs[i + 1];
+            }
+            --numberOfRuns;
+            return evicted;
+        }
+    }
+
+    auto FATCache::removeRunContaining(uint32_t cluster) -> void {
+        const auto index = upperBound(cluster);
+        if(index == 0) return;
+        const auto& run = runs[index - 1].run;
+        if(cluster >= run.firstCluster + run.length) return;
+        for(auto i = index - 1; i + 1 < numberOfRuns; ++i) {
+            runs[i] = runs[i + 1];
+        }
+        --numberOfRuns;
+    }
+
+    auto FATCache::setEntryImpl(uint32_t cluster, uint32_t value) -> bool {
+        if(cluster < 2 || cluster >= clusterLimit) return false;
+        removeRunContaining(cluster);
+
+        const auto sectorIndex = cluster / FATSectorHandle::ENTRIES_PER_SECTOR;
+        auto sector = FATSectorHandle(fatStartingSector + sectorIndex);
+        sector.setEntry(cluster % FATSectorHandle::ENTRIES_PER_SECTOR, value);
+
+        if(!mirrored || numberOfFATs < 2) return true;
+        for(std::size_t i = 0; i < numberOfDirtySectors; ++i) {
+            if(dirtySectors[i] == sectorIndex) return true;
+        }
+        // sectors whose mirrors could not be written stay in the list, only a list still full is an error
+        if(numberOfDirtySectors == DIRTY_SECTORS_CAPACITY) static_cast<void>(flushMirrorsImpl());
+        if(numberOfDirtySectors == DIRTY_SECTORS_CAPACITY) return false;
+        dirtySectors[numberOfDirtySectors++] = sectorIndex;
+        return true;
+    }
+
+    // A sector is only removed from the list once all of its mirrors are written; failed ones are kept
+    // (moved to the front) so that the next flush retries them.
+    auto FATCache::flushMirrorsImpl() -> bool {
+        std::size_t numberOfFailed = 0;
+        alignas(ATA_SECTOR_SIZE) uint8_t sector[ATA_SECTOR_SIZE];
+        for(std::size_t i = 0; i < numberOfDirtySectors; ++i) {
+            bool written = BlockCache::read(fatStartingSector + dirtySectors[i], 1, xstd::span<uint8_t>(sector)).has_value();
+            for(uint8_t fat = 1; written && fat < numberOfFATs; ++fat) {
+                const auto mirrorSector = firstFATSector + fat * fatSizeInSectors + dirtySectors[i];
+                written = BlockCache::write(mirrorSector, 1, xstd::span<const uint8_t>(sector)).has_value();
+            }
+            if(!written) dirtySectors[numberOfFailed++] = dirtySectors[i];
+        }
+        numberOfDirtySectors = numberOfFailed;
+        return numberOfFailed == 0;
+    }
+
+}
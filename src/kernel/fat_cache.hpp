@@ -0,0 +1,166 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "block_cache.hpp"
+#include "bpb.hpp"
+#include "utils/data_manipulation.hpp"
+#include "xstd/array.hpp"
+#include "xstd/expected.hpp"
+
+namespace LiOS86 {
+
+    // value written to mark the last cluster of a chain, and that of free clusters
+    constexpr uint32_t END_OF_CHAIN_CLUSTER = 0x0FFFFFFF;
+    constexpr uint32_t FREE_CLUSTER = 0x00000000;
+
+    constexpr auto isChainCluster(uint32_t cluster) -> bool {
+        return cluster > 0x00000001 && cluster < 0x0FFFFFF7;
+    }
+
+    constexpr auto isEndOfChainCluster(uint32_t cluster) -> bool {
+        return cluster >= 0x0FFFFFF8 && cluster <= 0x0FFFFFFF;
+    }
+
+    class FATSectorHandle : CachedSector {
+        public:
+            static constexpr uint32_t ENTRIES_PER_SECTOR = ATA_SECTOR_SIZE / 4;
+
+            explicit FATSectorHandle(uint32_t sectorNumber) : CachedSector(sectorNumber) { }
+
+            auto getEntry(uint32_t indexInSector) const -> uint32_t {
+                return readFromMemoryAndPun<uint32_t>(bufferData(), indexInSector * 4) & 0x0FFFFFFF;
+            }
+
+            // the upper 4 bits of FAT32 entries are reserved and have to be preserved
+            auto setEntry(uint32_t indexInSector, uint32_t value) -> void {
+                const auto reserved = readFromMemoryAndPun<uint32_t>(bufferData(), indexInSector * 4) & 0xF0000000;
+                writeToMemory(mutableBufferData(), indexInSector * 4, reserved | (value & 0x0FFFFFFF));
+            }
+    };
+
+    // Part of a cluster chain made of physically consecutive clusters: firstCluster, firstCluster + 1, ...,
+    // firstCluster + length - 1, followed in the chain by nextCluster (the FAT entry of the last one).
+    class ClusterRun {
+        public:
+            uint32_t firstCluster;
+            uint32_t length;
+            uint32_t nextCluster;
+    };
+
+    // The File Allocation Table of the mounted FAT32 volume. Nothing is preloaded: a FAT sector is read
+    // through the block cache when an entry in it is needed. Chains that have been walked are remembered
+    // as runs of consecutive clusters (extents), sorted by their first cluster, so following a file
+    // costs one lookup per fragment instead of one FAT entry per cluster.
+    // Runs are always scanned up to the end of the consecutive part, which keeps them disjoint.
+    // The cache also knows where the clusters of the mounted volume are stored.
+    // Entries are written to the active FAT only; the FAT sectors changed since the last flushMirrors()
+    // are recorded and copied to the mirror FATs in one pass, instead of every update being written to each copy.
+    class FATCache {
+        public:
+            FATCache(const FATCache&) = delete;
+            FATCache& operator=(const FATCache&) = delete;
+            FATCache(FATCache&&) = delete;
+            FATCache& operator=(FATCache&&) = delete;
+
+            static auto& instance() {
+                static FATCache fat_cache;
+                return fat_cache;
+            }
+
+            static constexpr std::size_t RUN_CAPACITY = 256;
+            static constexpr std::size_t DIRTY_SECTORS_CAPACITY = 32;
+
+            enum class FATError : uint8_t { INVALID_CLUSTER };
+
+            // makes the active FAT of the volume described by the BPB the one accessed; forgets all runs
+            static auto mount(const BPBHandle& bpb, uint32_t partitionStartingSector) -> void {
+                instance().mountImpl(bpb, partitionStartingSector);
+            }
+
+            // the FAT entry of the cluster, i.e. the next cluster of its chain or an end-of-chain/bad/free marker
+            static auto nextCluster(uint32_t cluster) -> xstd::expected<uint32_t, FATError> {
+                const auto run = instance().runAtImpl(cluster);
+                if(!run) return xstd::unexpected(run.error());
+                return run->length > 1 ? cluster + 1 : run->nextCluster;
+            }
+
+            // the consecutive clusters of the chain starting at the given cluster
+            static auto runAt(uint32_t cluster) -> xstd::expected<ClusterRun, FATError> {
+                return instance().runAtImpl(cluster);
+            }
+
+            // updates the FAT entry of the cluster (in the block cache) and forgets the run containing it;
+            // returns false for clusters outside the volume
+            static auto setEntry(uint32_t cluster, uint32_t value) -> bool {
+                return instance().setEntryImpl(cluster, value);
+            }
+
+            // copies the FAT sectors changed since the last call to the mirror FATs; returns false if any write failed
+            static auto flushMirrors() -> bool {
+                return instance().flushMirrorsImpl();
+            }
+
+            // forgets all runs
+            static auto invalidate() -> void {
+                instance().numberOfRuns = 0;
+            }
+
+            static auto getNumberOfClusters() -> uint32_t {
+                return instance().clusterLimit >= 2 ? instance().clusterLimit - 2 : 0;
+            }
+
+            static auto getRootDirectoryCluster() -> uint32_t {
+                return instance().rootDirectoryCluster;
+            }
+
+            static auto getSectorsPerCluster() -> uint8_t {
+                return instance().sectorsPerCluster;
+            }
+
+            // sector of the active FAT holding the entry of the cluster
+            static auto entrySector(uint32_t cluster) -> uint32_t {
+                return instance().fatStartingSector + cluster / FATSectorHandle::ENTRIES_PER_SECTOR;
+            }
+
+            static auto clusterToSector(uint32_t cluster) -> uint32_t {
+                return instance().dataStartingSector + (cluster - 2) * instance().sectorsPerCluster;
+            }
+
+        private:
+            FATCache() = default;
+
+            class CachedRun {
+                public:
+                    ClusterRun run;
+                    bool recentlyUsed;     // CLOCK reference bit, as in the block cache
+            };
+
+            auto mountImpl(const BPBHandle& bpb, uint32_t partitionStartingSector) -> void;
+            auto runAtImpl(uint32_t cluster) -> xstd::expected<ClusterRun, FATError>;
+            auto upperBound(uint32_t cluster) const -> std::size_t;
+            auto scanRun(uint32_t cluster, std::size_t insertionIndex) -> ClusterRun;
+            auto insertRun(const ClusterRun& run, std::size_t insertionIndex) -> void;
+            auto evictRun() -> std::size_t;
+            auto removeRunContaining(uint32_t cluster) -> void;
+            auto setEntryImpl(uint32_t cluster, uint32_t value) -> bool;
+            auto flushMirrorsImpl() -> bool;
+
+            uint32_t fatStartingSector{0};
+            uint32_t fatSizeInSectors{0};
+            uint32_t firstFATSector{0};         // start of FAT 0
+            uint8_t numberOfFATs{1};
+            bool mirrored{true};
+            uint32_t dataStartingSector{0};
+            uint32_t rootDirectoryCluster{0};
+            uint8_t sectorsPerCluster{1};
+            uint32_t clusterLimit{0};           // one past the last valid cluster number
+            xstd::array<CachedRun, RUN_CAPACITY> runs{};
+            std::size_t numberOfRuns{0};
+            std::size_t clockHand{0};
+            xstd::array<uint32_t, DIRTY_SECTORS_CAPACITY> dirtySectors{};     // relative to the start of the FAT
+            std::size_t numberOfDirtySectors{0};
+    };
+
+}
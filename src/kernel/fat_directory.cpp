@@ -0,0 +1,279 @@
+#include "fat_directory.hpp"
+
+#include "block_cache.hpp"
+#include "cluster_allocator.hpp"
+#include "directory_sector.hpp"
+#include "fat_cache.hpp"
+#include "file_extent_map.hpp"
+#include "xstd/array.hpp"
+
+namespace LiOS86 {
+
+    namespace {
+
+        constexpr std::size_t SFN_NAME_LENGTH = 8;
+        constexpr std::size_t SFN_EXTENSION_LENGTH = 3;
+        using ShortFileNameField = xstd::array<char, SFN_NAME_LENGTH + SFN_EXTENSION_LENGTH>;
+
+        enum class ShortNameError : uint8_t { NOT_A_SHORT_NAME };
+
+        auto isShortNameCharacter(char c) -> bool {
+            constexpr const char* SPECIAL_CHARACTERS = "$%'-_@~`!(){}^#&";
+            if((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || static_cast<uint8_t>(c) >= 0x80) return true;
+            for(auto special = SPECIAL_CHARACTERS; *special; ++special) {
+                if(c == *special) return true;
+            }
+            return false;
+        }
+
+        // converts e.g. "kernel.bin" into the raw, space-padded "KERNEL  BIN" stored in directory entries
+        auto toShortFileNameField(const char* name, std::size_t nameLength) -> xstd::expected<ShortFileNameField, ShortNameError> {
+            ShortFileNameField field{};
+            field.fill(' ');
+            if((nameLength == 1 && name[0] == '.') || (nameLength == 2 && name[0] == '.' && name[1] == '.')) {
+                for(std::size_t i = 0; i < nameLength; ++i) field[i] = '.';
+                return field;
+            }
+
+            std::size_t dot = nameLength;
+            for(std::size_t i = 0; i < nameLength; ++i) {
+                if(name[i] != '.') continue;
+                if(dot != nameLength) return xstd::unexpected(ShortNameError::NOT_A_SHORT_NAME);
+                dot = i;
+            }
+            const auto extensionLength = dot < nameLength ? nameLength - dot - 1 : 0;
+            if(dot == 0 || dot > SFN_NAME_LENGTH || extensionLength > SFN_EXTENSION_LENGTH) {
+                return xstd::unexpected(ShortNameError::NOT_A_SHORT_NAME);
+            }
+
+            for(std::size_t i = 0; i < nameLength; ++i) {
+                if(i == dot) continue;
+                auto c = name[i];
+                if(c >= 'a' && c <= 'z') c = static_cast<char>(c - 'a' + 'A');
+                if(!isShortNameCharacter(c)) return xstd::unexpected(ShortNameError::NOT_A_SHORT_NAME);
+                field[i < dot ? i : SFN_NAME_LENGTH + (i - dot - 1)] = c;
+            }
+            return field;
+        }
+
+        using DirectoryEntryHandle = DirectorySectorHandle::DirectoryEntryHandle;
+
+        class EntrySlot {
+            public:
+                uint32_t sector;
+                uint8_t index;
+        };
+
+        enum class SlotError : uint8_t { DIRECTORY_FULL, BAD_CLUSTER_CHAIN };
+
+        auto slotAt(const DirectorySectorHandle& window, std::size_t index) -> EntrySlot {
+            return EntrySlot{static_cast<uint32_t>(window.getStartingSectorNumber() + index / DirectorySectorHandle::ENTRIES_PER_SECTOR),
+                             static_cast<uint8_t>(index % DirectorySectorHandle::ENTRIES_PER_SECTOR)};
+        }
+
+        // First free or never used entry of the directory. The last cluster of the chain is stored on the way,
+        // so a full directory can be extended.
+        auto findFreeSlot(uint32_t directoryCluster, uint32_t& lastCluster) -> xstd::expected<EntrySlot, SlotError> {
+            const auto sectorsPerCluster = FATCache::getSectorsPerCluster();
+            auto window = DirectorySectorHandle(FATCache::clusterToSector(directoryCluster), 0);
+            auto cluster = directoryCluster;
+            while(isChainCluster(cluster)) {
+                const auto run = FATCache::runAt(cluster);
+                if(!run) return xstd::unexpected(SlotError::BAD_CLUSTER_CHAIN);
+
+                const auto firstSector = FATCache::clusterToSector(cluster);
+                const auto numberOfSectors = run->length * sectorsPerCluster;
+                for(uint32_t i = 0; i < numberOfSectors; i += DirectorySectorHandle::MAX_SECTORS) {
+                    window.repoint(firstSector + i, numberOfSectors - i);
+                    for(std::size_t index = 0; index < window.getNumberOfEntries(); ++index) {
+                        const auto entry = window.entryAt(index);
+                        if(entry.isEndOfDirectory() || entry.isFree()) return slotAt(window, index);
+                    }
+                }
+                lastCluster = cluster + run->length - 1;
+                cluster = run->nextCluster;
+            }
+            if(!isEndOfChainCluster(cluster)) return xstd::unexpected(SlotError::BAD_CLUSTER_CHAIN);
+            return xstd::unexpected(SlotError::DIRECTORY_FULL);
+        }
+
+        // appends a zeroed cluster (all entries unused) to the directory; returns its first sector.
+        // If anything fails, the chain is terminated at its old last cluster again and the new cluster is freed.
+        auto extendDirectory(uint32_t lastCluster) -> xstd::expected<uint32_t, DirectoryUpdateError> {
+            const auto allocated = ClusterAllocator::allocate(1, lastCluster + 1);
+            if(!allocated) return xstd::unexpected(DirectoryUpdateError::VOLUME_FULL);
+            const auto cluster = allocated->firstCluster;
+            const auto fail = [cluster, lastCluster](bool linked) -> xstd::expected<uint32_t, DirectoryUpdateError> {
+                if(linked) static_cast<void>(FATCache::setEntry(lastCluster, END_OF_CHAIN_CLUSTER));
+                static_cast<void>(FATCache::setEntry(cluster, FREE_CLUSTER));
+                ClusterAllocator::release(cluster);
+                return xstd::unexpected(DirectoryUpdateError::DEVICE_ERROR);
+            };
+
+            alignas(ATA_SECTOR_SIZE) uint8_t zeroes[ATA_SECTOR_SIZE] = {};
+            const auto firstSector = FATCache::clusterToSector(cluster);
+            for(uint32_t i = 0; i < FATCache::getSectorsPerCluster(); ++i) {
+                if(!BlockCache::write(firstSector + i, 1, xstd::span<const uint8_t>(zeroes))) return fail(false);
+            }
+            // the new cluster is terminated before it is linked, so the chain is valid at every point;
+            // a failed setEntry may still have changed the primary FAT, so the link is undone as well
+            if(!FATCache::setEntry(cluster, END_OF_CHAIN_CLUSTER)) return fail(false);
+            if(!FATCache::setEntry(lastCluster, cluster)) return fail(true);
+            return firstSector;
+        }
+
+        // case-insensitive for ASCII and Latin-1 letters
+        constexpr auto foldCase(uint16_t c) -> uint16_t {
+            if((c >= 'a' && c <= 'z') || (c >= 0xE0 && c <= 0xFE && c != 0xF7)) return static_cast<uint16_t>(c - 0x20);
+            return c;
+        }
+
+        // Matches a long file name against the entries of a directory as they are scanned, comparing
+        // the UCS-2 code units in the sector data directly with the (Latin-1) name searched for.
+        // A long name only counts if its entries come in order and their checksum matches the short name entry that follows.
+        class LongNameMatcher {
+            public:
+                static constexpr std::size_t MAX_NAME_LENGTH = 255;
+
+                LongNameMatcher(const char* searchedName, std::size_t searchedNameLength) :
+                    name{searchedName}, nameLength{searchedNameLength},
+                    numberOfEntries{searchedNameLength <= MAX_NAME_LENGTH ?
+                        (searchedNameLength + DirectoryEntryHandle::LONG_NAME_CHARACTERS_PER_ENTRY - 1) / DirectoryEntryHandle::LONG_NAME_CHARACTERS_PER_ENTRY : 0} { }
+
+                auto consumeLongNameEntry(const DirectoryEntryHandle& entry) -> void {
+                    const auto order = entry.getLongNameOrder();
+                    if(entry.isLastLongNameEntry()) {
+                        matching = order == numberOfEntries;
+                        checksum = entry.getLongNameChecksum();
+                    } else if(order != expectedOrder || entry.getLongNameChecksum() != checksum) {
+                        matching = false;
+                    }
+                    if(!matching) return;
+                    matching = matchesCharacters(entry, order);
+                    expectedOrder = static_cast<uint8_t>(order - 1);
+                }
+
+                // true if the long name preceding the short name entry is the one searched for
+                auto completesMatch(const DirectoryEntryHandle& entry) -> bool {
+                    const auto matched = matching && expectedOrder == 0 && entry.getShortFileNameChecksum() == checksum;
+                    reset();
+                    return matched;
+                }
+
+                auto reset() -> void {
+                    matching = false;
+                }
+
+            private:
+                auto matchesCharacters(const DirectoryEntryHandle& entry, uint8_t order) const -> bool {
+                    const auto firstCharacter = (order - 1u) * DirectoryEntryHandle::LONG_NAME_CHARACTERS_PER_ENTRY;
+                    for(std::size_t i = 0; i < DirectoryEntryHandle::LONG_NAME_CHARACTERS_PER_ENTRY; ++i) {
+                        const auto position = firstCharacter + i;
+                        const auto c = entry.getLongNameCharacter(i);
+                        // the name is terminated with 0x0000 unless it fills the entry; the padding after it is not checked
+                        if(position > nameLength) break;
+                        if(position == nameLength) return c == 0x0000;
+                        if(foldCase(c) != foldCase(static_cast<uint8_t>(name[position]))) return false;
+                    }
+                    return true;
+                }
+
+                const char* name;
+                std::size_t nameLength;
+                std::size_t numberOfEntries;
+                bool matching{false};
+                uint8_t checksum{0};
+                uint8_t expectedOrder{0};
+        };
+
+    }
+
+    auto findDirectoryEntry(uint32_t directoryCluster, const char* name, std::size_t nameLength) -> xstd::expected<DirectoryEntryInfo, DirectoryLookupError> {
+        const auto key = NormalizedName(name, nameLength);
+        const auto cached = DentryCache::lookup(directoryCluster, key);
+        if(cached) return *cached;
+        if(cached.error() == DentryCache::LookupError::DOES_NOT_EXIST) return xstd::unexpected(DirectoryLookupError::NOT_FOUND);
+
+        // names that are not valid 8.3 names can only match long file names
+        const auto sfnField = toShortFileNameField(name, nameLength);
+        auto longName = LongNameMatcher(name, nameLength);
+
+        // the directory is scanned run by run, through a window moved along each run
+        const auto sectorsPerCluster = FATCache::getSectorsPerCluster();
+        auto window = DirectorySectorHandle(FATCache::clusterToSector(directoryCluster), 0);
+        auto cluster = directoryCluster;
+        while(isChainCluster(cluster)) {
+            const auto run = FATCache::runAt(cluster);
+            if(!run) return xstd::unexpected(DirectoryLookupError::BAD_CLUSTER_CHAIN);
+
+            const auto firstSector = FATCache::clusterToSector(cluster);
+            const auto numberOfSectors = run->length * sectorsPerCluster;
+            for(uint32_t i = 0; i < numberOfSectors; i += DirectorySectorHandle::MAX_SECTORS) {
+                window.repoint(firstSector + i, numberOfSectors - i);
+                for(std::size_t index = 0; index < window.getNumberOfEntries(); ++index) {
+                    const auto entry = window.entryAt(index);
+                    if(entry.isEndOfDirectory()) {
+                        DentryCache::insertNegative(directoryCluster, key);
+                        return xstd::unexpected(DirectoryLookupError::NOT_FOUND);
+                    }
+                    if(entry.isFree()) {
+                        longName.reset();
+                        continue;
+                    }
+                    if(entry.isLongFileNameEntry()) {
+                        longName.consumeLongNameEntry(entry);
+                        continue;
+                    }
+                    const auto longNameMatched = longName.completesMatch(entry);
+                    if(entry.isVolumeID()) continue;
+                    if(longNameMatched || (sfnField && entry.hasShortFileName(sfnField->data()))) {
+                        const auto slot = slotAt(window, index);
+                        const auto info = DirectoryEntryInfo{entry.getFirstClusterNumber(), entry.getFileSizeInBytes(), entry.getAttributes(), slot.sector, slot.index};
+                        DentryCache::insert(directoryCluster, key, info);
+                        return info;
+                    }
+                }
+            }
+            cluster = run->nextCluster;
+        }
+
+        if(!isEndOfChainCluster(cluster)) return xstd::unexpected(DirectoryLookupError::BAD_CLUSTER_CHAIN);
+        DentryCache::insertNegative(directoryCluster, key);
+        return xstd::unexpected(DirectoryLookupError::NOT_FOUND);
+    }
+
+    auto createDirectoryEntry(uint32_t directoryCluster, const char* name, std::size_t nameLength, uint8_t attributes) -> xstd::expected<DirectoryEntryInfo, DirectoryUpdateError> {
+        const auto sfnField = toShortFileNameField(name, nameLength);
+        if(!sfnField || (*sfnField)[0] == '.') return xstd::unexpected(DirectoryUpdateError::INVALID_NAME);
+        const auto existing = findDirectoryEntry(directoryCluster, name, nameLength);
+        if(existing) return xstd::unexpected(DirectoryUpdateError::ALREADY_EXISTS);
+        if(existing.error() == DirectoryLookupError::BAD_CLUSTER_CHAIN) return xstd::unexpected(DirectoryUpdateError::BAD_CLUSTER_CHAIN);
+
+        uint32_t lastCluster = directoryCluster;
+        const auto slot = findFreeSlot(directoryCluster, lastCluster);
+        if(!slot && slot.error() == SlotError::BAD_CLUSTER_CHAIN) return xstd::unexpected(DirectoryUpdateError::BAD_CLUSTER_CHAIN);
+        auto location = EntrySlot{0, 0};
+        if(slot) {
+            location = *slot;
+        } else {
+            const auto extended = extendDirectory(lastCluster);
+            if(!extended) return xstd::unexpected(extended.error());
+            location.sector = *extended;
+            FileExtentMapCache::invalidate(directoryCluster);
+        }
+
+        // a reused end-of-directory slot is followed by zeroed entries, so the rest of the directory stays terminated
+        auto directorySector = DirectorySectorHandle(location.sector);
+        directorySector.writeShortNameEntry(location.index, sfnField->data(), attributes, 0, 0);
+        const auto info = DirectoryEntryInfo{0, 0, attributes, location.sector, location.index};
+        DentryCache::insert(directoryCluster, NormalizedName(name, nameLength), info);
+        return info;
+    }
+
+    auto updateDirectoryEntry(uint32_t entrySector, uint8_t entryIndex, uint32_t firstCluster, uint32_t fileSize) -> void {
+        auto directorySector = DirectorySectorHandle(entrySector);
+        directorySector.updateEntry(entryIndex, firstCluster, fileSize);
+        DentryCache::update(entrySector, entryIndex, firstCluster, fileSize);
+    }
+
+}
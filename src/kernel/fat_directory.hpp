@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "dentry_cache.hpp"
+#include "xstd/expected.hpp"
+
+namespace LiOS86 {
+
+    enum class DirectoryLookupError : uint8_t { NOT_FOUND, BAD_CLUSTER_CHAIN };
+    enum class DirectoryUpdateError : uint8_t { INVALID_NAME, ALREADY_EXISTS, VOLUME_FULL, BAD_CLUSTER_CHAIN, DEVICE_ERROR };
+
+    // Finds the entry with the given (case-insensitive) short or long name in the directory starting at the cluster
+    // of the volume mounted by the FAT cache. Results, including misses, are kept in the dentry cache.
+    auto findDirectoryEntry(uint32_t directoryCluster, const char* name, std::size_t nameLength) -> xstd::expected<DirectoryEntryInfo, DirectoryLookupError>;
+
+    // Adds an entry for an empty file or directory with the given name, which has to be a valid 8.3 name
+    // (long file names are only matched, not created). The first free slot is reused; a full directory
+    // is extended with a zeroed cluster. The new entry goes into the dentry cache.
+    auto createDirectoryEntry(uint32_t directoryCluster, const char* name, std::size_t nameLength, uint8_t attributes) -> xstd::expected<DirectoryEntryInfo, DirectoryUpdateError>;
+
+    // writes a file's first cluster and size to its entry (through the block cache) and to the dentry cache
+    auto updateDirectoryEntry(uint32_t entrySector, uint8_t entryIndex, uint32_t firstCluster, uint32_t fileSize) -> void;
+
+}
@@ -0,0 +1,536 @@
+#include "fat_file.hpp"
+
+#include "block_cache.hpp"
+#include "cluster_allocator.hpp"
+#include "fat_cache.hpp"
+#include "fat_directory.hpp"
+#include "fat_path.hpp"
+#include "file_extent_map.hpp"
+#include "xstd/cstring.hpp"
+
+namespace LiOS86 {
+
+    namespace {
+
+        auto toFileError(PathError error) -> FileError {
+            switch(error) {
+                case PathError::INVALID_PATH:
+                    return FileError::INVALID_PATH;
+                case PathError::NOT_FOUND:
+                    return FileError::NOT_FOUND;
+                case PathError::NOT_A_DIRECTORY:
+                    return FileError::NOT_A_DIRECTORY;
+                case PathError::BAD_CLUSTER_CHAIN:
+                    return FileError::BAD_CLUSTER_CHAIN;
+                default:
+                    return FileError::BAD_CLUSTER_CHAIN;
+            }
+        }
+
+        auto toFileError(DirectoryUpdateError error) -> FileError {
+            switch(error) {
+                case DirectoryUpdateError::INVALID_NAME:
+                    return FileError::INVALID_PATH;
+                case DirectoryUpdateError::ALREADY_EXISTS:
+                    return FileError::INVALID_PATH;
+                case DirectoryUpdateError::VOLUME_FULL:
+                    return FileError::VOLUME_FULL;
+                case DirectoryUpdateError::BAD_CLUSTER_CHAIN:
+                    return FileError::BAD_CLUSTER_CHAIN;
+                case DirectoryUpdateError::DEVICE_ERROR:
+                    return FileError::DEVICE_ERROR;
+                default:
+                    return FileError::BAD_CLUSTER_CHAIN;
+            }
+        }
+
+        constexpr uint8_t ARCHIVE_ATTRIBUTE = 0x20;
+
+        // the cluster following the given one for the readahead, 0 (not a chain cluster) if the FAT cannot tell
+        auto nextChainCluster(uint32_t cluster) -> uint32_t {
+            return FATCache::nextCluster(cluster).value_or(0u);
+        }
+
+        // copies part of a single sector through the block cache
+        auto readPartialSector(uint32_t sectorNumber, uint32_t offsetInSector, xstd::span<uint8_t> destination) -> bool {
+            alignas(ATA_SECTOR_SIZE) uint8_t sector[ATA_SECTOR_SIZE];
+            if(!BlockCache::read(sectorNumber, 1, xstd::span<uint8_t>(sector))) return false;
+            xstd::memcpy(destination.data(), sector + offsetInSector, destination.size());
+            return true;
+        }
+
+        // whole sectors straight into the destination; drivers that cannot transfer into it get it sector by sector
+        auto readWholeSectors(uint32_t firstSector, uint16_t numberOfSectors, xstd::span<uint8_t> destination) -> bool {
+            const auto result = BlockCache::readUncached(firstSector, numberOfSectors, destination);
+            if(result) return true;
+            if(result.error() != DiskError::MISALIGNED_BUFFER) return false;
+            for(uint32_t i = 0; i < numberOfSectors; ++i) {
+                if(!readPartialSector(firstSector + i, 0, destination.subspan(i * ATA_SECTOR_SIZE, ATA_SECTOR_SIZE))) return false;
+            }
+            return true;
+        }
+
+        // changes part of a single sector through the block cache; without a source it is zeroed
+        auto writePartialSector(uint32_t sectorNumber, uint32_t offsetInSector, uint32_t count, const uint8_t* source) -> bool {
+            alignas(ATA_SECTOR_SIZE) uint8_t sector[ATA_SECTOR_SIZE];
+            if(count < ATA_SECTOR_SIZE && !BlockCache::read(sectorNumber, 1, xstd::span<uint8_t>(sector))) return false;
+            if(source != nullptr) {
+                xstd::memcpy(sector + offsetInSector, source, count);
+            } else {
+                xstd::memset(sector + offsetInSector, 0, count);
+            }
+            return BlockCache::write(sectorNumber, 1, xstd::span<const uint8_t>(sector)).has_value();
+        }
+
+        auto writeWholeSectors(uint32_t firstSector, uint16_t numberOfSectors, xstd::span<const uint8_t> source) -> bool {
+            const auto result = BlockCache::writeUncached(firstSector, numberOfSectors, source);
+            if(result) return true;
+            if(result.error() != DiskError::MISALIGNED_BUFFER) return false;
+            return BlockCache::write(firstSector, numberOfSectors, source).has_value();
+        }
+
+    }
+
+    // Pending data is flushed first, as it changes the FAT and the directory entries; everything else
+    // has only been written to the block cache so far and goes to the disk with its flush.
+    auto FileTable::syncImpl() -> bool {
+        bool succeeded = true;
+        for(auto& file : files) {
+            if(file.open) succeeded = flushPending(file, 0).has_value() && succeeded;
+        }
+        for(auto& file : files) {
+            if(file.open) writeEntryBack(file);
+        }
+        ClusterAllocator::sync();
+        succeeded = FATCache::flushMirrors() && succeeded;
+        return BlockCache::flush() && succeeded;
+    }
+
+    auto FileTable::closeImpl(FileDescriptor fd) -> void {
+        if(fd >= CAPACITY || !files[fd].open) return;
+        // pending data that cannot get clusters any more is lost, the file ends where the written data ends
+        static_cast<void>(flushPending(files[fd], 0));
+        writeEntryBack(files[fd]);
+        files[fd].open = false;
+    }
+
+    auto FileTable::openEntry(const DirectoryEntryInfo& info) -> xstd::expected<FileDescriptor, FileError> {
+        for(FileDescriptor fd = 0; fd < CAPACITY; ++fd) {
+            auto& file = files[fd];
+            if(file.open) continue;
+            file = OpenFile{};
+            file.firstCluster = info.firstCluster;
+            file.size = info.fileSize;
+            file.entrySector = info.entrySector;
+            file.entryIndex = info.entryIndex;
+            file.open = true;
+            file.readahead = FileReadahead(nextChainCluster, FATCache::clusterToSector, FATCache::getSectorsPerCluster());
+            // the entry may be outdated while the file is open elsewhere
+            for(const auto& other : files) {
+                if(&other == &file || !other.open || other.entrySector != file.entrySector || other.entryIndex != file.entryIndex) continue;
+                file.firstCluster = other.firstCluster;
+                file.size = other.size;
+                file.chainMapped = other.chainMapped;
+                file.clustersInChain = other.clustersInChain;
+                file.lastCluster = other.lastCluster;
+                break;
+            }
+            // the extent map is built on open, so that reads only search it
+            if(isChainCluster(file.firstCluster)) FileExtentMapCache::get(file.firstCluster);
+            return fd;
+        }
+        return xstd::unexpected(FileError::TOO_MANY_OPEN_FILES);
+    }
+
+    auto FileTable::openImpl(const char* path) -> xstd::expected<FileDescriptor, FileError> {
+        const auto info = resolvePath(path);
+        if(!info) return xstd::unexpected(toFileError(info.error()));
+        if(info->isDirectory()) return xstd::unexpected(FileError::IS_A_DIRECTORY);
+        return openEntry(*info);
+    }
+
+    auto FileTable::createImpl(const char* path) -> xstd::expected<FileDescriptor, FileError> {
+        if(path == nullptr || path[0] != '/') return xstd::unexpected(FileError::INVALID_PATH);
+        std::size_t length = 0;
+        std::size_t lastSlash = 0;
+        for(; path[length] != '\0'; ++length) {
+            if(path[length] == '/') lastSlash = length;
+        }
+        const auto name = path + lastSlash + 1;
+        const auto nameLength = length - lastSlash - 1;
+        if(nameLength == 0 || lastSlash > PathPrefixCache::MAX_PATH_LENGTH) return xstd::unexpected(FileError::INVALID_PATH);
+
+        xstd::array<char, PathPrefixCache::MAX_PATH_LENGTH + 2> parentPath{};
+        parentPath[0] = '/';
+        for(std::size_t i = 1; i < lastSlash; ++i) {
+            parentPath[i] = path[i];
+        }
+        const auto parent = resolvePath(parentPath.data());
+        if(!parent) return xstd::unexpected(toFileError(parent.error()));
+        if(!parent->isDirectory()) return xstd::unexpected(FileError::NOT_A_DIRECTORY);
+
+        const auto existing = findDirectoryEntry(parent->firstCluster, name, nameLength);
+        if(existing) {
+            if(existing->isDirectory()) return xstd::unexpected(FileError::IS_A_DIRECTORY);
+            const auto fd = openEntry(*existing);
+            if(!fd) return fd;
+            const auto truncated = truncateImpl(*fd, 0);
+            if(truncated) return fd;
+            close(*fd);
+            return xstd::unexpected(truncated.error());
+        }
+        if(existing.error() == DirectoryLookupError::BAD_CLUSTER_CHAIN) return xstd::unexpected(FileError::BAD_CLUSTER_CHAIN);
+
+        // a descriptor has to be available before the entry is created
+        bool descriptorAvailable = false;
+        for(const auto& file : files) {
+            descriptorAvailable = descriptorAvailable || !file.open;
+        }
+        if(!descriptorAvailable) return xstd::unexpected(FileError::TOO_MANY_OPEN_FILES);
+
+        const auto created = createDirectoryEntry(parent->firstCluster, name, nameLength, ARCHIVE_ATTRIBUTE);
+        if(!created) return xstd::unexpected(toFileError(created.error()));
+        return openEntry(*created);
+    }
+
+    auto FileTable::readImpl(FileDescriptor fd, xstd::span<uint8_t> destination) -> xstd::expected<uint32_t, FileError> {
+        if(fd >= CAPACITY || !files[fd].open) return xstd::unexpected(FileError::BAD_DESCRIPTOR);
+        const auto result = preadImpl(fd, destination, files[fd].position);
+        if(result) files[fd].position += *result;
+        return result;
+    }
+
+    auto FileTable::preadImpl(FileDescriptor fd, xstd::span<uint8_t> destination, uint32_t offset) -> xstd::expected<uint32_t, FileError> {
+        if(fd >= CAPACITY || !files[fd].open) return xstd::unexpected(FileError::BAD_DESCRIPTOR);
+        auto& file = files[fd];
+        if(offset >= file.size) return 0u;
+
+        const auto remainingInFile = file.size - offset;
+        const auto count = static_cast<uint32_t>(destination.size() < remainingInFile ? destination.size() : remainingInFile);
+        const auto flushed = flushSharedPending(file, nullptr, offset + count);
+        if(!flushed) return xstd::unexpected(flushed.error());
+        const auto& extents = FileExtentMapCache::get(file.firstCluster);
+        const auto clusterSize = static_cast<uint32_t>(FATCache::getSectorsPerCluster() * ATA_SECTOR_SIZE);
+        static constexpr uint32_t MAX_SECTORS_PER_TRANSFER = 0xffff;
+
+        uint32_t done = 0;
+        while(done < count) {
+            const auto position = offset + done;
+            const auto extent = extents.extentAt(position / clusterSize);
+            if(!extent) return xstd::unexpected(FileError::BAD_CLUSTER_CHAIN);
+
+            const auto offsetInExtent = position % clusterSize;
+            const auto sectorNumber = FATCache::clusterToSector(extent->diskCluster) + static_cast<uint32_t>(offsetInExtent / ATA_SECTOR_SIZE);
+            const auto offsetInSector = static_cast<uint32_t>(offsetInExtent % ATA_SECTOR_SIZE);
+            const auto bytesInExtent = static_cast<uint64_t>(extent->length) * clusterSize - offsetInExtent;
+            auto chunk = static_cast<uint32_t>(count - done < bytesInExtent ? count - done : bytesInExtent);
+
+            if(offsetInSector != 0 || chunk < ATA_SECTOR_SIZE) {
+                const auto restOfSector = static_cast<uint32_t>(ATA_SECTOR_SIZE) - offsetInSector;
+                if(chunk > restOfSector) chunk = restOfSector;
+                file.readahead.access(extent->diskCluster);
+                if(!readPartialSector(sectorNumber, offsetInSector, destination.subspan(done, chunk))) return xstd::unexpected(FileError::DEVICE_ERROR);
+            } else {
+                auto numberOfSectors = static_cast<uint32_t>(chunk / ATA_SECTOR_SIZE);
+                if(numberOfSectors > MAX_SECTORS_PER_TRANSFER) numberOfSectors = MAX_SECTORS_PER_TRANSFER;
+                chunk = static_cast<uint32_t>(numberOfSectors * ATA_SECTOR_SIZE);
+                if(!readWholeSectors(sectorNumber, static_cast<uint16_t>(numberOfSectors), destination.subspan(done, chunk))) return xstd::unexpected(FileError::DEVICE_ERROR);
+            }
+            done += chunk;
+        }
+        return count;
+    }
+
+    // The write counterpart of preadImpl, for space the file already has clusters for; without a source, zeroes are written.
+    auto FileTable::transfer(const OpenFile& file, uint32_t offset, uint32_t count, const uint8_t* source) -> xstd::expected<uint32_t, FileError> {
+        const auto& extents = FileExtentMapCache::get(file.firstCluster);
+        const auto clusterSize = static_cast<uint32_t>(FATCache::getSectorsPerCluster() * ATA_SECTOR_SIZE);
+        static constexpr uint32_t MAX_SECTORS_PER_TRANSFER = 0xffff;
+
+        uint32_t done = 0;
+        while(done < count) {
+            const auto position = offset + done;
+            const auto extent = extents.extentAt(position / clusterSize);
+            if(!extent) return xstd::unexpected(FileError::BAD_CLUSTER_CHAIN);
+
+            const auto offsetInExtent = position % clusterSize;
+            const auto sectorNumber = FATCache::clusterToSector(extent->diskCluster) + static_cast<uint32_t>(offsetInExtent / ATA_SECTOR_SIZE);
+            const auto offsetInSector = static_cast<uint32_t>(offsetInExtent % ATA_SECTOR_SIZE);
+            const auto bytesInExtent = static_cast<uint64_t>(extent->length) * clusterSize - offsetInExtent;
+            auto chunk = static_cast<uint32_t>(count - done < bytesInExtent ? count - done : bytesInExtent);
+            const auto chunkSource = source != nullptr ? source + done : nullptr;
+
+            // zeroes go through the block cache sector by sector, there is no source buffer to transfer them from
+            if(offsetInSector != 0 || chunk < ATA_SECTOR_SIZE || source == nullptr) {
+                const auto restOfSector = static_cast<uint32_t>(ATA_SECTOR_SIZE) - offsetInSector;
+                if(chunk > restOfSector) chunk = restOfSector;
+                if(!writePartialSector(sectorNumber, offsetInSector, chunk, chunkSource)) return xstd::unexpected(FileError::DEVICE_ERROR);
+            } else {
+                auto numberOfSectors = static_cast<uint32_t>(chunk / ATA_SECTOR_SIZE);
+                if(numberOfSectors > MAX_SECTORS_PER_TRANSFER) numberOfSectors = MAX_SECTORS_PER_TRANSFER;
+                chunk = static_cast<uint32_t>(numberOfSectors * ATA_SECTOR_SIZE);
+                if(!writeWholeSectors(sectorNumber, static_cast<uint16_t>(numberOfSectors), xstd::span<const uint8_t>(chunkSource, chunk))) return xstd::unexpected(FileError::DEVICE_ERROR);
+            }
+            done += chunk;
+        }
+        return count;
+    }
+
+    // counts the clusters of the file's chain and finds its last one, once per open file
+    auto FileTable::mapChain(OpenFile& file) -> xstd::expected<uint32_t, FileError> {
+        if(file.chainMapped) return file.clustersInChain;
+        uint32_t chainLength = 0;
+        uint32_t lastCluster = 0;
+        auto cluster = file.firstCluster;
+        while(isChainCluster(cluster)) {
+            const auto run = FATCache::runAt(cluster);
+            if(!run) return xstd::unexpected(FileError::BAD_CLUSTER_CHAIN);
+            chainLength += run->length;
+            lastCluster = cluster + run->length - 1;
+            cluster = run->nextCluster;
+        }
+        if(lastCluster != 0 && !isEndOfChainCluster(cluster)) return xstd::unexpected(FileError::BAD_CLUSTER_CHAIN);
+        file.clustersInChain = chainLength;
+        file.lastCluster = lastCluster;
+        file.chainMapped = true;
+        return chainLength;
+    }
+
+    // Makes the file's chain at least numberOfClusters long. New clusters are allocated as runs following
+    // the current end of the chain where possible; each run is terminated before it is linked to the chain.
+    auto FileTable::reserveClusters(OpenFile& file, uint32_t numberOfClusters) -> xstd::expected<uint32_t, FileError> {
+        const auto mapped = mapChain(file);
+        if(!mapped) return mapped;
+        if(file.clustersInChain >= numberOfClusters) return file.clustersInChain;
+
+        bool volumeFull = false;
+        bool entriesWritten = true;
+        while(file.clustersInChain < numberOfClusters) {
+            const auto allocated = ClusterAllocator::allocate(numberOfClusters - file.clustersInChain, file.lastCluster != 0 ? file.lastCluster + 1 : 0);
+            if(!allocated) {
+                volumeFull = true;
+                break;
+            }
+            const auto runEnd = allocated->firstCluster + allocated->length - 1;
+            for(auto runCluster = allocated->firstCluster; runCluster < runEnd; ++runCluster) {
+                entriesWritten = FATCache::setEntry(runCluster, runCluster + 1) && entriesWritten;
+            }
+            entriesWritten = FATCache::setEntry(runEnd, END_OF_CHAIN_CLUSTER) && entriesWritten;
+            if(file.lastCluster == 0) {
+                file.firstCluster = allocated->firstCluster;
+            } else {
+                entriesWritten = FATCache::setEntry(file.lastCluster, allocated->firstCluster) && entriesWritten;
+            }
+            file.clustersInChain += allocated->length;
+            file.lastCluster = runEnd;
+        }
+        // clusters allocated before the volume filled up stay with the file
+        FileExtentMapCache::invalidate(file.firstCluster);
+        setFileSize(file, file.size);
+        if(!entriesWritten) return xstd::unexpected(FileError::DEVICE_ERROR);
+        if(volumeFull) return xstd::unexpected(FileError::VOLUME_FULL);
+        return file.clustersInChain;
+    }
+
+    // returns false if a FAT entry could not be updated; the clusters are released to the allocator all the same
+    auto FileTable::freeClustersFrom(uint32_t cluster) -> bool {
+        bool entriesWritten = true;
+        while(isChainCluster(cluster)) {
+            const auto run = FATCache::runAt(cluster);
+            if(!run) return entriesWritten;
+            for(uint32_t i = 0; i < run->length; ++i) {
+                entriesWritten = FATCache::setEntry(cluster + i, FREE_CLUSTER) && entriesWritten;
+                ClusterAllocator::release(cluster + i);
+            }
+            cluster = run->nextCluster;
+        }
+        return entriesWritten;
+    }
+
+    // Gives the file's pending data its clusters, together with those for everything up to reserveUpTo,
+    // in a single allocation, and writes it. If the volume is full, the data that does not fit is dropped.
+    auto FileTable::flushPending(OpenFile& file, uint32_t reserveUpTo) -> xstd::expected<uint32_t, FileError> {
+        if(file.pendingLength == 0 && reserveUpTo == 0) return 0u;
+        const auto clusterSize = static_cast<uint32_t>(FATCache::getSectorsPerCluster() * ATA_SECTOR_SIZE);
+        const auto reservedEnd = static_cast<uint64_t>(reserveUpTo > file.size ? reserveUpTo : file.size);
+        const auto reserved = reserveClusters(file, static_cast<uint32_t>((reservedEnd + clusterSize - 1) / clusterSize));
+        if(file.pendingLength == 0) {
+            if(!reserved) return xstd::unexpected(reserved.error());
+            return 0u;
+        }
+
+        const auto pendingStart = file.size - file.pendingLength;
+        const auto chainEnd = static_cast<uint64_t>(file.clustersInChain) * clusterSize;
+        const auto writable = static_cast<uint32_t>(chainEnd - pendingStart < file.pendingLength ? chainEnd - pendingStart : file.pendingLength);
+        const auto written = transfer(file, pendingStart, writable, pendingBuffers[file.pendingBuffer].data());
+        pendingBufferUsed[file.pendingBuffer] = false;
+        file.pendingBuffer = NO_BUFFER;
+        file.pendingLength = 0;
+        if(!written) {
+            setFileSize(file, pendingStart);
+            return xstd::unexpected(written.error());
+        }
+        if(writable < file.size - pendingStart) setFileSize(file, pendingStart + writable);
+        if(!reserved) return xstd::unexpected(reserved.error());
+        return writable;
+    }
+
+    // flushes the pending data of the descriptors of the same file (except one) that starts before the given offset
+    auto FileTable::flushSharedPending(const OpenFile& file, const OpenFile* except, uint32_t before) -> xstd::expected<uint32_t, FileError> {
+        uint32_t flushed = 0;
+        for(auto& other : files) {
+            if(&other == except || !other.open || other.pendingLength == 0) continue;
+            if(other.entrySector != file.entrySector || other.entryIndex != file.entryIndex) continue;
+            if(other.size - other.pendingLength >= before) continue;
+            const auto result = flushPending(other, 0);
+            if(!result) return result;
+            flushed += *result;
+        }
+        return flushed;
+    }
+
+    // Keeps an append past the end of the chain in the file's pending buffer, if it has or can get one
+    // and the data fits; returns false otherwise.
+    auto FileTable::appendPending(OpenFile& file, xstd::span<const uint8_t> source) -> bool {
+        if(source.size() > PENDING_BUFFER_SIZE - file.pendingLength) return false;
+        if(file.pendingBuffer == NO_BUFFER) {
+            for(uint8_t buffer = 0; buffer < PENDING_BUFFERS; ++buffer) {
+                if(pendingBufferUsed[buffer]) continue;
+                pendingBufferUsed[buffer] = true;
+                file.pendingBuffer = buffer;
+                break;
+            }
+            if(file.pendingBuffer == NO_BUFFER) return false;
+        }
+        xstd::memcpy(pendingBuffers[file.pendingBuffer].data() + file.pendingLength, source.data(), source.size());
+        file.pendingLength += static_cast<uint32_t>(source.size());
+        setFileSize(file, file.size + static_cast<uint32_t>(source.size()));
+        return true;
+    }
+
+    // the entry itself is only written back on sync or close
+    auto FileTable::setFileSize(OpenFile& file, uint32_t size) -> void {
+        file.size = size;
+        file.entryOutdated = true;
+        shareMetadata(file);
+    }
+
+    auto FileTable::shareMetadata(const OpenFile& file) -> void {
+        for(auto& other : files) {
+            if(&other == &file || !other.open || other.entrySector != file.entrySector || other.entryIndex != file.entryIndex) continue;
+            other.firstCluster = file.firstCluster;
+            other.size = file.size;
+            other.entryOutdated = file.entryOutdated;
+            other.chainMapped = file.chainMapped;
+            other.clustersInChain = file.clustersInChain;
+            other.lastCluster = file.lastCluster;
+        }
+    }
+
+    auto FileTable::writeEntryBack(OpenFile& file) -> void {
+        if(!file.entryOutdated) return;
+        updateDirectoryEntry(file.entrySector, file.entryIndex, file.firstCluster, file.size);
+        file.entryOutdated = false;
+        shareMetadata(file);
+    }
+
+    auto FileTable::writeImpl(FileDescriptor fd, xstd::span<const uint8_t> source) -> xstd::expected<uint32_t, FileError> {
+        if(fd >= CAPACITY || !files[fd].open) return xstd::unexpected(FileError::BAD_DESCRIPTOR);
+        const auto result = pwriteImpl(fd, source, files[fd].position);
+        if(result) files[fd].position += *result;
+        return result;
+    }
+
+    auto FileTable::pwriteImpl(FileDescriptor fd, xstd::span<const uint8_t> source, uint32_t offset) -> xstd::expected<uint32_t, FileError> {
+        if(fd >= CAPACITY || !files[fd].open) return xstd::unexpected(FileError::BAD_DESCRIPTOR);
+        auto& file = files[fd];
+        if(source.size() == 0) return 0u;
+        const auto end = static_cast<uint64_t>(offset) + source.size();
+        if(end > 0xFFFFFFFF) return xstd::unexpected(FileError::FILE_TOO_LARGE);
+        const auto count = static_cast<uint32_t>(source.size());
+
+        const auto flushed = flushSharedPending(file, &file, 0xFFFFFFFF);
+        if(!flushed) return xstd::unexpected(flushed.error());
+        const auto mapped = mapChain(file);
+        if(!mapped) return mapped;
+
+        // appends past the end of the chain are delayed, the part that still fits into the last cluster is written right away
+        const auto clusterSize = static_cast<uint32_t>(FATCache::getSectorsPerCluster() * ATA_SECTOR_SIZE);
+        const auto chainEnd = static_cast<uint64_t>(file.clustersInChain) * clusterSize;
+        auto data = source;
+        if(offset == file.size && end > chainEnd) {
+            if(offset < chainEnd) {
+                const auto direct = static_cast<uint32_t>(chainEnd - offset);
+                const auto written = transfer(file, offset, direct, data.data());
+                if(!written) return written;
+                setFileSize(file, offset + direct);
+                offset += direct;
+                data = data.subspan(direct);
+            }
+            if(appendPending(file, data)) return count;
+        }
+
+        const auto pendingFlushed = flushPending(file, static_cast<uint32_t>(end));
+        if(!pendingFlushed) return xstd::unexpected(pendingFlushed.error());
+        if(offset > file.size) {
+            const auto zeroed = transfer(file, file.size, offset - file.size, nullptr);
+            if(!zeroed) return xstd::unexpected(zeroed.error());
+        }
+        const auto written = transfer(file, offset, static_cast<uint32_t>(data.size()), data.data());
+        if(!written) return written;
+        if(end > file.size) setFileSize(file, static_cast<uint32_t>(end));
+        return count;
+    }
+
+    auto FileTable::truncateImpl(FileDescriptor fd, uint32_t size) -> xstd::expected<uint32_t, FileError> {
+        if(fd >= CAPACITY || !files[fd].open) return xstd::unexpected(FileError::BAD_DESCRIPTOR);
+        auto& file = files[fd];
+        const auto flushed = flushSharedPending(file, nullptr, 0xFFFFFFFF);
+        if(!flushed) return xstd::unexpected(flushed.error());
+        if(size == file.size) return size;
+        const auto mapped = mapChain(file);
+        if(!mapped) return mapped;
+        const auto clusterSize = static_cast<uint32_t>(FATCache::getSectorsPerCluster() * ATA_SECTOR_SIZE);
+        const auto clustersKept = size / clusterSize + (size % clusterSize != 0 ? 1 : 0);
+
+        if(size > file.size) {
+            const auto reserved = reserveClusters(file, clustersKept);
+            if(!reserved) return xstd::unexpected(reserved.error());
+            const auto zeroed = transfer(file, file.size, size - file.size, nullptr);
+            if(!zeroed) return xstd::unexpected(zeroed.error());
+            setFileSize(file, size);
+            return size;
+        }
+
+        // the entry stops referring to freed clusters before they are freed
+        const auto oldFirstCluster = file.firstCluster;
+        bool entriesWritten = true;
+        if(clustersKept == 0) {
+            file.firstCluster = 0;
+            file.clustersInChain = 0;
+            file.lastCluster = 0;
+            setFileSize(file, 0);
+            writeEntryBack(file);
+            entriesWritten = freeClustersFrom(oldFirstCluster);
+        } else if(clustersKept < file.clustersInChain) {
+            const auto lastKept = FileExtentMapCache::get(oldFirstCluster).clusterAt(clustersKept - 1);
+            if(!lastKept) return xstd::unexpected(FileError::BAD_CLUSTER_CHAIN);
+            const auto lastCluster = *lastKept;
+            const auto next = FATCache::nextCluster(lastCluster);
+            if(!next) return xstd::unexpected(FileError::BAD_CLUSTER_CHAIN);
+            const auto firstFreed = *next;
+            file.clustersInChain = clustersKept;
+            file.lastCluster = lastCluster;
+            setFileSize(file, size);
+            writeEntryBack(file);
+            entriesWritten = FATCache::setEntry(lastCluster, END_OF_CHAIN_CLUSTER);
+            entriesWritten = freeClustersFrom(firstFreed) && entriesWritten;
+        } else {
+            setFileSize(file, size);
+        }
+        FileExtentMapCache::invalidate(oldFirstCluster);
+        if(!entriesWritten) return xstd::unexpected(FileError::DEVICE_ERROR);
+        return size;
+    }
+
+}
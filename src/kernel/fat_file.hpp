@@ -0,0 +1,154 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "ata.hpp"
+#include "cluster_readahead.hpp"
+#include "dentry_cache.hpp"
+#include "xstd/array.hpp"
+#include "xstd/expected.hpp"
+#include "xstd/span.hpp"
+
+namespace LiOS86 {
+
+    enum class FileError : uint8_t { INVALID_PATH, NOT_FOUND, NOT_A_DIRECTORY, IS_A_DIRECTORY, TOO_MANY_OPEN_FILES, BAD_DESCRIPTOR, BAD_CLUSTER_CHAIN, DEVICE_ERROR, VOLUME_FULL, FILE_TOO_LARGE };
+
+    // Open files of the volume mounted by the FAT cache.
+    // A read is split at the extents of the file (see FileExtentMap) only: the whole sectors of each extent
+    // are transferred with a single request straight into the caller's buffer (DMA'd when the driver can),
+    // without going through the block cache. Only a partial first or last sector is copied through it; those
+    // reads drive a per-file ClusterReadahead, so a file read in small pieces is prefetched a window ahead.
+    // Writes work the same way the other way round, with delayed allocation for appends: data past the clusters
+    // a file already has is kept in one of the PENDING_BUFFERS buffers, and clusters are only chosen for it when
+    // it is flushed (on sync, close, a read of it, a non-appending write or when the buffer is full). All of it
+    // then gets a single allocation, so files appended to in small pieces still come out contiguous.
+    // FAT, FSInfo and directory entry updates are likewise collected in memory and the block cache and written
+    // in one batch by sync(), which kmain calls once per sync interval (and the shell's sync command on demand)
+    // rather than per write; changes made since the last sync are lost if the machine is turned off.
+    class FileTable {
+        public:
+            FileTable(const FileTable&) = delete;
+            FileTable& operator=(const FileTable&) = delete;
+            FileTable(FileTable&&) = delete;
+            FileTable& operator=(FileTable&&) = delete;
+
+            static auto& instance() {
+                static FileTable file_table;
+                return file_table;
+            }
+
+            using FileDescriptor = uint8_t;
+            static constexpr std::size_t CAPACITY = 16;
+
+            static auto open(const char* path) -> xstd::expected<FileDescriptor, FileError> {
+                return instance().openImpl(path);
+            }
+
+            // opens the file, truncated to 0 bytes if it exists; a new file gets an 8.3 name entry in its directory
+            static auto create(const char* path) -> xstd::expected<FileDescriptor, FileError> {
+                return instance().createImpl(path);
+            }
+
+            // flushes the file's pending data and updates its directory entry (in the block cache)
+            static auto close(FileDescriptor fd) -> void {
+                instance().closeImpl(fd);
+            }
+
+            // reads from the current position and advances it; returns the number of bytes read, 0 at the end of the file
+            static auto read(FileDescriptor fd, xstd::span<uint8_t> destination) -> xstd::expected<uint32_t, FileError> {
+                return instance().readImpl(fd, destination);
+            }
+
+            // reads from the given offset, the current position is not used nor changed
+            static auto pread(FileDescriptor fd, xstd::span<uint8_t> destination, uint32_t offset) -> xstd::expected<uint32_t, FileError> {
+                return instance().preadImpl(fd, destination, offset);
+            }
+
+            // writes at the current position and advances it; returns the number of bytes written
+            static auto write(FileDescriptor fd, xstd::span<const uint8_t> source) -> xstd::expected<uint32_t, FileError> {
+                return instance().writeImpl(fd, source);
+            }
+
+            // writes at the given offset, extending the file if needed; a gap after the old end of the file is zero-filled
+            static auto pwrite(FileDescriptor fd, xstd::span<const uint8_t> source, uint32_t offset) -> xstd::expected<uint32_t, FileError> {
+                return instance().pwriteImpl(fd, source, offset);
+            }
+
+            // shrinks the file, freeing the clusters past its new end, or extends it with zeroes; returns the new size
+            static auto truncate(FileDescriptor fd, uint32_t size) -> xstd::expected<uint32_t, FileError> {
+                return instance().truncateImpl(fd, size);
+            }
+
+            // Allocates clusters for all pending data and writes it, then the directory entries, the FSInfo hints,
+            // the FAT mirrors and all cached sectors to the disk; returns false if anything could not be written.
+            static auto sync() -> bool {
+                return instance().syncImpl();
+            }
+
+            static auto seek(FileDescriptor fd, uint32_t position) -> xstd::expected<uint32_t, FileError> {
+                if(fd >= CAPACITY || !instance().files[fd].open) return xstd::unexpected(FileError::BAD_DESCRIPTOR);
+                instance().files[fd].position = position;
+                return position;
+            }
+
+            static auto getFileSize(FileDescriptor fd) -> xstd::expected<uint32_t, FileError> {
+                if(fd >= CAPACITY || !instance().files[fd].open) return xstd::unexpected(FileError::BAD_DESCRIPTOR);
+                return instance().files[fd].size;
+            }
+
+        private:
+            FileTable() = default;
+
+            static constexpr std::size_t PENDING_BUFFERS = 4;
+            static constexpr std::size_t PENDING_BUFFER_SIZE = 32 * 1024;
+            static constexpr uint8_t NO_BUFFER = 0xff;
+
+            using ClusterFunction = uint32_t (*)(uint32_t);
+            using FileReadahead = ClusterReadahead<ClusterFunction, ClusterFunction>;
+
+            class OpenFile {
+                public:
+                    uint32_t firstCluster{0};
+                    uint32_t size{0};
+                    uint32_t position{0};
+                    uint32_t entrySector{0};
+                    uint8_t entryIndex{0};
+                    bool open{false};
+                    bool entryOutdated{false};      // size or first cluster changed since the entry was written
+                    bool chainMapped{false};        // clustersInChain and lastCluster are known
+                    uint32_t clustersInChain{0};
+                    uint32_t lastCluster{0};
+                    // data appended past the end of the chain, waiting for clusters: [clustersInChain * cluster size, size)
+                    uint8_t pendingBuffer{NO_BUFFER};
+                    uint32_t pendingLength{0};
+                    FileReadahead readahead{};
+            };
+
+            auto openEntry(const DirectoryEntryInfo& info) -> xstd::expected<FileDescriptor, FileError>;
+            auto openImpl(const char* path) -> xstd::expected<FileDescriptor, FileError>;
+            auto createImpl(const char* path) -> xstd::expected<FileDescriptor, FileError>;
+            auto transfer(const OpenFile& file, uint32_t offset, uint32_t count, const uint8_t* source) -> xstd::expected<uint32_t, FileError>;
+            auto mapChain(OpenFile& file) -> xstd::expected<uint32_t, FileError>;
+            auto reserveClusters(OpenFile& file, uint32_t numberOfClusters) -> xstd::expected<uint32_t, FileError>;
+            auto freeClustersFrom(uint32_t cluster) -> bool;
+            auto flushPending(OpenFile& file, uint32_t reserveUpTo) -> xstd::expected<uint32_t, FileError>;
+            auto flushSharedPending(const OpenFile& file, const OpenFile* except, uint32_t before) -> xstd::expected<uint32_t, FileError>;
+            auto shareMetadata(const OpenFile& file) -> void;
+            auto appendPending(OpenFile& file, xstd::span<const uint8_t> source) -> bool;
+            auto setFileSize(OpenFile& file, uint32_t size) -> void;
+            auto writeEntryBack(OpenFile& file) -> void;
+            auto closeImpl(FileDescriptor fd) -> void;
+            auto syncImpl() -> bool;
+            auto writeImpl(FileDescriptor fd, xstd::span<const uint8_t> source) -> xstd::expected<uint32_t, FileError>;
+            auto pwriteImpl(FileDescriptor fd, xstd::span<const uint8_t> source, uint32_t offset) -> xstd::expected<uint32_t, FileError>;
+            auto truncateImpl(FileDescriptor fd, uint32_t size) -> xstd::expected<uint32_t, FileError>;
+            auto readImpl(FileDescriptor fd, xstd::span<uint8_t> destination) -> xstd::expected<uint32_t, FileError>;
+            auto preadImpl(FileDescriptor fd, xstd::span<uint8_t> destination, uint32_t offset) -> xstd::expected<uint32_t, FileError>;
+
+            xstd::array<OpenFile, CAPACITY> files{};
+            alignas(ATA_SECTOR_SIZE) xstd::array<xstd::array<uint8_t, PENDING_BUFFER_SIZE>, PENDING_BUFFERS> pendingBuffers{};
+            xstd::array<bool, PENDING_BUFFERS> pendingBufferUsed{};
+    };
+
+}
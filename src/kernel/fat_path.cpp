@@ -0,0 +1,127 @@
+#include "fat_path.hpp"
+
+#include "fat_cache.hpp"
+#include "fat_directory.hpp"
+
+namespace LiOS86 {
+
+    namespace {
+
+        constexpr std::size_t MAX_DEPTH = 32;
+        constexpr uint8_t DIRECTORY_ATTRIBUTE = 0x10;
+
+        // FNV-1a
+        auto hashPrefix(const char* prefix, std::size_t length) -> uint32_t {
+            uint32_t hash = 2166136261u;
+            for(std::size_t i = 0; i < length; ++i) {
+                hash = (hash ^ static_cast<uint8_t>(prefix[i])) * 16777619u;
+            }
+            return hash;
+        }
+
+        auto isDotComponent(const char* name, std::size_t length) -> bool {
+            return (length == 1 && name[0] == '.') || (length == 2 && name[0] == '.' && name[1] == '.');
+        }
+
+        auto toPathError(DirectoryLookupError error) -> PathError {
+            switch(error) {
+                case DirectoryLookupError::NOT_FOUND:
+                    return PathError::NOT_FOUND;
+                case DirectoryLookupError::BAD_CLUSTER_CHAIN:
+                    return PathError::BAD_CLUSTER_CHAIN;
+                default:
+                    return PathError::BAD_CLUSTER_CHAIN;
+            }
+        }
+
+    }
+
+    auto resolvePath(const char* path) -> xstd::expected<DirectoryEntryInfo, PathError> {
+        if(path == nullptr || path[0] != '/') return xstd::unexpected(PathError::INVALID_PATH);
+        const auto rootCluster = FATCache::getRootDirectoryCluster();
+        const auto rootInfo = DirectoryEntryInfo{rootCluster, 0, DIRECTORY_ATTRIBUTE, 0, 0};
+
+        // the normalized path is built first, recording where each component ends
+        xstd::array<char, PathPrefixCache::MAX_PATH_LENGTH> normalized{};
+        xstd::array<std::size_t, MAX_DEPTH> componentEnds{};
+        std::size_t length = 0;
+        std::size_t depth = 0;
+        for(auto c = path; *c != '\0';) {
+            if(*c == '/') {
+                ++c;
+                continue;
+            }
+            if(depth == MAX_DEPTH || length == PathPrefixCache::MAX_PATH_LENGTH) return xstd::unexpected(PathError::INVALID_PATH);
+            normalized[length++] = '/';
+            for(; *c != '\0' && *c != '/'; ++c) {
+                if(length == PathPrefixCache::MAX_PATH_LENGTH) return xstd::unexpected(PathError::INVALID_PATH);
+                normalized[length++] = (*c >= 'a' && *c <= 'z') ? static_cast<char>(*c - 'a' + 'A') : *c;
+            }
+            componentEnds[depth++] = length;
+        }
+        if(depth == 0) return rootInfo;
+
+        // resolution starts from the deepest parent directory in the prefix cache
+        std::size_t resolvedDepth = depth - 1;
+        uint32_t directoryCluster = rootCluster;
+        for(; resolvedDepth > 0; --resolvedDepth) {
+            const auto cached = PathPrefixCache::lookup(normalized.data(), componentEnds[resolvedDepth - 1]);
+            if(cached) {
+                directoryCluster = *cached;
+                break;
+            }
+        }
+
+        for(auto i = resolvedDepth; i < depth; ++i) {
+            const auto componentStart = (i == 0 ? 0 : componentEnds[i - 1]) + 1;
+            const auto name = normalized.data() + componentStart;
+            const auto nameLength = componentEnds[i] - componentStart;
+
+            auto info = rootInfo;
+            // the root directory has no dot entries of its own
+            if(directoryCluster != rootCluster || !isDotComponent(name, nameLength)) {
+                const auto found = findDirectoryEntry(directoryCluster, name, nameLength);
+                if(!found) return xstd::unexpected(toPathError(found.error()));
+                info = *found;
+            }
+            // ".." entries of the root's subdirectories refer to it as cluster 0
+            if(info.isDirectory() && info.firstCluster == 0) info.firstCluster = rootCluster;
+
+            if(i + 1 == depth) return info;
+            if(!info.isDirectory()) return xstd::unexpected(PathError::NOT_A_DIRECTORY);
+            directoryCluster = info.firstCluster;
+            PathPrefixCache::insert(normalized.data(), componentEnds[i], directoryCluster);
+        }
+        return xstd::unexpected(PathError::INVALID_PATH);
+    }
+
+    auto PathPrefixCache::find(const char* normalizedPrefix, std::size_t length) const -> const Entry* {
+        const auto hash = hashPrefix(normalizedPrefix, length);
+        for(const auto& entry : entries) {
+            if(entry.length != length || entry.hash != hash) continue;
+            std::size_t i = 0;
+            while(i < length && entry.characters[i] == normalizedPrefix[i]) ++i;
+            if(i == length) return &entry;
+        }
+        return nullptr;
+    }
+
+    auto PathPrefixCache::lookupImpl(const char* normalizedPrefix, std::size_t length) -> xstd::expected<uint32_t, LookupError> {
+        const auto entry = find(normalizedPrefix, length);
+        if(entry == nullptr) return xstd::unexpected(LookupError::NOT_CACHED);
+        return entry->directoryCluster;
+    }
+
+    auto PathPrefixCache::insertImpl(const char* normalizedPrefix, std::size_t length, uint32_t directoryCluster) -> void {
+        if(length == 0 || length > MAX_PATH_LENGTH || find(normalizedPrefix, length) != nullptr) return;
+        auto& entry = entries[nextReplaced];
+        nextReplaced = (nextReplaced + 1) % CAPACITY;
+        entry.hash = hashPrefix(normalizedPrefix, length);
+        entry.directoryCluster = directoryCluster;
+        entry.length = length;
+        for(std::size_t i = 0; i < length; ++i) {
+            entry.characters[i] = normalizedPrefix[i];
+        }
+    }
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "dentry_cache.hpp"
+#include "xstd/array.hpp"
+#include "xstd/expected.hpp"
+
+namespace LiOS86 {
+
+    enum class PathError : uint8_t { INVALID_PATH, NOT_FOUND, NOT_A_DIRECTORY, BAD_CLUSTER_CHAIN };
+
+    // Resolves an absolute, case-insensitive path such as /A/B/C.TXT on the volume mounted by the FAT cache.
+    // Empty components are ignored, so "//A/" is "/A"; "/" is the root directory itself.
+    auto resolvePath(const char* path) -> xstd::expected<DirectoryEntryInfo, PathError>;
+
+    // First clusters of recently resolved directories, keyed by their normalized path ("/A/B", upper-cased,
+    // single slashes). A lookup starts from the deepest cached parent, so opening files deep in the tree
+    // does not walk every parent directory again. Entries are replaced round-robin.
+    class PathPrefixCache {
+        public:
+            PathPrefixCache(const PathPrefixCache&) = delete;
+            PathPrefixCache& operator=(const PathPrefixCache&) = delete;
+            PathPrefixCache(PathPrefixCache&&) = delete;
+            PathPrefixCache& operator=(PathPrefixCache&&) = delete;
+
+            static auto& instance() {
+                static PathPrefixCache path_prefix_cache;
+                return path_prefix_cache;
+            }
+
+            static constexpr std::size_t CAPACITY = 32;
+            static constexpr std::size_t MAX_PATH_LENGTH = 127;
+
+            enum class LookupError : uint8_t { NOT_CACHED };
+
+            static auto lookup(const char* normalizedPrefix, std::size_t length) -> xstd::expected<uint32_t, LookupError> {
+                return instance().lookupImpl(normalizedPrefix, length);
+            }
+
+            static auto insert(const char* normalizedPrefix, std::size_t length, uint32_t directoryCluster) -> void {
+                instance().insertImpl(normalizedPrefix, length, directoryCluster);
+            }
+
+            // needed whenever a directory is removed or renamed
+            static auto invalidateAll() -> void {
+                for(auto& entry : instance().entries) {
+                    entry.length = 0;
+                }
+            }
+
+        private:
+            PathPrefixCache() = default;
+
+            class Entry {
+                public:
+                    uint32_t hash{0};
+                    uint32_t directoryCluster{0};
+                    std::size_t length{0};      // 0 for unused entries
+                    xstd::array<char, MAX_PATH_LENGTH> characters{};
+            };
+
+            auto find(const char* normalizedPrefix, std::size_t length) const -> const Entry*;
+            auto lookupImpl(const char* normalizedPrefix, std::size_t length) -> xstd::expected<uint32_t, LookupError>;
+            auto insertImpl(const char* normalizedPrefix, std::size_t length, uint32_t directoryCluster) -> void;
+
+            xstd::array<Entry, CAPACITY> entries{};
+            std::size_t nextReplaced{0};
+    };
+
+}
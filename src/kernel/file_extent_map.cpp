@@ -0,0 +1,80 @@
+#include "file_extent_map.hpp"
+
+#include "fat_cache.hpp"
+
+namespace LiOS86 {
+
+    namespace {
+        constexpr uint32_t BAD_CLUSTER = 0x0FFFFFF7;
+    }
+
+    FileExtentMap::FileExtentMap(uint32_t startingCluster) : firstCluster{startingCluster} {
+        auto cluster = startingCluster;
+        while(numberOfExtents < CAPACITY && isChainCluster(cluster)) {
+            const auto run = FATCache::runAt(cluster);
+            if(!run) {
+                cluster = BAD_CLUSTER;
+                break;
+            }
+            extents[numberOfExtents++] = FileExtent{mappedClusters, cluster, run->length};
+            mappedClusters += run->length;
+            cluster = run->nextCluster;
+        }
+        continuationCluster = cluster;
+    }
+
+    auto FileExtentMap::isComplete() const -> bool {
+        return isEndOfChainCluster(continuationCluster);
+    }
+
+    auto FileExtentMap::extentAt(uint32_t fileCluster) const -> xstd::expected<FileExtent, ExtentError> {
+        if(fileCluster < mappedClusters) {
+            // the last extent starting at or before the file cluster
+            std::size_t low = 0;
+            std::size_t high = numberOfExtents - 1;
+            while(low < high) {
+                const auto middle = high - (high - low) / 2;
+                if(extents[middle].fileCluster <= fileCluster) {
+                    low = middle;
+                } else {
+                    high = middle - 1;
+                }
+            }
+            const auto& extent = extents[low];
+            const auto offset = fileCluster - extent.fileCluster;
+            return FileExtent{fileCluster, extent.diskCluster + offset, extent.length - offset};
+        }
+
+        auto position = mappedClusters;
+        auto cluster = continuationCluster;
+        while(isChainCluster(cluster)) {
+            const auto run = FATCache::runAt(cluster);
+            if(!run) return xstd::unexpected(ExtentError::BAD_CLUSTER_CHAIN);
+            if(fileCluster < position + run->length) {
+                const auto offset = fileCluster - position;
+                return FileExtent{fileCluster, cluster + offset, run->length - offset};
+            }
+            position += run->length;
+            cluster = run->nextCluster;
+        }
+        if(isEndOfChainCluster(cluster)) return xstd::unexpected(ExtentError::BEYOND_END_OF_FILE);
+        return xstd::unexpected(ExtentError::BAD_CLUSTER_CHAIN);
+    }
+
+    auto FileExtentMapCache::getImpl(uint32_t firstCluster) -> const FileExtentMap& {
+        for(const auto& map : maps) {
+            if(map.getFirstCluster() == firstCluster) return map;
+        }
+        auto& replaced = maps[nextReplaced];
+        nextReplaced = (nextReplaced + 1) % CAPACITY;
+        replaced = FileExtentMap(firstCluster);
+        return replaced;
+    }
+
+    auto FileExtentMapCache::invalidateImpl(uint32_t firstCluster) -> void {
+        for(auto& map : maps) {
+            if(map.getFirstCluster() == firstCluster) map = FileExtentMap();
+        }
+    }
+
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "xstd/array.hpp"
+#include "xstd/expected.hpp"
+
+namespace LiOS86 {
+
+    // Clusters fileCluster, fileCluster + 1, ... of a file stored in the consecutive disk clusters
+    // diskCluster, diskCluster + 1, ...
+    class FileExtent {
+        public:
+            uint32_t fileCluster;
+            uint32_t diskCluster;
+            uint32_t length;
+    };
+
+    // Cluster chain of a file as a list of extents sorted by file cluster index, so that the disk cluster
+    // holding any offset is found with a binary search instead of a walk from the start of the chain.
+    // Built from the runs of the FAT cache. Files with more than CAPACITY fragments have only their first
+    // CAPACITY extents mapped; beyond those, the chain is followed run by run.
+    class FileExtentMap {
+        public:
+            static constexpr std::size_t CAPACITY = 32;
+
+            enum class ExtentError : uint8_t { BEYOND_END_OF_FILE, BAD_CLUSTER_CHAIN };
+
+            // an empty map, not describing any file
+            FileExtentMap() = default;
+            explicit FileExtentMap(uint32_t startingCluster);
+
+            auto getFirstCluster() const -> uint32_t {
+                return firstCluster;
+            }
+
+            // true if the whole chain is mapped and it ends properly
+            auto isComplete() const -> bool;
+
+            // the file's cluster count; only exact for complete maps
+            auto getNumberOfMappedClusters() const -> uint32_t {
+                return mappedClusters;
+            }
+
+            // the rest of the extent holding the given file cluster, starting from that cluster
+            auto extentAt(uint32_t fileCluster) const -> xstd::expected<FileExtent, ExtentError>;
+
+            auto clusterAt(uint32_t fileCluster) const -> xstd::expected<uint32_t, ExtentError> {
+                const auto extent = extentAt(fileCluster);
+                if(!extent) return xstd::unexpected(extent.error());
+                return extent->diskCluster;
+            }
+
+        private:
+            uint32_t firstCluster{0};
+            xstd::array<FileExtent, CAPACITY> extents{};
+            std::size_t numberOfExtents{0};
+            uint32_t mappedClusters{0};
+            uint32_t continuationCluster{0};    // FAT entry following the last mapped extent
+    };
+
+    // Extent maps of the most recently opened files, keyed by their first cluster; built on first use.
+    class FileExtentMapCache {
+        public:
+            FileExtentMapCache(const FileExtentMapCache&) = delete;
+            FileExtentMapCache& operator=(const FileExtentMapCache&) = delete;
+            FileExtentMapCache(FileExtentMapCache&&) = delete;
+            FileExtentMapCache& operator=(FileExtentMapCache&&) = delete;
+
+            static auto& instance() {
+                static FileExtentMapCache file_extent_map_cache;
+                return file_extent_map_cache;
+            }
+
+            static constexpr std::size_t CAPACITY = 8;
+
+            // the reference stays valid until CAPACITY other files have been looked up
+            static auto get(uint32_t firstCluster) -> const FileExtentMap& {
+                return instance().getImpl(firstCluster);
+            }
+
+            // drops the map of the file, needed whenever its cluster chain changes
+            static auto invalidate(uint32_t firstCluster) -> void {
+                instance().invalidateImpl(firstCluster);
+            }
+
+        private:
+            FileExtentMapCache() = default;
+
+            auto getImpl(uint32_t firstCluster) -> const FileExtentMap&;
+            auto invalidateImpl(uint32_t firstCluster) -> void;
+
+            xstd::array<FileExtentMap, CAPACITY> maps{};
+            std::size_t nextReplaced{0};
+    };
+
+}
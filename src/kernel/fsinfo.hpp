@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "block_cache.hpp"
+#include "utils/data_manipulation.hpp"
+
+namespace LiOS86 {
+
+    // FAT32 FSInfo sector: hints about free space, maintained by the driver writing to the volume.
+    // Both values may be unknown (0xFFFFFFFF) and neither is guaranteed to be accurate.
+    class FSInfoHandle : CachedSector {
+        public:
+            static constexpr uint32_t UNKNOWN = 0xFFFFFFFF;
+
+            explicit FSInfoHandle(uint32_t sectorNumber) : CachedSector(sectorNumber) { }
+
+            auto isValid() const -> bool {
+                return readFromMemoryAndPun<uint32_t>(bufferData(), 0) == 0x41615252
+                    && readFromMemoryAndPun<uint32_t>(bufferData(), 484) == 0x61417272
+                    && readFromMemoryAndPun<uint32_t>(bufferData(), 508) == 0xAA550000;
+            }
+
+            auto getFreeClusterCount() const -> uint32_t {
+                return readFromMemoryAndPun<uint32_t>(bufferData(), 488);
+            }
+
+            // cluster the search for a free one should start at
+            auto getNextFreeCluster() const -> uint32_t {
+                return readFromMemoryAndPun<uint32_t>(bufferData(), 492);
+            }
+
+            auto setFreeClusterCount(uint32_t count) -> void {
+                writeToMemory(mutableBufferData(), 488, count);
+            }
+
+            auto setNextFreeCluster(uint32_t cluster) -> void {
+                writeToMemory(mutableBufferData(), 492, cluster);
+            }
+    };
+
+}
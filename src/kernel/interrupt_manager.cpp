@@ -9,6 +9,7 @@ static constexpr uint8_t PIC1_VECTOR_OFFSET = 0x20;
 static constexpr uint8_t PIC1_VECTOR_NUMBER = 8;
 static constexpr uint8_t PIC2_VECTOR_OFFSET = 0x28;
 static constexpr uint8_t PIC2_VECTOR_NUMBER = 8;
+static constexpr uint8_t PIC2_CASCADE_IRQ = 2;
 
 extern void (*isr_stub_table[])();
 
@@ -65,14 +66,15 @@ namespace LiOS86 {
 
 		auto mask_pic2_interrupt(uint8_t interrupt_number) -> void {
 			uint8_t mask = inb(Port::PIC2_DATA);
-			mask |= static_cast<uint8_t>(1 << (interrupt_number - PIC1_VECTOR_OFFSET));
+			mask |= static_cast<uint8_t>(1 << (interrupt_number - PIC2_VECTOR_OFFSET));
 			outb(Port::PIC2_DATA, mask);
 		}
 
 		auto unmask_pic2_interrupt(uint8_t interrupt_number) -> void {
 			uint8_t mask = inb(Port::PIC2_DATA);
-			mask &= ~static_cast<uint8_t>(1 << (interrupt_number - PIC1_VECTOR_OFFSET));
+			mask &= ~static_cast<uint8_t>(1 << (interrupt_number - PIC2_VECTOR_OFFSET));
 			outb(Port::PIC2_DATA, mask);
+			unmask_pic1_interrupt(PIC1_VECTOR_OFFSET + PIC2_CASCADE_IRQ);	// slave PIC interrupts arrive through the cascade line
 		}
 	}
 
@@ -95,6 +97,11 @@ namespace LiOS86 {
 		__asm__ volatile ("sti");
 	}
 
+	auto InterruptManager::irq_to_interrupt_number(uint8_t irq) -> uint8_t {
+		if(irq < PIC1_VECTOR_NUMBER) return static_cast<uint8_t>(PIC1_VECTOR_OFFSET + irq);
+		return static_cast<uint8_t>(PIC2_VECTOR_OFFSET + (irq - PIC1_VECTOR_NUMBER));
+	}
+
 	auto InterruptManager::set_interrupt_handler_impl(uint8_t interrupt_number, FunctionPointer handler) -> void {
 		auto old_handler = interrupt_handlers[interrupt_number];
 		interrupt_handlers[interrupt_number] = handler;
@@ -23,6 +23,36 @@ namespace LiOS86 {
                 instance().set_interrupt_handler_impl(interrupt_number, handler);
             }
 
+            // interrupt number the PICs deliver the given hardware IRQ line (0-15) on
+            static auto irq_to_interrupt_number(uint8_t irq) -> uint8_t;
+
+            static auto are_interrupts_enabled() -> bool {
+                uint32_t flags;
+                __asm__ volatile ("pushf\n\tpop %0" : "=r"(flags));
+                return flags & 0x200;
+            }
+
+            // Halts the CPU until the condition (set by an interrupt handler) holds.
+            // If interrupts are disabled, e.g. when called from within an interrupt handler, or the device
+            // has no interrupt line (interrupt_driven false), poll is called repeatedly instead,
+            // so it has to make the progress the handler would.
+            template<typename Condition, typename Poll>
+            static auto wait_until(Condition condition, Poll poll, bool interrupt_driven = true) -> void {
+                if(!interrupt_driven || !are_interrupts_enabled()) {
+                    while(!condition()) {
+                        poll();
+                    }
+                    return;
+                }
+                while(true) {
+                    __asm__ volatile ("cli" : : : "memory");
+                    if(condition()) break;
+                    // sti only takes effect after the following instruction, so no interrupt can slip in before hlt
+                    __asm__ volatile ("sti\n\thlt" : : : "memory");
+                }
+                __asm__ volatile ("sti" : : : "memory");
+            }
+
         private:
             InterruptManager();
 
@@ -62,5 +92,23 @@ namespace LiOS86 {
 
             friend void ::general_interrupt_handler(uint32_t interrupt_number);
     };
+
+    // disables interrupts for its lifetime, restoring the previous state on destruction
+    class InterruptGuard {
+        public:
+            InterruptGuard() : were_enabled{InterruptManager::are_interrupts_enabled()} {
+                __asm__ volatile ("cli" : : : "memory");
+            }
+            ~InterruptGuard() {
+                if(were_enabled) __asm__ volatile ("sti" : : : "memory");
+            }
+            InterruptGuard(const InterruptGuard&) = delete;
+            InterruptGuard& operator=(const InterruptGuard&) = delete;
+            InterruptGuard(InterruptGuard&&) = delete;
+            InterruptGuard& operator=(InterruptGuard&&) = delete;
+
+        private:
+            bool were_enabled;
+    };
     
 }
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "block_cache.hpp"
+#include "utils/data_manipulation.hpp"
+
+namespace LiOS86 {
+
+    // Sectors of KERNEL.BIN, stored by the build (build/host/write_kernel_extents) in a reserved sector of the boot
+    // partition, so the loader can read the kernel with a few large reads instead of walking the root directory and the FAT.
+    // The table also records where the file's directory entry is and what it held when the table was written;
+    // the loader only trusts the table if its checksum is right and the entry still matches.
+    //
+    // Layout: signature, entry sector (LBA), entry index, first cluster, file size, number of extents,
+    // then up to MAX_EXTENTS extents (first sector LBA, number of sectors) and a checksum of all that at CHECKSUM_OFFSET.
+    class KernelExtentTableHandle : CachedSector {
+        public:
+            // relative to the start of the partition; sectors 0-2 are the boot sector (backed up at 6-8), 1 is usually FSInfo
+            static constexpr uint32_t SECTOR_IN_PARTITION = 3;
+            static constexpr uint32_t SIGNATURE = 0x5458454B;       // "KEXT"
+            static constexpr std::size_t EXTENTS_OFFSET = 24;
+            static constexpr std::size_t CHECKSUM_OFFSET = 508;
+            static constexpr uint32_t MAX_EXTENTS = (CHECKSUM_OFFSET - EXTENTS_OFFSET) / 8;
+
+            explicit KernelExtentTableHandle(uint32_t sectorNumber) : CachedSector(sectorNumber) { }
+
+            auto isValid() const -> bool {
+                return readFromMemoryAndPun<uint32_t>(bufferData(), 0) == SIGNATURE
+                    && getNumberOfExtents() <= MAX_EXTENTS
+                    && readFromMemoryAndPun<uint32_t>(bufferData(), CHECKSUM_OFFSET) == computeChecksum();
+            }
+
+            // true for a sector holding neither a table nor anything else, which the build may take over
+            auto isUnused() const -> bool {
+                for(std::size_t i = 0; i < ATA_SECTOR_SIZE; ++i) {
+                    if(bufferData()[i] != 0) return readFromMemoryAndPun<uint32_t>(bufferData(), 0) == SIGNATURE;
+                }
+                return true;
+            }
+
+            auto getEntrySector() const -> uint32_t {
+                return readFromMemoryAndPun<uint32_t>(bufferData(), 4);
+            }
+
+            auto getEntryIndex() const -> uint32_t {
+                return readFromMemoryAndPun<uint32_t>(bufferData(), 8);
+            }
+
+            auto getFirstCluster() const -> uint32_t {
+                return readFromMemoryAndPun<uint32_t>(bufferData(), 12);
+            }
+
+            auto getFileSize() const -> uint32_t {
+                return readFromMemoryAndPun<uint32_t>(bufferData(), 16);
+            }
+
+            auto getNumberOfExtents() const -> uint32_t {
+                return readFromMemoryAndPun<uint32_t>(bufferData(), 20);
+            }
+
+            auto getExtentFirstSector(uint32_t index) const -> uint32_t {
+                return readFromMemoryAndPun<uint32_t>(bufferData(), EXTENTS_OFFSET + index * 8);
+            }
+
+            auto getExtentLength(uint32_t index) const -> uint32_t {
+                return readFromMemoryAndPun<uint32_t>(bufferData(), EXTENTS_OFFSET + index * 8 + 4);
+            }
+
+            // starts a new table for the file whose directory entry is the given one, with no extents yet
+            auto reset(uint32_t entrySector, uint32_t entryIndex, uint32_t firstCluster, uint32_t fileSize) -> void {
+                const auto sector = mutableBufferData();
+                for(std::size_t i = 0; i < ATA_SECTOR_SIZE; ++i) {
+                    sector[i] = 0;
+                }
+                writeToMemory(sector, 0, SIGNATURE);
+                writeToMemory(sector, 4, entrySector);
+                writeToMemory(sector, 8, entryIndex);
+                writeToMemory(sector, 12, firstCluster);
+                writeToMemory(sector, 16, fileSize);
+                sealChecksum();
+            }
+
+            // returns false if the table is full
+            auto addExtent(uint32_t firstSector, uint32_t numberOfSectors) -> bool {
+                const auto index = getNumberOfExtents();
+                if(index >= MAX_EXTENTS) return false;
+                const auto sector = mutableBufferData();
+                writeToMemory(sector, EXTENTS_OFFSET + index * 8, firstSector);
+                writeToMemory(sector, EXTENTS_OFFSET + index * 8 + 4, numberOfSectors);
+                writeToMemory(sector, 20, index + 1);
+                sealChecksum();
+                return true;
+            }
+
+            // makes the loader ignore the table
+            auto clear() -> void {
+                const auto sector = mutableBufferData();
+                for(std::size_t i = 0; i < ATA_SECTOR_SIZE; ++i) {
+                    sector[i] = 0;
+                }
+            }
+
+        private:
+            // rotating sum of the words before the checksum, so swapped words do not cancel out
+            auto computeChecksum() const -> uint32_t {
+                uint32_t checksum = 0;
+                for(std::size_t offset = 0; offset < CHECKSUM_OFFSET; offset += 4) {
+                    checksum = ((checksum << 1) | (checksum >> 31)) + readFromMemoryAndPun<uint32_t>(bufferData(), offset);
+                }
+                return ~checksum;
+            }
+
+            auto sealChecksum() -> void {
+                writeToMemory(mutableBufferData(), CHECKSUM_OFFSET, computeChecksum());
+            }
+    };
+
+}
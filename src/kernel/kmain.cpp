@@ -1,8 +1,94 @@
+#include "ahci.hpp"
+#include "ata.hpp"
+#include "block_cache.hpp"
+#include "block_device.hpp"
+#include "bpb.hpp"
+#include "cluster_allocator.hpp"
+#include "fat_cache.hpp"
+#include "fat_file.hpp"
+#include "interrupt_manager.hpp"
+#include "kmalloc.hpp"
+#include "mbr.hpp"
 #include "memory_manager.hpp"
+#include "nvme.hpp"
 #include "shell.hpp"
+#include "timer.hpp"
+#include "virtio_blk.hpp"
+#include "xstd/array.hpp"
+
+namespace {
+
+    // file changes are only collected in memory between syncs, this bounds how much of them a crash can lose
+    constexpr uint32_t SYNC_INTERVAL_TICKS = 5 * LiOS86::Timer::TICKS_PER_SECOND;
+
+    // true if the device has an MBR (the boot disk's, when the same image is attached to another controller)
+    auto selectIfBootDisk(const LiOS86::BlockDevice& device) -> bool {
+        LiOS86::selectBlockDevice(device);
+        LiOS86::xstd::array<uint8_t, LiOS86::ATA_SECTOR_SIZE> sector{};
+        return LiOS86::BlockCache::read(0, 1, sector) && sector[510] == 0x55 && sector[511] == 0xAA;
+    }
+
+    // Reads one sector more than a single NVMe command transfers, which the driver has to split, and compares
+    // the first and the last sector with single-sector reads. A device failing it is not used.
+    auto longReadWorks(const LiOS86::BlockDevice& device, uint32_t maxSectorsPerCommand) -> bool {
+        const auto numberOfSectors = static_cast<uint16_t>(maxSectorsPerCommand + 1);
+        const auto size = static_cast<std::size_t>(numberOfSectors) * LiOS86::ATA_SECTOR_SIZE;
+        const auto buffer = static_cast<uint8_t*>(LiOS86::kmalloc(size));
+        if(buffer == nullptr) return true;      // nothing to check with, the single-sector read has worked
+
+        LiOS86::xstd::array<uint8_t, LiOS86::ATA_SECTOR_SIZE> sector{};
+        bool matches = device.read(0, numberOfSectors, LiOS86::xstd::span<uint8_t>(buffer, size)).has_value();
+        const LiOS86::xstd::array<uint16_t, 2> checkedSectors{0, static_cast<uint16_t>(numberOfSectors - 1)};
+        for(const auto sectorNumber : checkedSectors) {
+            matches = matches && device.read(sectorNumber, 1, sector);
+            for(std::size_t i = 0; matches && i < sector.size(); ++i) {
+                matches = buffer[sectorNumber * LiOS86::ATA_SECTOR_SIZE + i] == sector[i];
+            }
+        }
+        LiOS86::kfree(buffer);
+        return matches;
+    }
+
+    // The boot volume is mounted through the first of the other controllers that finds a disk holding it
+    // (see the run-ahci, run-virtio and run-nvme targets in the Makefile), through the ATA driver the loader used otherwise.
+    auto selectBootDisk() -> void {
+        const auto nvme = LiOS86::BlockDevice::fromDriver("NVMe",
+                LiOS86::NVMeController::readSectors, LiOS86::NVMeController::writeSectors, LiOS86::NVMeController::flushCache);
+        if(LiOS86::NVMeController::isAvailable() && selectIfBootDisk(nvme) && longReadWorks(nvme, LiOS86::NVMeController::getMaxSectorsPerCommand())) {
+            return;
+        }
+        if(LiOS86::VirtioBlockDevice::isAvailable() && selectIfBootDisk(LiOS86::BlockDevice::fromDriver("virtio",
+                LiOS86::VirtioBlockDevice::readSectors, LiOS86::VirtioBlockDevice::writeSectors, LiOS86::VirtioBlockDevice::flushCache))) {
+            return;
+        }
+        if(LiOS86::AHCIController::isAvailable() && selectIfBootDisk(LiOS86::BlockDevice::fromDriver("AHCI",
+                LiOS86::AHCIController::readSectors, LiOS86::AHCIController::writeSectors, LiOS86::AHCIController::flushCache))) {
+            return;
+        }
+        LiOS86::selectBlockDevice(LiOS86::BlockDevice::fromDriver("ATA", LiOS86::readSectors, LiOS86::writeSectors, LiOS86::flushCache));
+    }
+
+}
 
 extern "C" [[noreturn]] void kmain() {
     LiOS86::MemoryManager::instance();
+    LiOS86::InterruptManager::set_interrupt_handler(0x2E, LiOS86::ataInterruptHandler);
+    LiOS86::enableInterruptCompletion();
+    selectBootDisk();
+    const auto partitionStartingSector = LiOS86::MBRHandle().getActivePartitionTableEntryHandle().getStartSector();
+    const auto bpb = LiOS86::BPBHandle(partitionStartingSector);
+    LiOS86::FATCache::mount(bpb, partitionStartingSector);
+    LiOS86::ClusterAllocator::mount(bpb, partitionStartingSector);
     LiOS86::Shell::instance();
-    while(true) {}
+    LiOS86::Timer::instance();
+    auto lastSync = LiOS86::Timer::getTicks();
+    while(true) {
+        __asm__ volatile ("hlt");
+        if(LiOS86::Timer::getTicks() - lastSync < SYNC_INTERVAL_TICKS) continue;
+        lastSync = LiOS86::Timer::getTicks();
+        // shell commands run in the keyboard interrupt handler, none of them may run in the middle of the sync;
+        // the drivers poll for completion meanwhile, and whatever could not be written stays dirty for the next one
+        const LiOS86::InterruptGuard guard;
+        static_cast<void>(LiOS86::FileTable::sync());
+    }
 }
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "../utils/data_manipulation.hpp"
+#include "../xstd/array.hpp"
+
+namespace LiOS86 {
+
+    // The parts of the 32-bit ELF format needed to load an executable's segments.
+    // Both headers are copied out of the file into their own buffers, filled through data().
+
+    class ElfHeader {
+        public:
+            static constexpr std::size_t SIZE = 52;
+            static constexpr uint32_t MAGIC = 0x464C457F;       // "\x7F" "ELF"
+
+            auto data() -> uint8_t* {
+                return bytes.data();
+            }
+
+            // a little-endian i386 executable whose program headers have the layout of ElfProgramHeader
+            auto isI386Executable() const -> bool;
+
+            auto getEntryPoint() const -> uint32_t {
+                return readFromMemoryAndPun<uint32_t>(bytes.data(), 24);
+            }
+
+            auto getProgramHeaderOffset() const -> uint32_t {
+                return readFromMemoryAndPun<uint32_t>(bytes.data(), 28);
+            }
+
+            auto getNumberOfProgramHeaders() const -> uint16_t {
+                return readFromMemoryAndPun<uint16_t>(bytes.data(), 44);
+            }
+
+        private:
+            xstd::array<uint8_t, SIZE> bytes{};
+    };
+
+    class ElfProgramHeader {
+        public:
+            static constexpr std::size_t SIZE = 32;
+            static constexpr uint32_t LOADABLE_SEGMENT = 1;      // PT_LOAD
+
+            // permissions of the segment's memory, for the page tables of a paging layer
+            static constexpr uint32_t EXECUTABLE = 0x1;
+            static constexpr uint32_t WRITEABLE = 0x2;
+            static constexpr uint32_t READABLE = 0x4;
+
+            auto data() -> uint8_t* {
+                return bytes.data();
+            }
+
+            auto getType() const -> uint32_t {
+                return readFromMemoryAndPun<uint32_t>(bytes.data(), 0);
+            }
+
+            auto getFileOffset() const -> uint32_t {
+                return readFromMemoryAndPun<uint32_t>(bytes.data(), 4);
+            }
+
+            // no paging yet: segments are loaded at their physical address
+            auto getPhysicalAddress() const -> uint32_t {
+                return readFromMemoryAndPun<uint32_t>(bytes.data(), 12);
+            }
+
+            auto getFileSize() const -> uint32_t {
+                return readFromMemoryAndPun<uint32_t>(bytes.data(), 16);
+            }
+
+            // the part of the segment past its file size is zero-filled (e.g. .bss)
+            auto getMemorySize() const -> uint32_t {
+                return readFromMemoryAndPun<uint32_t>(bytes.data(), 20);
+            }
+
+            auto getFlags() const -> uint32_t {
+                return readFromMemoryAndPun<uint32_t>(bytes.data(), 24);
+            }
+
+        private:
+            xstd::array<uint8_t, SIZE> bytes{};
+    };
+
+    inline auto ElfHeader::isI386Executable() const -> bool {
+        constexpr uint8_t CLASS_32_BIT = 1;
+        constexpr uint8_t DATA_LITTLE_ENDIAN = 1;
+        constexpr uint16_t EXECUTABLE_FILE = 2;
+        constexpr uint16_t MACHINE_I386 = 3;
+        return readFromMemoryAndPun<uint32_t>(bytes.data(), 0) == MAGIC
+            && bytes[4] == CLASS_32_BIT
+            && bytes[5] == DATA_LITTLE_ENDIAN
+            && readFromMemoryAndPun<uint16_t>(bytes.data(), 16) == EXECUTABLE_FILE
+            && readFromMemoryAndPun<uint16_t>(bytes.data(), 18) == MACHINE_I386
+            && readFromMemoryAndPun<uint16_t>(bytes.data(), 42) == ElfProgramHeader::SIZE;
+    }
+
+}
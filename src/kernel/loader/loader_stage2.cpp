@@ -1,38 +1,192 @@
 #include <cstddef>
 
 #include "../ata.hpp"
+#include "../block_cache.hpp"
+#include "../block_device.hpp"
+#include "../block_queue.hpp"
 #include "../bpb.hpp"
+#include "../cluster_readahead.hpp"
 #include "../directory_sector.hpp"
+#include "../kernel_extent_table.hpp"
 #include "../mbr.hpp"
 #include "../utils/data_manipulation.hpp"
 #include "../utils/error_handling.hpp"
+#include "../xstd/array.hpp"
 #include "../xstd/expected.hpp"
+#include "../xstd/cstring.hpp"
+#include "../xstd/span.hpp"
+#include "elf.hpp"
+#include "lz4_frame.hpp"
 
 namespace LiOS86 {
 
+    // The few FAT sectors the loader needs (those of the root directory's and the kernel's chains), read one
+    // at a time when an entry in them is first looked up, so boot time does not depend on the size of the FAT.
+    // Sectors are replaced round-robin; the chains walked here are short and ascending, so that is enough.
+    class LoaderFATCache {
+        public:
+            static constexpr std::size_t CAPACITY = 4;
+            static constexpr uint32_t ENTRIES_PER_SECTOR = ATA_SECTOR_SIZE / 4;
+
+            explicit LoaderFATCache(uint32_t fatStartingSector) : firstSector{fatStartingSector} {
+                sectorNumbers.fill(NO_SECTOR);
+            }
+
+            auto entry(uint32_t cluster) -> uint32_t {
+                const auto sectorNumber = firstSector + cluster / ENTRIES_PER_SECTOR;
+                std::size_t slot = 0;
+                while(slot < CAPACITY && sectorNumbers[slot] != sectorNumber) ++slot;
+                if(slot == CAPACITY) {
+                    slot = nextVictim;
+                    nextVictim = (nextVictim + 1) % CAPACITY;
+                    if(!readSectors(sectorNumber, 1, xstd::span<uint8_t>(sectors[slot].data(), ATA_SECTOR_SIZE))) {
+                        kpanic("Error reading the File Allocation Table. Halting.");
+                    }
+                    sectorNumbers[slot] = sectorNumber;
+                }
+                return readFromMemoryAndPun<uint32_t>(sectors[slot].data(), (cluster % ENTRIES_PER_SECTOR) * 4) & 0x0FFFFFFF;
+            }
+
+        private:
+            static constexpr uint32_t NO_SECTOR = 0xffffffff;
+
+            uint32_t firstSector;
+            alignas(16) xstd::array<xstd::array<uint8_t, ATA_SECTOR_SIZE>, CAPACITY> sectors{};
+            xstd::array<uint32_t, CAPACITY> sectorNumbers{};
+            std::size_t nextVictim{0};
+    };
+
+    // Where the sectors of a file are on the disk: runs of consecutive sectors, in the order of the file.
+    // Any byte range of the file can be read with it, whole sectors straight into the destination with
+    // a queued request per run (so the runs are read in one sweep), partial ones through the block cache.
+    class FileSectorMap {
+        public:
+            static constexpr std::size_t CAPACITY = 256;
+
+            auto getFileSize() const -> uint32_t {
+                return fileSize;
+            }
+
+            auto setFileSize(uint32_t size) -> void {
+                fileSize = size;
+            }
+
+            auto getNumberOfSectors() const -> uint32_t {
+                return mappedSectors;
+            }
+
+            // the whole file is already in memory at the given address (read there before stage 2): reads copy from it
+            auto setLoadedCopyAddress(uint32_t address) -> void {
+                loadedCopyAddress = address;
+            }
+
+            // appends sectors to the file, merged into the last run if they follow it; returns false if the map is full
+            auto addSectors(uint32_t firstSector, uint32_t numberOfSectors) -> bool {
+                mappedSectors += numberOfSectors;
+                if(numberOfRuns > 0 && runs[numberOfRuns - 1].firstSector + runs[numberOfRuns - 1].numberOfSectors == firstSector) {
+                    runs[numberOfRuns - 1].numberOfSectors += numberOfSectors;
+                    return true;
+                }
+                if(numberOfRuns == CAPACITY) return false;
+                runs[numberOfRuns++] = SectorRun{firstSector, numberOfSectors};
+                return true;
+            }
+
+            // reads the bytes [offset, offset + length) of the file; halts if they are not all mapped or the disk fails
+            auto read(uint32_t offset, uint32_t length, uint8_t* destination) const -> void;
+
+        private:
+            class SectorRun {
+                public:
+                    uint32_t firstSector;
+                    uint32_t numberOfSectors;
+            };
+
+            xstd::array<SectorRun, CAPACITY> runs{};
+            std::size_t numberOfRuns{0};
+            uint32_t mappedSectors{0};
+            uint32_t fileSize{0};
+            uint32_t loadedCopyAddress{0};
+    };
+
+    auto FileSectorMap::read(uint32_t offset, uint32_t length, uint8_t* destination) const -> void {
+        constexpr auto SECTOR_SIZE = static_cast<uint32_t>(ATA_SECTOR_SIZE);
+        // a single (LBA48) command can transfer up to 65535 sectors
+        constexpr uint32_t SECTORS_PER_READ = 0xffff;
+        if(offset > fileSize || length > fileSize - offset) kpanic("Error reading the kernel file. Halting.");
+        if(loadedCopyAddress != 0) {
+            // a read to where the bytes already are (e.g. the LZ4 frame at its own address) has nothing to copy
+            const auto source = reinterpret_cast<const uint8_t*>(loadedCopyAddress + offset);
+            if(source != destination) xstd::memcpy(destination, source, length);
+            return;
+        }
+
+        uint32_t runStart = 0;      // index in the file of the run's first sector
+        for(std::size_t i = 0; i < numberOfRuns && length > 0; ++i) {
+            const auto runEnd = runStart + runs[i].numberOfSectors;
+            while(length > 0 && offset / SECTOR_SIZE < runEnd) {
+                const auto sectorNumber = runs[i].firstSector + (offset / SECTOR_SIZE - runStart);
+                const auto offsetInSector = offset % SECTOR_SIZE;
+                uint32_t count = 0;
+                if(offsetInSector != 0 || length < SECTOR_SIZE) {
+                    xstd::array<uint8_t, ATA_SECTOR_SIZE> sector{};
+                    if(!BlockCache::read(sectorNumber, 1, sector)) kpanic("Error reading the kernel file. Halting.");
+                    count = SECTOR_SIZE - offsetInSector < length ? SECTOR_SIZE - offsetInSector : length;
+                    xstd::memcpy(destination, sector.data() + offsetInSector, count);
+                } else {
+                    auto sectors = length / SECTOR_SIZE;
+                    if(sectors > runEnd - offset / SECTOR_SIZE) sectors = runEnd - offset / SECTOR_SIZE;
+                    if(sectors > SECTORS_PER_READ) sectors = SECTORS_PER_READ;
+                    count = sectors * SECTOR_SIZE;
+                    if(!BlockRequestQueue::submitRead(sectorNumber, static_cast<uint16_t>(sectors), xstd::span<uint8_t>(destination, count))) {
+                        kpanic("Error reading the kernel file. Halting.");
+                    }
+                }
+                offset += count;
+                length -= count;
+                destination += count;
+            }
+            runStart = runEnd;
+        }
+        if(length > 0 || !BlockRequestQueue::dispatch()) kpanic("Error reading the kernel file. Halting.");
+    }
+
+    class FoundFile {
+        public:
+            uint32_t firstCluster;
+            uint32_t fileSize;
+    };
+
     enum class FileSearchError { NOT_FOUND, BAD_CLUSTER_CHAIN };
-    static auto getFileStartingCluster(
+    static auto findFile(
         const char* shortFilename, 
         uint32_t parentDirectoryStartingCluster, 
-        volatile uint8_t* fatPtr,
+        auto nextCluster,
         auto clusterNumberToSectorNumber,
         uint8_t sectorsPerCluster
-    ) -> xstd::expected<uint32_t, FileSearchError> {
+    ) -> xstd::expected<FoundFile, FileSearchError> {
 
         uint32_t currentCluster = parentDirectoryStartingCluster;
+        auto readahead = ClusterReadahead(nextCluster, clusterNumberToSectorNumber, sectorsPerCluster);
+        // the whole cluster is read into one window (in pieces of MAX_SECTORS for clusters larger than that)
+        auto directoryWindow = LiOS86::DirectorySectorHandle(clusterNumberToSectorNumber(currentCluster), 0);
 
         do {
+            readahead.access(currentCluster);
             auto currentSectorNumber = clusterNumberToSectorNumber(currentCluster);
-            for(int i = 0; i < sectorsPerCluster; ++i) {
-                const auto directorySector = LiOS86::DirectorySectorHandle(currentSectorNumber + i);
-                for(const auto entry : directorySector) {
-                    const auto sfn = entry.getShortFileName();
-                    if(sfn == shortFilename) {
-                        return entry.getFirstClusterNumber();
+            for(std::size_t i = 0; i < sectorsPerCluster; i += LiOS86::DirectorySectorHandle::MAX_SECTORS) {
+                directoryWindow.repoint(currentSectorNumber + i, sectorsPerCluster - i);
+                for(const auto entry : directoryWindow) {
+                    // nothing in use follows the end-of-directory marker
+                    if(entry.isEndOfDirectory()) {
+                        return xstd::unexpected(FileSearchError::NOT_FOUND);
+                    }
+                    if(entry.hasShortFileName(shortFilename)) {
+                        return FoundFile{entry.getFirstClusterNumber(), entry.getFileSizeInBytes()};
                     }
                 }
             }
-            currentCluster = LiOS86::readFromMemoryAndPun<uint32_t>(fatPtr, currentCluster * 4);
+            currentCluster = nextCluster(currentCluster);
         } while(currentCluster > 0x00000001 && currentCluster < 0x0FFFFFF7);
 
         if(currentCluster >= 0x0FFFFFF8 && currentCluster <= 0x0FFFFFFF) {
@@ -41,45 +195,96 @@ namespace LiOS86 {
         return xstd::unexpected(FileSearchError::BAD_CLUSTER_CHAIN);
     }
 
-    static auto copyFileToMemory(
-        uint32_t fileStartingCluster, 
-        volatile uint8_t* destinationPtr, 
-        volatile uint8_t* fatPtr, 
+    // follows the file's cluster chain as far as its size requires
+    static auto mapClusterChain(
+        const FoundFile& file, 
+        FileSectorMap& map, 
+        auto nextCluster, 
         auto clusterNumberToSectorNumber,
-        uint8_t sectorsPerCluster, 
-        uint16_t bytesPerSector
+        uint8_t sectorsPerCluster
     ) -> void {
 
-        auto currentCluster = fileStartingCluster;
-        uint32_t currentClusterCount = 0;
-
-        do {
-            auto currentSectorNumber = clusterNumberToSectorNumber(currentCluster);
-            for(int i = 0; i < sectorsPerCluster; ++i) {
-                const auto sector = LiOS86::readSectors(currentSectorNumber + i, 1);
-                if(!sector) {
-                    kpanic("Error reading the kernel file. Halting.");
-                }
-                const auto currentSectorCount = sectorsPerCluster * currentClusterCount + i;
-                for(int j = 0; j < 512; ++j) {
-                    destinationPtr[currentSectorCount * bytesPerSector + j] = (*sector)[j];
-                }
+        map.setFileSize(file.fileSize);
+        const auto neededSectors = (file.fileSize + ATA_SECTOR_SIZE - 1) / ATA_SECTOR_SIZE;
+        auto currentCluster = file.firstCluster;
+        while(map.getNumberOfSectors() < neededSectors) {
+            if(currentCluster <= 0x00000001 || currentCluster >= 0x0FFFFFF7) {
+                kpanic("Error reading the kernel file. Halting.");
             }
-            currentCluster = LiOS86::readFromMemoryAndPun<uint32_t>(fatPtr, currentCluster * 4);
-            ++currentClusterCount;
-        } while(currentCluster > 0x00000001 && currentCluster < 0x0FFFFFF7);
+            if(!map.addSectors(static_cast<uint32_t>(clusterNumberToSectorNumber(currentCluster)), sectorsPerCluster)) {
+                kpanic("The kernel file is too fragmented. Halting.");
+            }
+            currentCluster = nextCluster(currentCluster);
+        }
+    }
+
+    // Fast path: maps the file with the sectors listed in the extent table written by the build.
+    // Returns false if there is no valid table or it does not describe the file's current entry.
+    static auto mapFromExtentTable(uint32_t tableSectorNumber, const char* shortFilename, FileSectorMap& map) -> bool {
+        const auto table = KernelExtentTableHandle(tableSectorNumber);
+        if(!table.isValid() || table.getEntryIndex() >= DirectorySectorHandle::ENTRIES_PER_SECTOR) return false;
+
+        // a file replaced since the table was written no longer has the entry the table was made for
+        const auto directorySector = DirectorySectorHandle(table.getEntrySector());
+        const auto entry = directorySector.entryAt(table.getEntryIndex());
+        if(!entry.hasShortFileName(shortFilename) || entry.getFirstClusterNumber() != table.getFirstCluster()
+            || entry.getFileSizeInBytes() != table.getFileSize()) {
+            return false;
+        }
 
-        if(currentCluster <= 0x00000001 || currentCluster == 0x0FFFFFF7) {
-            kpanic("Error reading the kernel file. Halting.");
+        for(uint32_t i = 0; i < table.getNumberOfExtents(); ++i) {
+            if(!map.addSectors(table.getExtentFirstSector(i), table.getExtentLength(i))) return false;
         }
+        map.setFileSize(table.getFileSize());
+        return map.getNumberOfSectors() == (table.getFileSize() + ATA_SECTOR_SIZE - 1) / ATA_SECTOR_SIZE;
+    }
+
+    // Loads the loadable segments of an ELF executable at their physical addresses, each of which has to lie
+    // within [lowestAddress, highestAddress): only their bytes stored in the file are read, the rest is zero-filled.
+    // Returns the entry point.
+    static auto loadElfSegments(const FileSectorMap& map, uint32_t lowestAddress, uint32_t highestAddress) -> uint32_t {
+        ElfHeader header{};
+        map.read(0, ElfHeader::SIZE, header.data());
+        if(!header.isI386Executable()) kpanic("The kernel file is not an i386 executable. Halting.");
+
+        for(uint16_t i = 0; i < header.getNumberOfProgramHeaders(); ++i) {
+            ElfProgramHeader segment{};
+            map.read(header.getProgramHeaderOffset() + i * static_cast<uint32_t>(ElfProgramHeader::SIZE), ElfProgramHeader::SIZE, segment.data());
+            if(segment.getType() != ElfProgramHeader::LOADABLE_SEGMENT) continue;
+
+            const auto address = segment.getPhysicalAddress();
+            const auto memorySize = segment.getMemorySize();
+            if(segment.getFileSize() > memorySize || address < lowestAddress || address > highestAddress || memorySize > highestAddress - address) {
+                kpanic("The kernel file has a segment that cannot be loaded. Halting.");
+            }
+            const auto destination = reinterpret_cast<uint8_t*>(address);
+            map.read(segment.getFileOffset(), segment.getFileSize(), destination);
+            xstd::memset(destination + segment.getFileSize(), 0, memorySize - segment.getFileSize());
+        }
+        return header.getEntryPoint();
     }
 
 }
 
 extern "C" constexpr auto KERNEL_MEMORY_START_ADDRESS = 0x01000000;
 
+// a compressed kernel is read to the memory below its own address, then decompressed into place
+static constexpr auto COMPRESSED_KERNEL_ADDRESS = 0x00100000;
+static constexpr std::size_t MAX_KERNEL_FILE_SIZE = KERNEL_MEMORY_START_ADDRESS - COMPRESSED_KERNEL_ADDRESS;
+static constexpr std::size_t MAX_KERNEL_MEMORY_SIZE = 0x01000000;
+// size of the kernel file that the first stage (src/boot/loader.asm, built with KERNEL_LOADER=bios) read
+// to COMPRESSED_KERNEL_ADDRESS with BIOS extended reads, using the sectors of the extent table; 0 if it did not
+static constexpr auto PRELOADED_KERNEL_SIZE_ADDRESS = 0x7ffc;
+
+extern "C" {
+    // where _start jumps once kloader() returns
+    uint32_t kernelEntryPoint = KERNEL_MEMORY_START_ADDRESS;
+}
+
 extern "C" void kloader() {
-    
+
+    LiOS86::selectBlockDevice(LiOS86::BlockDevice::fromDriver("ATA", LiOS86::readSectors, LiOS86::writeSectors, LiOS86::flushCache));
+
     const auto mbrHandle = LiOS86::MBRHandle();
     const auto activePartitionEntryHandle = mbrHandle.getActivePartitionTableEntryHandle();
     const auto partitionStartingSector = activePartitionEntryHandle.getStartSector();
@@ -88,50 +293,65 @@ extern "C" void kloader() {
     const auto bytesPerSector = bpbHandle.getBytesPerSector();
     kassert(bytesPerSector == 512);
 
-    const auto sectorsPerCluster = bpbHandle.getSectorsPerCluster();
-    const auto FATSizeInSectors = bpbHandle.getFATSizeInSectors();
-    const auto rootDirectoryStartingCluster = bpbHandle.getRootDirectoryStartingCluster();
+    auto kernelFile = LiOS86::FileSectorMap();
+    const auto extentTableSector = partitionStartingSector + LiOS86::KernelExtentTableHandle::SECTOR_IN_PARTITION;
+    if(LiOS86::mapFromExtentTable(extentTableSector, "KERNEL  BIN", kernelFile)) {
+        // the first stage read the same sectors, but only this checks the whole table (checksum, directory entry)
+        if(*reinterpret_cast<const uint32_t*>(PRELOADED_KERNEL_SIZE_ADDRESS) == kernelFile.getFileSize()) {
+            kernelFile.setLoadedCopyAddress(COMPRESSED_KERNEL_ADDRESS);
+        }
+    } else {
+        // no usable extent table: the kernel file is looked up in the root directory and its cluster chain followed
+        kernelFile = LiOS86::FileSectorMap();
+        const auto sectorsPerCluster = bpbHandle.getSectorsPerCluster();
+        const auto rootDirectoryStartingCluster = bpbHandle.getRootDirectoryStartingCluster();
 
-    const auto FATStartingSector = partitionStartingSector + bpbHandle.getFirstActiveFATOffsetInSectors();
+        const auto FATStartingSector = partitionStartingSector + bpbHandle.getFirstActiveFATOffsetInSectors();
 
-    static constexpr auto EXTENDED_MEMORY_START_ADDRESS = 0x00100000;
-    auto extendedMemoryPtr = reinterpret_cast<volatile uint8_t*>(EXTENDED_MEMORY_START_ADDRESS);
+        auto fatCache = LiOS86::LoaderFATCache(FATStartingSector);
+        const auto nextCluster = [&fatCache](uint32_t cluster) {
+            return fatCache.entry(cluster);
+        };
 
-    for(std::size_t i = 0; i < FATSizeInSectors; ++i) {
-        const auto sector = LiOS86::readSectors(FATStartingSector + i, 1);
-        if(!sector) {
-            LiOS86::kpanic("Error reading the File Allocation Table. Halting.");
-        }
-        for(int j = 0; j < 512; ++j) {
-            extendedMemoryPtr[i * 512 + j] = (*sector)[j];
-        }
-    }
+        const auto dataSectionStartingSector = partitionStartingSector + bpbHandle.getDataSectionOffsetInSectors();
+        const auto clusterNumberToSectorNumber = [dataSectionStartingSector, sectorsPerCluster](std::size_t clusterNumber) {
+            return dataSectionStartingSector + (clusterNumber - 2) * sectorsPerCluster;
+        };
 
-    const auto dataSectionStartingSector = partitionStartingSector + bpbHandle.getDataSectionOffsetInSectors();
-    const auto clusterNumberToSectorNumber = [dataSectionStartingSector, sectorsPerCluster](std::size_t clusterNumber) {
-        return dataSectionStartingSector + (clusterNumber - 2) * sectorsPerCluster;
-    };
+        const auto kernelFileEntry = 
+            LiOS86::findFile("KERNEL  BIN", 
+                                rootDirectoryStartingCluster, 
+                                nextCluster,
+                                clusterNumberToSectorNumber,
+                                sectorsPerCluster
+                                );
+        
+        if(!kernelFileEntry) {
+            LiOS86::kpanic("Error reading the kernel file. Halting.");
+        }
 
-    const auto kernelFileStartingCluster = 
-        LiOS86::getFileStartingCluster("KERNEL  BIN", 
-                                        rootDirectoryStartingCluster, 
-                                        extendedMemoryPtr,
-                                        clusterNumberToSectorNumber,
-                                        sectorsPerCluster
-                                        );
-    
-    if(!kernelFileStartingCluster) {
-        LiOS86::kpanic("Error reading the kernel file. Halting.");
+        LiOS86::mapClusterChain(*kernelFileEntry, kernelFile, nextCluster, clusterNumberToSectorNumber, sectorsPerCluster);
     }
 
-    auto kernelMemoryPtr = reinterpret_cast<volatile uint8_t*>(KERNEL_MEMORY_START_ADDRESS);
+    // the kernel file is an ELF executable, an LZ4 frame holding the flat kernel image, or that image itself
+    LiOS86::xstd::array<uint8_t, 4> magic{};
+    const auto fileSize = kernelFile.getFileSize();
+    if(fileSize > MAX_KERNEL_FILE_SIZE) LiOS86::kpanic("The kernel file is too large. Halting.");
+    kernelFile.read(0, fileSize < magic.size() ? fileSize : static_cast<uint32_t>(magic.size()), magic.data());
 
-    LiOS86::copyFileToMemory(*kernelFileStartingCluster,
-                                kernelMemoryPtr,
-                                extendedMemoryPtr,
-                                clusterNumberToSectorNumber,
-                                sectorsPerCluster,
-                                bytesPerSector
-                            );
+    auto kernelMemoryPtr = reinterpret_cast<uint8_t*>(KERNEL_MEMORY_START_ADDRESS);
+    if(LiOS86::isLZ4Frame(magic)) {
+        const auto compressedKernelPtr = reinterpret_cast<uint8_t*>(COMPRESSED_KERNEL_ADDRESS);
+        kernelFile.read(0, fileSize, compressedKernelPtr);
+        const auto source = LiOS86::xstd::span<const uint8_t>(compressedKernelPtr, fileSize);
+        const auto destination = LiOS86::xstd::span<uint8_t>(kernelMemoryPtr, MAX_KERNEL_MEMORY_SIZE);
+        if(!LiOS86::decompressLZ4Frame(source, destination)) {
+            LiOS86::kpanic("Error decompressing the kernel file. Halting.");
+        }
+    } else if(LiOS86::readFromMemoryAndPun<uint32_t>(magic.data()) == LiOS86::ElfHeader::MAGIC) {
+        kernelEntryPoint = LiOS86::loadElfSegments(kernelFile, KERNEL_MEMORY_START_ADDRESS, KERNEL_MEMORY_START_ADDRESS + MAX_KERNEL_MEMORY_SIZE);
+    } else {
+        kernelFile.read(0, fileSize, kernelMemoryPtr);
+    }
 
 }
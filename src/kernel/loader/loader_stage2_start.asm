@@ -1,12 +1,21 @@
 extern _init
 extern kloader
 extern _fini
-extern KERNEL_MEMORY_START_ADDRESS
+extern kernelEntryPoint
+extern __bss_start
+extern __bss_end
 
 section .text.start
 global _start
 _start:
+    ; .bss is not part of the flat binary, so it may lie past the loaded image
+    mov edi, __bss_start
+    mov ecx, __bss_end
+    sub ecx, edi
+    xor eax, eax
+    cld
+    rep stosb
     call _init
     call kloader
     call _fini
-    jmp [KERNEL_MEMORY_START_ADDRESS]
+    jmp [kernelEntryPoint]
@@ -0,0 +1,112 @@
+#include "lz4_frame.hpp"
+
+#include "../utils/data_manipulation.hpp"
+#include "../xstd/cstring.hpp"
+
+namespace LiOS86 {
+
+    namespace {
+
+        constexpr uint8_t FLG_VERSION_MASK = 0xC0;
+        constexpr uint8_t FLG_VERSION = 0x40;
+        constexpr uint8_t FLG_BLOCK_CHECKSUM = 0x10;
+        constexpr uint8_t FLG_CONTENT_SIZE = 0x08;
+        constexpr uint8_t FLG_DICTIONARY_ID = 0x01;
+        constexpr uint32_t UNCOMPRESSED_BLOCK = 0x80000000;
+        constexpr std::size_t MIN_MATCH = 4;
+
+        // reads a length continued in the following bytes for as long as they are 255
+        auto readExtendedLength(const uint8_t*& input, const uint8_t* inputEnd, std::size_t& length) -> bool {
+            uint8_t byte = 0;
+            do {
+                if(input == inputEnd) return false;
+                byte = *input++;
+                length += byte;
+            } while(byte == 255);
+            return true;
+        }
+
+        // one block: sequences of literals copied as they are and matches copied from the output written before
+        auto decompressBlock(const uint8_t* input, const uint8_t* inputEnd, const uint8_t* outputStart, uint8_t*& output, const uint8_t* outputEnd) -> bool {
+            while(input < inputEnd) {
+                const auto token = *input++;
+
+                std::size_t literalLength = token >> 4;
+                if(literalLength == 15 && !readExtendedLength(input, inputEnd, literalLength)) return false;
+                if(literalLength > static_cast<std::size_t>(inputEnd - input) || literalLength > static_cast<std::size_t>(outputEnd - output)) return false;
+                xstd::memcpy(output, input, literalLength);
+                output += literalLength;
+                input += literalLength;
+                // the last sequence of a block has literals only
+                if(input == inputEnd) return true;
+
+                if(inputEnd - input < 2) return false;
+                const auto offset = static_cast<std::size_t>(input[0] | (input[1] << 8));
+                input += 2;
+                if(offset == 0 || offset > static_cast<std::size_t>(output - outputStart)) return false;
+
+                std::size_t matchLength = token & 0x0F;
+                if(matchLength == 15 && !readExtendedLength(input, inputEnd, matchLength)) return false;
+                matchLength += MIN_MATCH;
+                if(matchLength > static_cast<std::size_t>(outputEnd - output)) return false;
+                // byte by byte, since a match may overlap the bytes it produces
+                const uint8_t* match = output - offset;
+                for(std::size_t i = 0; i < matchLength; ++i) {
+                    *output++ = *match++;
+                }
+            }
+            return true;
+        }
+
+    }
+
+    auto isLZ4Frame(xstd::span<const uint8_t> source) -> bool {
+        return source.size() >= 4 && readFromMemoryAndPun<uint32_t>(source.data()) == LZ4_FRAME_MAGIC;
+    }
+
+    auto decompressLZ4Frame(xstd::span<const uint8_t> source, xstd::span<uint8_t> destination) -> xstd::expected<uint32_t, LZ4Error> {
+        if(!isLZ4Frame(source)) return xstd::unexpected(LZ4Error::NOT_AN_LZ4_FRAME);
+        auto input = source.data() + 4;
+        const auto inputEnd = source.data() + source.size();
+
+        // frame descriptor: flags, block size byte, optional content size and dictionary ID, header checksum
+        if(inputEnd - input < 3) return xstd::unexpected(LZ4Error::CORRUPT_DATA);
+        const auto flags = input[0];
+        if((flags & FLG_VERSION_MASK) != FLG_VERSION) return xstd::unexpected(LZ4Error::UNSUPPORTED_FRAME);
+        if(flags & FLG_DICTIONARY_ID) return xstd::unexpected(LZ4Error::UNSUPPORTED_FRAME);
+        input += 2;
+        if(flags & FLG_CONTENT_SIZE) {
+            if(inputEnd - input < 8) return xstd::unexpected(LZ4Error::CORRUPT_DATA);
+            const auto contentSize = readFromMemoryAndPun<uint64_t>(input);
+            if(contentSize > destination.size()) return xstd::unexpected(LZ4Error::DESTINATION_TOO_SMALL);
+            input += 8;
+        }
+        ++input;
+
+        const auto outputStart = destination.data();
+        const uint8_t* outputEnd = outputStart + destination.size();
+        auto output = outputStart;
+        while(true) {
+            if(inputEnd - input < 4) return xstd::unexpected(LZ4Error::CORRUPT_DATA);
+            const auto blockSize = readFromMemoryAndPun<uint32_t>(input);
+            input += 4;
+            // end mark
+            if(blockSize == 0) break;
+
+            const auto dataSize = static_cast<std::size_t>(blockSize & ~UNCOMPRESSED_BLOCK);
+            if(dataSize > static_cast<std::size_t>(inputEnd - input)) return xstd::unexpected(LZ4Error::CORRUPT_DATA);
+            if(blockSize & UNCOMPRESSED_BLOCK) {
+                if(dataSize > static_cast<std::size_t>(outputEnd - output)) return xstd::unexpected(LZ4Error::DESTINATION_TOO_SMALL);
+                xstd::memcpy(output, input, dataSize);
+                output += dataSize;
+            } else if(!decompressBlock(input, input + dataSize, outputStart, output, outputEnd)) {
+                return xstd::unexpected(LZ4Error::CORRUPT_DATA);
+            }
+            input += dataSize;
+            if(flags & FLG_BLOCK_CHECKSUM) input += 4;
+        }
+        // a content checksum may follow, it is not verified
+        return static_cast<uint32_t>(output - outputStart);
+    }
+
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "../xstd/expected.hpp"
+#include "../xstd/span.hpp"
+
+namespace LiOS86 {
+
+    enum class LZ4Error : uint8_t { NOT_AN_LZ4_FRAME, UNSUPPORTED_FRAME, CORRUPT_DATA, DESTINATION_TOO_SMALL };
+
+    constexpr uint32_t LZ4_FRAME_MAGIC = 0x184D2204;
+
+    // true if the data starts with the magic number of an LZ4 frame (as written by the lz4 tool)
+    auto isLZ4Frame(xstd::span<const uint8_t> source) -> bool;
+
+    // Decompresses an LZ4 frame into the destination, which has to hold the frame's whole content: all blocks
+    // are decompressed one after the other into a single buffer, so linked blocks need no separate history.
+    // Block and content checksums are skipped, not verified. Returns the number of bytes decompressed.
+    auto decompressLZ4Frame(xstd::span<const uint8_t> source, xstd::span<uint8_t> destination) -> xstd::expected<uint32_t, LZ4Error>;
+
+}
@@ -2,15 +2,15 @@
 
 #include <stdint.h>
 
+#include "block_cache.hpp"
 #include "utils/data_manipulation.hpp"
-#include "utils/disk_buffer.hpp"
 #include "xstd/utility.hpp"
 
 namespace LiOS86 {
 
-    class MBRHandle : ReadonlyDiskBuffer<1> {
+    class MBRHandle : CachedSector {
         public:
-            MBRHandle() : ReadonlyDiskBuffer<1>(0) { }
+            MBRHandle() : CachedSector(0) { }
 
             class PartitionTableEntryHandle {
                 public:
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace LiOS86 {
+
+    // 32-bit registers of a memory-mapped device (e.g. a PCI memory BAR), by byte offset from its base
+    static inline auto readRegister(volatile uint32_t* base, uint32_t offset) -> uint32_t {
+        return base[offset / 4];
+    }
+
+    static inline auto writeRegister(volatile uint32_t* base, uint32_t offset, uint32_t value) -> void {
+        base[offset / 4] = value;
+    }
+
+    // Keeps the compiler from moving accesses to memory shared with a device (DMA buffers, descriptor
+    // tables, queues) across register or port accesses. x86 does not reorder them itself, so no fence is needed.
+    static inline auto compilerBarrier() -> void {
+        __asm__ volatile ("" : : : "memory");
+    }
+
+}
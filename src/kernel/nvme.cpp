@@ -0,0 +1,381 @@
+#include "nvme.hpp"
+
+#include "interrupt_manager.hpp"
+#include "mmio.hpp"
+#include "pci.hpp"
+#include "xstd/cstring.hpp"
+
+namespace LiOS86 {
+
+    namespace {
+        constexpr std::size_t PAGE_SIZE = 4096;
+        constexpr uint16_t ADMIN_QUEUE_SIZE = 16;
+        constexpr uint16_t MAX_IO_QUEUE_SIZE = 64;
+        constexpr std::size_t MAX_COMMANDS = 32;
+        constexpr std::size_t PRP_LIST_ENTRIES = PAGE_SIZE / sizeof(uint64_t);
+
+        class SubmissionQueueEntry {
+            public:
+                uint8_t opcode;
+                uint8_t flags;
+                uint16_t commandID;
+                uint32_t namespaceID;
+                uint64_t reserved;
+                uint64_t metadataPointer;
+                uint64_t prp1;
+                uint64_t prp2;
+                uint32_t cdw10;
+                uint32_t cdw11;
+                uint32_t cdw12;
+                uint32_t cdw13;
+                uint32_t cdw14;
+                uint32_t cdw15;
+        } __attribute__((packed));
+        static_assert( sizeof(SubmissionQueueEntry) == 64, "SubmissionQueueEntry has incorrect size" );
+
+        class CompletionQueueEntry {
+            public:
+                uint32_t commandSpecific;
+                uint32_t reserved;
+                uint16_t submissionQueueHead;
+                uint16_t submissionQueueID;
+                uint16_t commandID;
+                uint16_t status;                // bit 0 - phase tag, bits 15:1 - status field
+        } __attribute__((packed));
+        static_assert( sizeof(CompletionQueueEntry) == 16, "CompletionQueueEntry has incorrect size" );
+
+        // memory shared with the controller; addresses are handed out as physical (identity mapping)
+        SubmissionQueueEntry adminSubmissionQueue[ADMIN_QUEUE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+        volatile CompletionQueueEntry adminCompletionQueue[ADMIN_QUEUE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+        SubmissionQueueEntry ioSubmissionQueue[MAX_IO_QUEUE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+        volatile CompletionQueueEntry ioCompletionQueue[MAX_IO_QUEUE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+        uint8_t identifyBuffer[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+        // one PRP list page per command slot, for transfers spanning more than two memory pages
+        uint64_t prpLists[MAX_COMMANDS][PRP_LIST_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+
+        // controller register offsets
+        constexpr uint32_t REG_CAP_LOW = 0x00;
+        constexpr uint32_t REG_CAP_HIGH = 0x04;
+        constexpr uint32_t REG_CC = 0x14;
+        constexpr uint32_t REG_CSTS = 0x1c;
+        constexpr uint32_t REG_AQA = 0x24;
+        constexpr uint32_t REG_ASQ_LOW = 0x28;
+        constexpr uint32_t REG_ASQ_HIGH = 0x2c;
+        constexpr uint32_t REG_ACQ_LOW = 0x30;
+        constexpr uint32_t REG_ACQ_HIGH = 0x34;
+        constexpr uint32_t DOORBELLS_OFFSET = 0x1000;
+
+        constexpr uint32_t CC_ENABLE = 1u << 0;
+        constexpr uint32_t CC_IO_SQ_ENTRY_SIZE = 6u << 16;     // 2^6 = 64 bytes
+        constexpr uint32_t CC_IO_CQ_ENTRY_SIZE = 4u << 20;     // 2^4 = 16 bytes
+        constexpr uint32_t CSTS_READY = 1u << 0;
+        constexpr uint32_t CSTS_FATAL = 1u << 1;
+
+        enum class AdminOpcode : uint8_t {
+            CREATE_IO_SUBMISSION_QUEUE = 0x01,
+            CREATE_IO_COMPLETION_QUEUE = 0x05,
+            IDENTIFY = 0x06
+        };
+
+        enum class IOOpcode : uint8_t {
+            FLUSH = 0x00,
+            WRITE = 0x01,
+            READ = 0x02
+        };
+
+        constexpr uint32_t NAMESPACE_ID = 1;
+
+        auto isSuccessful(uint16_t completionStatus) -> bool {
+            return (completionStatus >> 1) == 0;
+        }
+    }
+
+    NVMeController::NVMeController() {
+        constexpr uint8_t MASS_STORAGE_CLASS = 0x01;
+        constexpr uint8_t NVM_SUBCLASS = 0x08;
+        constexpr uint8_t NVME_PROG_IF = 0x02;
+
+        const auto controller = findPCIDevice([](const PCIDeviceHandle& handle) {
+            return handle.getClassCode() == MASS_STORAGE_CLASS && handle.getSubclass() == NVM_SUBCLASS &&
+                    handle.getProgIF() == NVME_PROG_IF;
+        });
+        if(!controller || controller->isIOSpaceBAR(0)) return;
+        // BAR0 is 64-bit, the upper half (BAR1) has to be 0 to be reachable without paging
+        const auto is64BitBAR = ((controller->getBAR(0) >> 1) & 0x03) == 0x02;
+        if(is64BitBAR && controller->getBAR(1) != 0) return;
+        controller->enableMemorySpace();
+        controller->enableBusMastering();
+
+        registers = reinterpret_cast<volatile uint32_t*>(controller->getBARAddress(0));
+        // without an interrupt line the completion queue is created without interrupts and polled instead
+        interruptDriven = controller->hasInterruptLine();
+        if(!enableController() || !identify() || !createIOQueues()) {
+            registers = nullptr;
+            return;
+        }
+        if(interruptDriven) {
+            InterruptManager::set_interrupt_handler(InterruptManager::irq_to_interrupt_number(controller->getInterruptLine()), interrupt_handler);
+        }
+    }
+
+    auto NVMeController::enableController() -> bool {
+        const auto capabilitiesHigh = readRegister(registers, REG_CAP_HIGH);
+        doorbellStride = 4u << (capabilitiesHigh & 0x0f);
+        const auto maxQueueEntries = (readRegister(registers, REG_CAP_LOW) & 0xffff) + 1u;
+
+        writeRegister(registers, REG_CC, readRegister(registers, REG_CC) & ~CC_ENABLE);
+        while(readRegister(registers, REG_CSTS) & CSTS_READY) { }
+
+        xstd::memset(adminSubmissionQueue, 0, sizeof(adminSubmissionQueue));
+        xstd::memset(const_cast<CompletionQueueEntry*>(adminCompletionQueue), 0, sizeof(adminCompletionQueue));
+        adminQueue = QueuePair{};
+        adminQueue.size = ADMIN_QUEUE_SIZE;
+        compilerBarrier();
+
+        writeRegister(registers, REG_AQA, static_cast<uint32_t>((ADMIN_QUEUE_SIZE - 1) << 16 | (ADMIN_QUEUE_SIZE - 1)));
+        writeRegister(registers, REG_ASQ_LOW, reinterpret_cast<uint32_t>(&adminSubmissionQueue[0]));
+        writeRegister(registers, REG_ASQ_HIGH, 0);
+        writeRegister(registers, REG_ACQ_LOW, reinterpret_cast<uint32_t>(&adminCompletionQueue[0]));
+        writeRegister(registers, REG_ACQ_HIGH, 0);
+        // NVM command set, 4 KiB memory pages
+        writeRegister(registers, REG_CC, CC_IO_SQ_ENTRY_SIZE | CC_IO_CQ_ENTRY_SIZE | CC_ENABLE);
+
+        while(!(readRegister(registers, REG_CSTS) & CSTS_READY)) {
+            if(readRegister(registers, REG_CSTS) & CSTS_FATAL) return false;
+        }
+
+        ioQueue = QueuePair{};
+        ioQueue.id = 1;
+        ioQueue.size = static_cast<uint16_t>((maxQueueEntries < MAX_IO_QUEUE_SIZE) ? maxQueueEntries : MAX_IO_QUEUE_SIZE);
+        // one queue entry always stays empty to tell a full queue from an empty one
+        const auto numberOfCommands = (ioQueue.size - 1u < MAX_COMMANDS) ? ioQueue.size - 1u : MAX_COMMANDS;
+        usableCommandsMask = (numberOfCommands == 32) ? 0xffffffffu : ((1u << numberOfCommands) - 1);
+        return true;
+    }
+
+    auto NVMeController::identify() -> bool {
+        constexpr uint32_t CNS_NAMESPACE = 0;
+        constexpr uint32_t CNS_CONTROLLER = 1;
+
+        if(!adminCommand(static_cast<uint8_t>(AdminOpcode::IDENTIFY), 0, reinterpret_cast<uint32_t>(identifyBuffer), CNS_CONTROLLER, 0)) {
+            return false;
+        }
+        // byte 77 - maximum data transfer size as a power of two in units of the minimum page size (0 - unlimited)
+        const auto maxDataTransferSize = identifyBuffer[77];
+        const std::size_t maxTransferPages = (maxDataTransferSize == 0 || maxDataTransferSize > 9) ? PRP_LIST_ENTRIES : (1u << maxDataTransferSize);
+        // limited by a single PRP list page as well
+        const auto pages = (maxTransferPages < PRP_LIST_ENTRIES) ? maxTransferPages : PRP_LIST_ENTRIES;
+        maxSectorsPerCommand = static_cast<uint32_t>(pages * PAGE_SIZE / ATA_SECTOR_SIZE);
+
+        if(!adminCommand(static_cast<uint8_t>(AdminOpcode::IDENTIFY), NAMESPACE_ID, reinterpret_cast<uint32_t>(identifyBuffer), CNS_NAMESPACE, 0)) {
+            return false;
+        }
+        // byte 26, bits 3:0 - formatted LBA format index; LBA formats start at byte 128, 4 bytes each,
+        // the third byte holding the LBA data size as a power of two
+        const auto lbaFormat = identifyBuffer[26] & 0x0f;
+        const auto lbaDataSize = identifyBuffer[128 + 4 * lbaFormat + 2];
+        return (1u << lbaDataSize) == ATA_SECTOR_SIZE;
+    }
+
+    auto NVMeController::createIOQueues() -> bool {
+        constexpr uint32_t PHYSICALLY_CONTIGUOUS = 1u << 0;
+        constexpr uint32_t INTERRUPTS_ENABLED = 1u << 1;
+
+        xstd::memset(ioSubmissionQueue, 0, sizeof(ioSubmissionQueue));
+        xstd::memset(const_cast<CompletionQueueEntry*>(ioCompletionQueue), 0, sizeof(ioCompletionQueue));
+        compilerBarrier();
+
+        const auto queueDescriptor = static_cast<uint32_t>((ioQueue.size - 1) << 16 | ioQueue.id);
+        if(!adminCommand(static_cast<uint8_t>(AdminOpcode::CREATE_IO_COMPLETION_QUEUE), 0,
+                            reinterpret_cast<uint32_t>(&ioCompletionQueue[0]), queueDescriptor, PHYSICALLY_CONTIGUOUS | (interruptDriven ? INTERRUPTS_ENABLED : 0))) {
+            return false;
+        }
+        return adminCommand(static_cast<uint8_t>(AdminOpcode::CREATE_IO_SUBMISSION_QUEUE), 0,
+                            reinterpret_cast<uint32_t>(&ioSubmissionQueue[0]), queueDescriptor, static_cast<uint32_t>(ioQueue.id) << 16 | PHYSICALLY_CONTIGUOUS);
+    }
+
+    // Admin commands are only issued during initialization, one at a time, and are polled for.
+    auto NVMeController::adminCommand(uint8_t opcode, uint32_t namespaceID, uint32_t dataAddress, uint32_t cdw10, uint32_t cdw11) -> bool {
+        const auto commandID = adminQueue.submissionTail;
+        adminSubmissionQueue[adminQueue.submissionTail] = SubmissionQueueEntry{opcode, 0, commandID, namespaceID, 0, 0, dataAddress, 0, cdw10, cdw11, 0, 0, 0, 0};
+        adminQueue.submissionTail = static_cast<uint16_t>((adminQueue.submissionTail + 1) % adminQueue.size);
+        ringSubmissionDoorbell(adminQueue);
+
+        volatile auto& entry = adminCompletionQueue[adminQueue.completionHead];
+        while(((entry.status & 1) != 0) != adminQueue.phase) {
+            if(readRegister(registers, REG_CSTS) & CSTS_FATAL) return false;
+        }
+        compilerBarrier();
+        const auto status = entry.status;
+
+        adminQueue.completionHead = static_cast<uint16_t>(adminQueue.completionHead + 1);
+        if(adminQueue.completionHead == adminQueue.size) {
+            adminQueue.completionHead = 0;
+            adminQueue.phase = !adminQueue.phase;
+        }
+        ringCompletionDoorbell(adminQueue);
+        return isSuccessful(status);
+    }
+
+    auto NVMeController::ringSubmissionDoorbell(QueuePair& queue) -> void {
+        compilerBarrier();
+        writeRegister(registers, DOORBELLS_OFFSET + (2u * queue.id) * doorbellStride, queue.submissionTail);
+        queue.publishedTail = queue.submissionTail;
+    }
+
+    auto NVMeController::ringCompletionDoorbell(QueuePair& queue) -> void {
+        writeRegister(registers, DOORBELLS_OFFSET + (2u * queue.id + 1) * doorbellStride, queue.completionHead);
+    }
+
+    auto NVMeController::allocateCommand() -> xstd::expected<CommandID, DiskError> {
+        const auto freeCommands = usableCommandsMask & ~allocatedCommands;
+        if(freeCommands == 0) return xstd::unexpected(DiskError::QUEUE_FULL);
+        const auto command = static_cast<CommandID>(__builtin_ctz(freeCommands));
+        allocatedCommands |= (1u << command);
+        return command;
+    }
+
+    auto NVMeController::submitImpl(uint32_t logicalBlockAddress, uint16_t numberOfSectors, const uint8_t* buffer, std::size_t size, bool write) -> xstd::expected<CommandID, DiskError> {
+        if(registers == nullptr) return xstd::unexpected(DiskError::NO_DEVICE);
+        const auto transferSize = numberOfSectors * ATA_SECTOR_SIZE;
+        if(numberOfSectors == 0 || numberOfSectors > maxSectorsPerCommand || size < transferSize) {
+            return xstd::unexpected(DiskError::BUFFER_TOO_SMALL);
+        }
+        const auto address = reinterpret_cast<uint32_t>(buffer);
+        if(address % 4 != 0) return xstd::unexpected(DiskError::MISALIGNED_BUFFER);
+
+        const auto command = allocateCommand();
+        if(!command) return command;
+
+        // PRP1 covers the rest of the first memory page; PRP2 is either the second page or a list of the remaining ones
+        uint64_t prp2 = 0;
+        const auto firstPageBytes = PAGE_SIZE - address % PAGE_SIZE;
+        if(transferSize > firstPageBytes) {
+            const auto nextPage = static_cast<uint32_t>(address + firstPageBytes);
+            const auto remainingPages = (transferSize - firstPageBytes + PAGE_SIZE - 1) / PAGE_SIZE;
+            if(remainingPages == 1) {
+                prp2 = nextPage;
+            } else {
+                for(std::size_t i = 0; i < remainingPages; ++i) {
+                    prpLists[*command][i] = nextPage + i * PAGE_SIZE;
+                }
+                prp2 = reinterpret_cast<uint32_t>(&prpLists[*command][0]);
+            }
+        }
+
+        const auto opcode = static_cast<uint8_t>(write ? IOOpcode::WRITE : IOOpcode::READ);
+        ioSubmissionQueue[ioQueue.submissionTail] = SubmissionQueueEntry{opcode, 0, *command, NAMESPACE_ID, 0, 0, address, prp2,
+                                                                        logicalBlockAddress, 0, static_cast<uint32_t>(numberOfSectors - 1), 0, 0, 0};
+        ioQueue.submissionTail = static_cast<uint16_t>((ioQueue.submissionTail + 1) % ioQueue.size);
+        sectorCounts[*command] = numberOfSectors;
+        return command;
+    }
+
+    auto NVMeController::kickImpl() -> void {
+        if(registers == nullptr || ioQueue.submissionTail == ioQueue.publishedTail) return;
+        ringSubmissionDoorbell(ioQueue);
+    }
+
+    auto NVMeController::waitForCompletionImpl(CommandID command) -> xstd::expected<uint32_t, DiskError> {
+        const auto bit = 1u << command;
+        if(!(allocatedCommands & bit)) return xstd::unexpected(DiskError::DEVICE_ERROR);
+        kickImpl();
+
+        InterruptManager::wait_until([this, bit]() { return ((completedCommands | failedCommands) & bit) != 0; },
+                                        [this]() { processCompletions(); }, interruptDriven);
+        compilerBarrier();
+
+        InterruptGuard guard;
+        const bool failed = failedCommands & bit;
+        completedCommands = completedCommands & ~bit;
+        failedCommands = failedCommands & ~bit;
+        allocatedCommands &= ~bit;
+        if(failed) return xstd::unexpected(DiskError::DEVICE_ERROR);
+        return sectorCounts[command];
+    }
+
+    // Requests longer than the controller's maximum data transfer size are split into several commands, like the ATA driver does.
+    auto NVMeController::readSectors(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<uint8_t> destination) -> xstd::expected<uint32_t, DiskError> {
+        if(destination.size() < numberOfSectors * ATA_SECTOR_SIZE) return xstd::unexpected(DiskError::BUFFER_TOO_SMALL);
+        if(!isAvailable()) return xstd::unexpected(DiskError::NO_DEVICE);
+
+        const auto maxSectors = instance().maxSectorsPerCommand;
+        uint32_t sectorsRead = 0;
+        while(sectorsRead < numberOfSectors) {
+            const auto remainingSectors = numberOfSectors - sectorsRead;
+            const auto commandSectors = static_cast<uint16_t>((remainingSectors < maxSectors) ? remainingSectors : maxSectors);
+            const auto command = submitRead(logicalBlockAddress + sectorsRead, commandSectors, destination.subspan(sectorsRead * ATA_SECTOR_SIZE));
+            if(!command) return xstd::unexpected(command.error());
+            const auto completed = waitForCompletion(*command);
+            if(!completed) return completed;
+            sectorsRead += commandSectors;
+        }
+        return sectorsRead;
+    }
+
+    auto NVMeController::writeSectors(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<const uint8_t> source) -> xstd::expected<uint32_t, DiskError> {
+        if(source.size() < numberOfSectors * ATA_SECTOR_SIZE) return xstd::unexpected(DiskError::BUFFER_TOO_SMALL);
+        if(!isAvailable()) return xstd::unexpected(DiskError::NO_DEVICE);
+
+        const auto maxSectors = instance().maxSectorsPerCommand;
+        uint32_t sectorsWritten = 0;
+        while(sectorsWritten < numberOfSectors) {
+            const auto remainingSectors = numberOfSectors - sectorsWritten;
+            const auto commandSectors = static_cast<uint16_t>((remainingSectors < maxSectors) ? remainingSectors : maxSectors);
+            const auto command = submitWrite(logicalBlockAddress + sectorsWritten, commandSectors, source.subspan(sectorsWritten * ATA_SECTOR_SIZE));
+            if(!command) return xstd::unexpected(command.error());
+            const auto completed = waitForCompletion(*command);
+            if(!completed) return completed;
+            sectorsWritten += commandSectors;
+        }
+        return sectorsWritten;
+    }
+
+    // The flush covers the writes completed before it, which is all of them for the synchronous callers; it transfers no data.
+    auto NVMeController::flushCacheImpl() -> bool {
+        if(registers == nullptr) return false;
+        const auto command = allocateCommand();
+        if(!command) return false;
+
+        ioSubmissionQueue[ioQueue.submissionTail] = SubmissionQueueEntry{static_cast<uint8_t>(IOOpcode::FLUSH), 0, *command, NAMESPACE_ID,
+                                                                        0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+        ioQueue.submissionTail = static_cast<uint16_t>((ioQueue.submissionTail + 1) % ioQueue.size);
+        sectorCounts[*command] = 0;
+        return waitForCompletionImpl(*command).has_value();
+    }
+
+    auto NVMeController::interrupt_handler() -> void {
+        instance().processCompletions();
+    }
+
+    // Consumes new entries of the I/O completion queue (recognized by their phase tag)
+    // and acknowledges them with a single completion doorbell write.
+    auto NVMeController::processCompletions() -> void {
+        if(registers == nullptr) return;
+        InterruptGuard guard;
+
+        bool consumed = false;
+        while(true) {
+            volatile auto& entry = ioCompletionQueue[ioQueue.completionHead];
+            const auto status = entry.status;
+            if(((status & 1) != 0) != ioQueue.phase) break;
+            compilerBarrier();
+
+            const auto bit = 1u << (entry.commandID % MAX_COMMANDS);
+            if(isSuccessful(status)) {
+                completedCommands = completedCommands | bit;
+            } else {
+                failedCommands = failedCommands | bit;
+            }
+
+            ioQueue.completionHead = static_cast<uint16_t>(ioQueue.completionHead + 1);
+            if(ioQueue.completionHead == ioQueue.size) {
+                ioQueue.completionHead = 0;
+                ioQueue.phase = !ioQueue.phase;
+            }
+            consumed = true;
+        }
+        if(consumed) ringCompletionDoorbell(ioQueue);
+    }
+
+}
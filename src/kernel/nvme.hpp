@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "ata.hpp"
+#include "xstd/array.hpp"
+#include "xstd/expected.hpp"
+#include "xstd/span.hpp"
+
+namespace LiOS86 {
+
+    // Driver for an NVMe controller, using namespace 1 (which has to be formatted with 512-byte blocks).
+    // Besides the admin queue pair it creates one I/O submission/completion queue pair; the queue
+    // state is kept together so further pairs (e.g. one per CPU) can be added later.
+    // Submitted commands are only made visible to the controller by kick(), which rings the
+    // submission doorbell once for all of them; waitForCompletion kicks pending commands itself.
+    // Completions are signalled by the controller's (pin-based) interrupt, or polled for if the firmware
+    // routed no interrupt line to it.
+    class NVMeController {
+        public:
+            NVMeController(const NVMeController&) = delete;
+            NVMeController& operator=(const NVMeController&) = delete;
+            NVMeController(NVMeController&&) = delete;
+            NVMeController& operator=(NVMeController&&) = delete;
+
+            static auto& instance() {
+                static NVMeController nvme_controller;
+                return nvme_controller;
+            }
+
+            using CommandID = uint8_t;
+
+            static auto isAvailable() -> bool {
+                return instance().registers != nullptr;
+            }
+
+            // queues a read into the (dword-aligned) destination buffer; it is sent to the controller on the next kick
+            static auto submitRead(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<uint8_t> destination) -> xstd::expected<CommandID, DiskError> {
+                return instance().submitImpl(logicalBlockAddress, numberOfSectors, destination.data(), destination.size(), false);
+            }
+
+            static auto submitWrite(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<const uint8_t> source) -> xstd::expected<CommandID, DiskError> {
+                return instance().submitImpl(logicalBlockAddress, numberOfSectors, source.data(), source.size(), true);
+            }
+
+            // rings the I/O submission queue doorbell once for all commands submitted since the last kick
+            static auto kick() -> void {
+                instance().kickImpl();
+            }
+
+            // waits until the command completes and releases it; returns the number of sectors transferred
+            static auto waitForCompletion(CommandID command) -> xstd::expected<uint32_t, DiskError> {
+                return instance().waitForCompletionImpl(command);
+            }
+
+            // submit, kick and wait for one command per getMaxSectorsPerCommand() sectors
+            static auto readSectors(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<uint8_t> destination) -> xstd::expected<uint32_t, DiskError>;
+            static auto writeSectors(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<const uint8_t> source) -> xstd::expected<uint32_t, DiskError>;
+
+            // the most sectors a single command transfers (limited by the controller's MDTS); longer requests are split
+            static auto getMaxSectorsPerCommand() -> uint32_t {
+                return instance().maxSectorsPerCommand;
+            }
+
+            // commits the namespace's volatile write cache to the media (Flush command), like flushCache in ata.hpp
+            static auto flushCache() -> bool {
+                return instance().flushCacheImpl();
+            }
+
+        private:
+            NVMeController();
+
+            class QueuePair {
+                public:
+                    uint16_t id{0};
+                    uint16_t size{0};
+                    uint16_t submissionTail{0};     // including commands not yet kicked
+                    uint16_t publishedTail{0};      // last value written to the submission doorbell
+                    uint16_t completionHead{0};
+                    bool phase{true};               // phase tag value of new completion entries
+            };
+
+            auto enableController() -> bool;
+            auto identify() -> bool;
+            auto createIOQueues() -> bool;
+            auto adminCommand(uint8_t opcode, uint32_t namespaceID, uint32_t dataAddress, uint32_t cdw10, uint32_t cdw11) -> bool;
+
+            auto ringSubmissionDoorbell(QueuePair& queue) -> void;
+            auto ringCompletionDoorbell(QueuePair& queue) -> void;
+
+            auto allocateCommand() -> xstd::expected<CommandID, DiskError>;
+            auto submitImpl(uint32_t logicalBlockAddress, uint16_t numberOfSectors, const uint8_t* buffer, std::size_t size, bool write) -> xstd::expected<CommandID, DiskError>;
+            auto kickImpl() -> void;
+            auto waitForCompletionImpl(CommandID command) -> xstd::expected<uint32_t, DiskError>;
+            auto flushCacheImpl() -> bool;
+
+            static auto interrupt_handler() -> void;
+            auto processCompletions() -> void;
+
+            volatile uint32_t* registers{nullptr};
+            uint32_t doorbellStride{4};
+            uint32_t maxSectorsPerCommand{0};
+            bool interruptDriven{false};        // an interrupt line is routed to the controller, otherwise completions are polled
+
+            QueuePair adminQueue{};
+            QueuePair ioQueue{};
+
+            uint32_t usableCommandsMask{0};
+            uint32_t allocatedCommands{0};
+            volatile uint32_t completedCommands{0};
+            volatile uint32_t failedCommands{0};
+            xstd::array<uint16_t, 32> sectorCounts{};
+    };
+
+}
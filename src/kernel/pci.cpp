@@ -0,0 +1,54 @@
+#include "pci.hpp"
+
+#include "ports.hpp"
+
+namespace LiOS86 {
+
+    namespace {
+        auto selectRegister(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset) -> void {
+            const uint32_t address = 0x80000000u
+                                    | (static_cast<uint32_t>(bus) << 16)
+                                    | (static_cast<uint32_t>(device & 0x1f) << 11)
+                                    | (static_cast<uint32_t>(function & 0x07) << 8)
+                                    | (offset & 0xfc);
+            outl(Port::PCI_CONFIG_ADDRESS, address);
+        }
+
+        // the data port is 4 bytes wide, narrower registers are accessed at their offset within it
+        auto dataPort(uint8_t offset) -> Port {
+            return static_cast<Port>(static_cast<uint16_t>(Port::PCI_CONFIG_DATA) + (offset & 0x03));
+        }
+    }
+
+    auto PCIDeviceHandle::readConfig8(uint8_t offset) const -> uint8_t {
+        selectRegister(busNumber, deviceNumber, functionNumber, offset);
+        return inb(dataPort(offset));
+    }
+
+    auto PCIDeviceHandle::readConfig16(uint8_t offset) const -> uint16_t {
+        selectRegister(busNumber, deviceNumber, functionNumber, offset);
+        return inw(dataPort(offset));
+    }
+
+    auto PCIDeviceHandle::readConfig32(uint8_t offset) const -> uint32_t {
+        selectRegister(busNumber, deviceNumber, functionNumber, offset);
+        return inl(Port::PCI_CONFIG_DATA);
+    }
+
+    auto PCIDeviceHandle::writeConfig16(uint8_t offset, uint16_t value) const -> void {
+        selectRegister(busNumber, deviceNumber, functionNumber, offset);
+        outw(dataPort(offset), value);
+    }
+
+    auto PCIDeviceHandle::writeConfig32(uint8_t offset, uint32_t value) const -> void {
+        selectRegister(busNumber, deviceNumber, functionNumber, offset);
+        outl(Port::PCI_CONFIG_DATA, value);
+    }
+
+    auto findPCIDevice(uint8_t classCode, uint8_t subclass) -> xstd::expected<PCIDeviceHandle, PCIError> {
+        return findPCIDevice([classCode, subclass](const PCIDeviceHandle& handle) {
+            return handle.getClassCode() == classCode && handle.getSubclass() == subclass;
+        });
+    }
+
+}
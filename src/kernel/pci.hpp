@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "xstd/expected.hpp"
+
+namespace LiOS86 {
+
+    // accesses the configuration space of a single PCI function (configuration mechanism #1)
+    class PCIDeviceHandle {
+        public:
+            constexpr PCIDeviceHandle(uint8_t bus, uint8_t device, uint8_t function) :
+                busNumber{bus}, deviceNumber{device}, functionNumber{function} { }
+
+            auto readConfig8(uint8_t offset) const -> uint8_t;
+            auto readConfig16(uint8_t offset) const -> uint16_t;
+            auto readConfig32(uint8_t offset) const -> uint32_t;
+            auto writeConfig16(uint8_t offset, uint16_t value) const -> void;
+            auto writeConfig32(uint8_t offset, uint32_t value) const -> void;
+
+            auto isPresent() const -> bool {
+                return getVendorID() != 0xffff;
+            }
+
+            auto getVendorID() const -> uint16_t {
+                return readConfig16(0x00);
+            }
+
+            auto getDeviceID() const -> uint16_t {
+                return readConfig16(0x02);
+            }
+
+            auto getProgIF() const -> uint8_t {
+                return readConfig8(0x09);
+            }
+
+            auto getSubclass() const -> uint8_t {
+                return readConfig8(0x0a);
+            }
+
+            auto getClassCode() const -> uint8_t {
+                return readConfig8(0x0b);
+            }
+
+            auto isMultiFunction() const -> bool {
+                return readConfig8(0x0e) & 0x80;
+            }
+
+            auto getBAR(uint8_t barNumber) const -> uint32_t {
+                return readConfig32(static_cast<uint8_t>(0x10 + 4 * barNumber));
+            }
+
+            auto isIOSpaceBAR(uint8_t barNumber) const -> bool {
+                return getBAR(barNumber) & 0x01;
+            }
+
+            // base address of a BAR with the type/flag bits masked out
+            auto getBARAddress(uint8_t barNumber) const -> uint32_t {
+                const auto bar = getBAR(barNumber);
+                return isIOSpaceBAR(barNumber) ? (bar & ~0x3u) : (bar & ~0xfu);
+            }
+
+            auto hasCapabilitiesList() const -> bool {
+                return readConfig16(0x06) & 0x10;
+            }
+
+            auto getCapabilitiesPointer() const -> uint8_t {
+                return readConfig8(0x34) & 0xfc;
+            }
+
+            auto getInterruptLine() const -> uint8_t {
+                return readConfig8(0x3c);
+            }
+
+            // the firmware writes 0xff when no PIC line is routed to the device's interrupt pin
+            auto hasInterruptLine() const -> bool {
+                return getInterruptLine() < 16;
+            }
+
+            auto enableIOSpace() const -> void {
+                writeConfig16(0x04, readConfig16(0x04) | 0x01);
+            }
+
+            auto enableMemorySpace() const -> void {
+                writeConfig16(0x04, readConfig16(0x04) | 0x02);
+            }
+
+            auto enableBusMastering() const -> void {
+                writeConfig16(0x04, readConfig16(0x04) | 0x04);
+            }
+
+        private:
+            uint8_t busNumber;
+            uint8_t deviceNumber;
+            uint8_t functionNumber;
+    };
+
+    enum class PCIError : uint8_t { DEVICE_NOT_FOUND };
+
+    // brute-force scan of all PCI buses; returns the first function accepted by the predicate
+    auto findPCIDevice(auto predicate) -> xstd::expected<PCIDeviceHandle, PCIError> {
+        for(uint16_t bus = 0; bus < 256; ++bus) {
+            for(uint8_t device = 0; device < 32; ++device) {
+                const auto function0 = PCIDeviceHandle(static_cast<uint8_t>(bus), device, 0);
+                if(!function0.isPresent()) continue;
+                const uint8_t numberOfFunctions = function0.isMultiFunction() ? 8 : 1;
+                for(uint8_t function = 0; function < numberOfFunctions; ++function) {
+                    const auto handle = PCIDeviceHandle(static_cast<uint8_t>(bus), device, function);
+                    if(handle.isPresent() && predicate(handle)) return handle;
+                }
+            }
+        }
+        return xstd::unexpected(PCIError::DEVICE_NOT_FOUND);
+    }
+
+    auto findPCIDevice(uint8_t classCode, uint8_t subclass) -> xstd::expected<PCIDeviceHandle, PCIError>;
+
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <cstddef>
 
 namespace LiOS86 {
 
@@ -9,6 +10,8 @@ namespace LiOS86 {
         PIC1_DATA = PIC1_COMMAND+1,
         PIC2_COMMAND = 0xa0,
         PIC2_DATA = PIC2_COMMAND+1,
+        PIT_CHANNEL_0_DATA = 0x40,
+        PIT_COMMAND = 0x43,
         PS2_DATA = 0x60,
         VGA_REGISTER_INDEX_3D4 = 0x3d4,
         VGA_REGISTER_DATA_3D5 = 0x3d5,
@@ -25,7 +28,10 @@ namespace LiOS86 {
         ATA_PRIMARY_COMMAND_REG = ATA_PRIMARY_DATA_REG+7,
         ATA_PRIMARY_ALTERNATE_STATUS_REG = 0x3f6,
         ATA_PRIMARY_DEVICE_CONTROL_REG = ATA_PRIMARY_ALTERNATE_STATUS_REG,
-        ATA_PRIMARY_DRIVE_ADDRESS_REG = ATA_PRIMARY_ALTERNATE_STATUS_REG+1
+        ATA_PRIMARY_DRIVE_ADDRESS_REG = ATA_PRIMARY_ALTERNATE_STATUS_REG+1,
+
+        PCI_CONFIG_ADDRESS = 0xcf8,
+        PCI_CONFIG_DATA = 0xcfc
     };
 
     static inline auto outb(Port port, uint8_t val) -> void {
@@ -48,6 +54,26 @@ namespace LiOS86 {
         return ret;
     }
 
+    static inline auto outl(Port port, uint32_t val) -> void {
+        __asm__ volatile ("outl %0, %1" : : "a"(val), "Nd"(static_cast<uint16_t>(port)));
+    }
+
+    static inline auto inl(Port port) -> uint32_t {
+        uint32_t ret;
+        __asm__ volatile ("inl %1, %0" : "=a"(ret) : "Nd"(static_cast<uint16_t>(port)));
+        return ret;
+    }
+
+    // reads count words from the port into the buffer (rep insw)
+    static inline auto insw(Port port, void* buffer, std::size_t count) -> void {
+        __asm__ volatile ("rep insw" : "+D"(buffer), "+c"(count) : "d"(static_cast<uint16_t>(port)) : "memory");
+    }
+
+    // writes count words from the buffer to the port (rep outsw)
+    static inline auto outsw(Port port, const void* buffer, std::size_t count) -> void {
+        __asm__ volatile ("rep outsw" : "+S"(buffer), "+c"(count) : "d"(static_cast<uint16_t>(port)) : "memory");
+    }
+
     static inline auto io_wait() -> void {
         outb(static_cast<Port>(0x80), 0);
     }
@@ -1,5 +1,7 @@
 #include "shell.hpp"
 
+#include "block_device.hpp"
+#include "fat_file.hpp"
 #include "keyboard_controller.hpp"
 #include "keyboard_event.hpp"
 #include "ports.hpp"
@@ -25,6 +27,7 @@ namespace LiOS86 {
         print_impl('\n');
         print_impl("version 1.0.1\n");
         print_impl("Developed by michalbr0 (github.com/michalbr0)\n\n");
+        print_impl("Disk: "); print_impl(activeBlockDevice().getName()); print_impl('\n');
         print_impl("Hello adventurer!\n\n");
         print_impl(">");
         KeyboardController::set_event_callback(keyboard_event_handler);
@@ -107,11 +110,14 @@ namespace LiOS86 {
                 print("Available commands:\n");
                 print("memmap - displays the physical memory map\n");
                 print("clear - clears the screen\n");
+                print("sync - writes all file changes to the disk (done every 5 seconds anyway)\n");
                 print("help - lists available commands\n");
             } else if(instance.input_buffer == "memmap") {
                 MemoryManager::print_memory_map();
             } else if(instance.input_buffer == "clear") {
                 clear();
+            } else if(instance.input_buffer == "sync") {
+                if(!FileTable::sync()) print("Writing to the disk failed.\n");
             } else {
                 print("Invalid command. Type help to list available commands.\n");
             }
@@ -0,0 +1,27 @@
+#include "timer.hpp"
+
+#include "interrupt_manager.hpp"
+#include "ports.hpp"
+
+namespace LiOS86 {
+
+    namespace {
+        constexpr uint32_t PIT_FREQUENCY = 1193182;
+        constexpr uint16_t DIVISOR = static_cast<uint16_t>(PIT_FREQUENCY / Timer::TICKS_PER_SECOND);
+        // channel 0, low byte then high byte of the divisor, mode 2 (rate generator), binary counting
+        constexpr uint8_t CHANNEL_0_RATE_GENERATOR = 0x34;
+    }
+
+    Timer::Timer() {
+        outb(Port::PIT_COMMAND, CHANNEL_0_RATE_GENERATOR);
+        outb(Port::PIT_CHANNEL_0_DATA, static_cast<uint8_t>(DIVISOR & 0xff));
+        outb(Port::PIT_CHANNEL_0_DATA, static_cast<uint8_t>(DIVISOR >> 8));
+        InterruptManager::set_interrupt_handler(InterruptManager::irq_to_interrupt_number(0), timerInterruptHandler);
+    }
+
+    auto Timer::timerInterruptHandler() -> void {
+        auto& instance = Timer::instance();
+        instance.ticks = instance.ticks + 1;
+    }
+
+}
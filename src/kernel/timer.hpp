@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace LiOS86 {
+
+    // Channel 0 of the programmable interval timer (PIT), raising IRQ 0 TICKS_PER_SECOND times a second.
+    // The interrupt handler only counts the ticks; periodic work polls getTicks() outside of interrupt context.
+    class Timer {
+        public:
+            Timer(const Timer&) = delete;
+            Timer& operator=(const Timer&) = delete;
+            Timer(Timer&&) = delete;
+            Timer& operator=(Timer&&) = delete;
+
+            static auto& instance() {
+                static Timer timer;
+                return timer;
+            }
+
+            static constexpr uint32_t TICKS_PER_SECOND = 100;
+
+            // wraps around after ~497 days, differences of two values stay correct across it
+            static auto getTicks() -> uint32_t {
+                return instance().ticks;
+            }
+
+        private:
+            Timer();
+
+            static auto timerInterruptHandler() -> void;
+
+            volatile uint32_t ticks{0};
+    };
+
+}
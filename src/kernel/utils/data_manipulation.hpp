@@ -23,4 +23,15 @@ namespace LiOS86 {
         return readFromMemoryAndPun<T>(source + offset);
     }
 
+    template<typename T>
+    requires std::is_trivial_v<T>
+    auto writeToMemory(volatile uint8_t* destination, std::size_t offset, T value) -> void {
+        auto valuePtr = reinterpret_cast<const uint8_t*>(&value);
+        destination += offset;
+        auto count = sizeof(T);
+        while(count--) {
+            *(destination++) = *(valuePtr++);
+        }
+    }
+
 }
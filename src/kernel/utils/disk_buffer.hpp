@@ -3,44 +3,119 @@
 #include <cstddef>
 
 #include "../xstd/array.hpp"
-#include "../xstd/cstring.hpp"
-#include "../ata.hpp"
+#include "../xstd/span.hpp"
+#include "../block_cache.hpp"
+#include "error_handling.hpp"
 
 namespace LiOS86 {
 
     constexpr std::size_t DEFAULT_SECTOR_SIZE = 512;
 
+    // Private copy of a window of up to numberOfSectors consecutive sectors, read (and written back) through the block cache.
+    // The window is read with a single request and can be moved to another sector range without constructing a new buffer;
+    // modified sectors are tracked individually and each run of consecutive ones is handed back with a single write.
+    // Writeable buffers write their modifications back when they are moved or destroyed.
     template<bool writeable, std::size_t numberOfSectors, std::size_t sectorSize = DEFAULT_SECTOR_SIZE>
     class DiskBuffer {
         public:
-            explicit DiskBuffer(std::size_t startingSectorNumber) : sectorNumber{startingSectorNumber} {
+            explicit DiskBuffer(std::size_t startingSectorNumber, std::size_t windowLength = numberOfSectors)
+                : sectorNumber{startingSectorNumber}, length{windowLength} {
                 reload();
             }
 
+            DiskBuffer(const DiskBuffer&) = delete;
+            DiskBuffer& operator=(const DiskBuffer&) = delete;
+            DiskBuffer(DiskBuffer&&) = delete;
+            DiskBuffer& operator=(DiskBuffer&&) = delete;
+
+            ~DiskBuffer() {
+                if constexpr(writeable) writeBack();
+            }
+
             auto reload() -> void;
 
+            // writes the current window back if needed, then reads windowLength sectors from the given one on
+            auto repoint(std::size_t startingSectorNumber, std::size_t windowLength = numberOfSectors) -> void {
+                if constexpr(writeable) writeBack();
+                sectorNumber = startingSectorNumber;
+                length = windowLength;
+                reload();
+            }
+
+            auto getStartingSectorNumber() const -> std::size_t {
+                return sectorNumber;
+            }
+
+            auto getWindowLength() const -> std::size_t {
+                return length;
+            }
+
+            // hands modified sectors over to the block cache, which writes them to the disk on flush
+            auto writeBack() -> void requires writeable;
+
+            // also has the block cache write all its dirty sectors, adjacent ones merged into single requests;
+            // returns false if the disk reported an error
+            auto flush() -> bool requires writeable {
+                writeBack();
+                return BlockCache::flush();
+            }
+
         protected:
             auto bufferData() const -> const uint8_t* {
                 return buffer.data();
             }
 
+            // gives write access to the whole window and marks all of it modified
+            auto mutableBufferData() -> uint8_t* requires writeable {
+                for(std::size_t i = 0; i < length; ++i) {
+                    dirty[i] = true;
+                }
+                return buffer.data();
+            }
+
+            // gives write access to a single sector of the window and marks only it modified
+            auto mutableSectorData(std::size_t sectorInWindow) -> uint8_t* requires writeable {
+                dirty[sectorInWindow] = true;
+                return buffer.data() + sectorInWindow * sectorSize;
+            }
+
         private:
-            xstd::array<uint8_t, numberOfSectors * sectorSize> buffer{};
+            alignas(16) xstd::array<uint8_t, numberOfSectors * sectorSize> buffer{};
+            xstd::array<bool, numberOfSectors> dirty{};
             std::size_t sectorNumber;
-            bool dirty{false};
+            std::size_t length;
     };
 
     template<bool writeable, std::size_t numberOfSectors, std::size_t sectorSize>
     auto DiskBuffer<writeable, numberOfSectors, sectorSize>::reload() -> void {
-        for(std::size_t i = 0; i < numberOfSectors; ++i) {
-            const auto sector = readSectors(sectorNumber + i, 1);
-            if(!sector) {
-                // TODO error handling
-                while(true) { }
+        static_assert(sectorSize == ATA_SECTOR_SIZE, "DiskBuffer sector size has to match the disk sector size");
+        static_assert(numberOfSectors > 0 && numberOfSectors <= 0xffff, "DiskBuffer has to fit in a single disk read");
+        if(length > numberOfSectors) length = numberOfSectors;
+        dirty.fill(false);
+        // an empty window is a buffer not pointed at any sectors yet
+        if(length == 0) return;
+        const auto result = BlockCache::read(static_cast<uint32_t>(sectorNumber), static_cast<uint16_t>(length), xstd::span<uint8_t>(buffer.data(), length * sectorSize));
+        if(!result) kpanic("Error reading from the disk. Halting.");
+    }
+
+    template<bool writeable, std::size_t numberOfSectors, std::size_t sectorSize>
+    auto DiskBuffer<writeable, numberOfSectors, sectorSize>::writeBack() -> void requires writeable {
+        std::size_t i = 0;
+        while(i < length) {
+            if(!dirty[i]) {
+                ++i;
+                continue;
+            }
+            auto runEnd = i + 1;
+            while(runEnd < length && dirty[runEnd]) ++runEnd;
+            const auto runSource = xstd::span<const uint8_t>(buffer.data() + i * sectorSize, (runEnd - i) * sectorSize);
+            if(!BlockCache::write(static_cast<uint32_t>(sectorNumber + i), static_cast<uint16_t>(runEnd - i), runSource)) {
+                kpanic("Error writing to the disk. Halting.");
+            }
+            for(; i < runEnd; ++i) {
+                dirty[i] = false;
             }
-            xstd::memcpy(buffer.data() + i * sectorSize, (*sector).data(), sectorSize);
         }
-        dirty = false;
     }
 
     template<std::size_t numberOfSectors, std::size_t sectorSize = DEFAULT_SECTOR_SIZE>
@@ -0,0 +1,275 @@
+#include "virtio_blk.hpp"
+
+#include "interrupt_manager.hpp"
+#include "mmio.hpp"
+#include "pci.hpp"
+#include "ports.hpp"
+#include "xstd/cstring.hpp"
+
+namespace LiOS86 {
+
+    namespace {
+        constexpr uint16_t MAX_QUEUE_SIZE = 256;
+        constexpr std::size_t MAX_REQUESTS = 32;
+        constexpr uint16_t DESCRIPTORS_PER_REQUEST = 3;
+        constexpr std::size_t QUEUE_ALIGNMENT = 4096;
+
+        class VirtqDescriptor {
+            public:
+                uint64_t address;
+                uint32_t length;
+                uint16_t flags;
+                uint16_t next;
+        } __attribute__((packed));
+        static_assert( sizeof(VirtqDescriptor) == 16, "VirtqDescriptor has incorrect size" );
+
+        class VirtqUsedElement {
+            public:
+                uint32_t id;
+                uint32_t length;
+        } __attribute__((packed));
+        static_assert( sizeof(VirtqUsedElement) == 8, "VirtqUsedElement has incorrect size" );
+
+        class RequestHeader {
+            public:
+                uint32_t type;
+                uint32_t reserved;
+                uint64_t sector;
+        } __attribute__((packed));
+        static_assert( sizeof(RequestHeader) == 16, "RequestHeader has incorrect size" );
+
+        constexpr uint16_t DESCRIPTOR_NEXT = 1;
+        constexpr uint16_t DESCRIPTOR_WRITE = 2;            // buffer is written by the device
+        constexpr uint16_t USED_NO_NOTIFY = 1;
+
+        constexpr uint32_t REQUEST_TYPE_IN = 0;
+        constexpr uint32_t REQUEST_TYPE_OUT = 1;
+        constexpr uint32_t REQUEST_TYPE_FLUSH = 4;
+        constexpr uint8_t REQUEST_STATUS_OK = 0;
+
+        constexpr auto alignUp(std::size_t value, std::size_t alignment) -> std::size_t {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+        // legacy layout: descriptor table and available ring, then the used ring on the next page boundary
+        constexpr auto usedRingOffset(std::size_t queueSize) -> std::size_t {
+            return alignUp(sizeof(VirtqDescriptor) * queueSize + 6 + 2 * queueSize, QUEUE_ALIGNMENT);
+        }
+        constexpr auto queueMemorySize(std::size_t queueSize) -> std::size_t {
+            return usedRingOffset(queueSize) + alignUp(6 + sizeof(VirtqUsedElement) * queueSize, QUEUE_ALIGNMENT);
+        }
+
+        // memory shared with the device; addresses are handed out as physical (identity mapping)
+        uint8_t queueMemory[queueMemorySize(MAX_QUEUE_SIZE)] __attribute__((aligned(QUEUE_ALIGNMENT)));
+        RequestHeader requestHeaders[MAX_REQUESTS];
+        volatile uint8_t requestStatus[MAX_REQUESTS];
+
+        // legacy virtio register offsets (I/O space BAR0)
+        constexpr uint16_t DEVICE_FEATURES_REG = 0x00;
+        constexpr uint16_t GUEST_FEATURES_REG = 0x04;
+        constexpr uint16_t QUEUE_ADDRESS_REG = 0x08;
+        constexpr uint16_t QUEUE_SIZE_REG = 0x0c;
+        constexpr uint16_t QUEUE_SELECT_REG = 0x0e;
+        constexpr uint16_t QUEUE_NOTIFY_REG = 0x10;
+        constexpr uint16_t DEVICE_STATUS_REG = 0x12;
+        constexpr uint16_t ISR_STATUS_REG = 0x13;
+
+        constexpr uint8_t STATUS_ACKNOWLEDGE = 1;
+        constexpr uint8_t STATUS_DRIVER = 2;
+        constexpr uint8_t STATUS_DRIVER_OK = 4;
+        constexpr uint8_t STATUS_FAILED = 128;
+
+        constexpr uint32_t FEATURE_FLUSH = 1u << 9;
+
+        auto descriptorTable() -> VirtqDescriptor* {
+            return reinterpret_cast<VirtqDescriptor*>(queueMemory);
+        }
+
+        // available ring: flags, index, ring[queueSize]
+        auto availableRing(uint16_t queueSize) -> uint16_t* {
+            return reinterpret_cast<uint16_t*>(queueMemory + sizeof(VirtqDescriptor) * queueSize);
+        }
+
+        // used ring: flags, index, ring[queueSize] (written by the device)
+        auto usedRing(uint16_t queueSize) -> volatile uint16_t* {
+            return reinterpret_cast<volatile uint16_t*>(queueMemory + usedRingOffset(queueSize));
+        }
+
+        auto usedElement(uint16_t queueSize, uint16_t index) -> volatile VirtqUsedElement* {
+            return reinterpret_cast<volatile VirtqUsedElement*>(queueMemory + usedRingOffset(queueSize) + 4) + index;
+        }
+    }
+
+    VirtioBlockDevice::VirtioBlockDevice() {
+        constexpr uint16_t VIRTIO_VENDOR_ID = 0x1af4;
+        constexpr uint16_t VIRTIO_BLOCK_TRANSITIONAL_DEVICE_ID = 0x1001;
+
+        const auto device = findPCIDevice([](const PCIDeviceHandle& handle) {
+            return handle.getVendorID() == VIRTIO_VENDOR_ID && handle.getDeviceID() == VIRTIO_BLOCK_TRANSITIONAL_DEVICE_ID;
+        });
+        if(!device || !device->isIOSpaceBAR(0)) return;
+        device->enableIOSpace();
+        device->enableBusMastering();
+
+        ioBase = static_cast<uint16_t>(device->getBARAddress(0));
+        if(!initializeQueue()) {
+            outb(static_cast<Port>(ioBase + DEVICE_STATUS_REG), STATUS_FAILED);
+            ioBase = 0;
+            return;
+        }
+
+        // without an interrupt line the used ring is polled for completions instead
+        if(device->hasInterruptLine()) {
+            InterruptManager::set_interrupt_handler(InterruptManager::irq_to_interrupt_number(device->getInterruptLine()), interrupt_handler);
+            interruptDriven = true;
+        }
+        outb(static_cast<Port>(ioBase + DEVICE_STATUS_REG), STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+    }
+
+    auto VirtioBlockDevice::initializeQueue() -> bool {
+        const auto port = [this](uint16_t offset) { return static_cast<Port>(ioBase + offset); };
+
+        outb(port(DEVICE_STATUS_REG), 0);
+        outb(port(DEVICE_STATUS_REG), STATUS_ACKNOWLEDGE);
+        outb(port(DEVICE_STATUS_REG), STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+        // the only optional feature used is the flush command, offered by devices with a write cache
+        flushSupported = inl(port(DEVICE_FEATURES_REG)) & FEATURE_FLUSH;
+        outl(port(GUEST_FEATURES_REG), flushSupported ? FEATURE_FLUSH : 0);
+
+        outw(port(QUEUE_SELECT_REG), 0);
+        queueSize = inw(port(QUEUE_SIZE_REG));
+        if(queueSize < DESCRIPTORS_PER_REQUEST || queueSize > MAX_QUEUE_SIZE) return false;
+
+        const auto numberOfRequests = (queueSize / DESCRIPTORS_PER_REQUEST < MAX_REQUESTS) ? queueSize / DESCRIPTORS_PER_REQUEST : MAX_REQUESTS;
+        usableRequestsMask = (numberOfRequests == 32) ? 0xffffffffu : ((1u << numberOfRequests) - 1);
+
+        xstd::memset(queueMemory, 0, sizeof(queueMemory));
+        compilerBarrier();
+        outl(port(QUEUE_ADDRESS_REG), reinterpret_cast<uint32_t>(&queueMemory[0]) / QUEUE_ALIGNMENT);
+        return true;
+    }
+
+    auto VirtioBlockDevice::allocateRequest() -> xstd::expected<RequestID, DiskError> {
+        const auto freeRequests = usableRequestsMask & ~allocatedRequests;
+        if(freeRequests == 0) return xstd::unexpected(DiskError::QUEUE_FULL);
+        const auto request = static_cast<RequestID>(__builtin_ctz(freeRequests));
+        allocatedRequests |= (1u << request);
+        return request;
+    }
+
+    auto VirtioBlockDevice::submitImpl(uint32_t logicalBlockAddress, uint16_t numberOfSectors, const uint8_t* buffer, std::size_t size, bool write) -> xstd::expected<RequestID, DiskError> {
+        if(ioBase == 0) return xstd::unexpected(DiskError::NO_DEVICE);
+        const auto transferSize = numberOfSectors * ATA_SECTOR_SIZE;
+        if(numberOfSectors == 0 || size < transferSize) return xstd::unexpected(DiskError::BUFFER_TOO_SMALL);
+
+        const auto request = allocateRequest();
+        if(!request) return request;
+
+        requestHeaders[*request] = RequestHeader{write ? REQUEST_TYPE_OUT : REQUEST_TYPE_IN, 0, logicalBlockAddress};
+        requestStatus[*request] = 0xff;
+        sectorCounts[*request] = numberOfSectors;
+
+        const auto head = static_cast<uint16_t>(*request * DESCRIPTORS_PER_REQUEST);
+        auto descriptors = descriptorTable();
+        descriptors[head] = VirtqDescriptor{reinterpret_cast<uint32_t>(&requestHeaders[*request]), sizeof(RequestHeader),
+                                            DESCRIPTOR_NEXT, static_cast<uint16_t>(head + 1)};
+        descriptors[head + 1] = VirtqDescriptor{reinterpret_cast<uint32_t>(buffer), static_cast<uint32_t>(transferSize),
+                                            static_cast<uint16_t>(DESCRIPTOR_NEXT | (write ? 0 : DESCRIPTOR_WRITE)), static_cast<uint16_t>(head + 2)};
+        descriptors[head + 2] = VirtqDescriptor{reinterpret_cast<uint32_t>(&requestStatus[*request]), 1, DESCRIPTOR_WRITE, 0};
+
+        availableRing(queueSize)[2 + availableIndex % queueSize] = head;
+        ++availableIndex;
+        return request;
+    }
+
+    auto VirtioBlockDevice::kickImpl() -> void {
+        if(ioBase == 0 || availableIndex == publishedIndex) return;
+        compilerBarrier();
+        availableRing(queueSize)[1] = availableIndex;
+        publishedIndex = availableIndex;
+        compilerBarrier();
+        if(!(usedRing(queueSize)[0] & USED_NO_NOTIFY)) {
+            outw(static_cast<Port>(ioBase + QUEUE_NOTIFY_REG), 0);
+        }
+    }
+
+    auto VirtioBlockDevice::waitForCompletionImpl(RequestID request) -> xstd::expected<uint32_t, DiskError> {
+        const auto bit = 1u << request;
+        if(!(allocatedRequests & bit)) return xstd::unexpected(DiskError::DEVICE_ERROR);
+        kickImpl();
+
+        InterruptManager::wait_until([this, bit]() { return ((completedRequests | failedRequests) & bit) != 0; },
+                                        [this]() { processCompletions(); }, interruptDriven);
+        compilerBarrier();
+
+        InterruptGuard guard;
+        const bool failed = failedRequests & bit;
+        completedRequests = completedRequests & ~bit;
+        failedRequests = failedRequests & ~bit;
+        allocatedRequests &= ~bit;
+        if(failed) return xstd::unexpected(DiskError::DEVICE_ERROR);
+        return sectorCounts[request];
+    }
+
+    auto VirtioBlockDevice::readSectors(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<uint8_t> destination) -> xstd::expected<uint32_t, DiskError> {
+        const auto request = submitRead(logicalBlockAddress, numberOfSectors, destination);
+        if(!request) return xstd::unexpected(request.error());
+        return waitForCompletion(*request);
+    }
+
+    auto VirtioBlockDevice::writeSectors(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<const uint8_t> source) -> xstd::expected<uint32_t, DiskError> {
+        const auto request = submitWrite(logicalBlockAddress, numberOfSectors, source);
+        if(!request) return xstd::unexpected(request.error());
+        return waitForCompletion(*request);
+    }
+
+    // A flush covers the writes completed before it, which is all of them for the synchronous callers.
+    // Its request has no data buffer: the header descriptor is chained straight to the status one.
+    // A device that does not offer the flush feature has no write cache to flush.
+    auto VirtioBlockDevice::flushCacheImpl() -> bool {
+        if(ioBase == 0) return false;
+        if(!flushSupported) return true;
+
+        const auto request = allocateRequest();
+        if(!request) return false;
+
+        requestHeaders[*request] = RequestHeader{REQUEST_TYPE_FLUSH, 0, 0};
+        requestStatus[*request] = 0xff;
+        sectorCounts[*request] = 0;
+
+        const auto head = static_cast<uint16_t>(*request * DESCRIPTORS_PER_REQUEST);
+        auto descriptors = descriptorTable();
+        descriptors[head] = VirtqDescriptor{reinterpret_cast<uint32_t>(&requestHeaders[*request]), sizeof(RequestHeader),
+                                            DESCRIPTOR_NEXT, static_cast<uint16_t>(head + 2)};
+        descriptors[head + 2] = VirtqDescriptor{reinterpret_cast<uint32_t>(&requestStatus[*request]), 1, DESCRIPTOR_WRITE, 0};
+
+        availableRing(queueSize)[2 + availableIndex % queueSize] = head;
+        ++availableIndex;
+        return waitForCompletionImpl(*request).has_value();
+    }
+
+    auto VirtioBlockDevice::interrupt_handler() -> void {
+        instance().processCompletions();
+    }
+
+    // Consumes the used ring; the head descriptor index identifies the request.
+    auto VirtioBlockDevice::processCompletions() -> void {
+        if(ioBase == 0) return;
+        InterruptGuard guard;
+
+        inb(static_cast<Port>(ioBase + ISR_STATUS_REG));    // reading acknowledges the interrupt
+        while(lastUsedIndex != usedRing(queueSize)[1]) {
+            compilerBarrier();
+            const auto element = usedElement(queueSize, lastUsedIndex % queueSize);
+            const auto request = element->id / DESCRIPTORS_PER_REQUEST;
+            const auto bit = 1u << request;
+            if(requestStatus[request] == REQUEST_STATUS_OK) {
+                completedRequests = completedRequests | bit;
+            } else {
+                failedRequests = failedRequests | bit;
+            }
+            ++lastUsedIndex;
+        }
+    }
+
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "ata.hpp"
+#include "xstd/array.hpp"
+#include "xstd/expected.hpp"
+#include "xstd/span.hpp"
+
+namespace LiOS86 {
+
+    // Driver for a virtio block device (legacy PCI interface) with a single split virtqueue.
+    // Every request is a chain of three descriptors: request header, data buffer and status byte.
+    // Submitted requests are only made visible to the device by kick(), so several of them
+    // can be handed over with a single notification (a trapped port write in a VM);
+    // waitForCompletion kicks any pending requests itself. Completions are signalled by the
+    // device's interrupt, or polled for if the firmware routed no interrupt line to it.
+    class VirtioBlockDevice {
+        public:
+            VirtioBlockDevice(const VirtioBlockDevice&) = delete;
+            VirtioBlockDevice& operator=(const VirtioBlockDevice&) = delete;
+            VirtioBlockDevice(VirtioBlockDevice&&) = delete;
+            VirtioBlockDevice& operator=(VirtioBlockDevice&&) = delete;
+
+            static auto& instance() {
+                static VirtioBlockDevice virtio_block_device;
+                return virtio_block_device;
+            }
+
+            using RequestID = uint8_t;
+
+            static auto isAvailable() -> bool {
+                return instance().ioBase != 0;
+            }
+
+            // queues a read into the destination buffer; it is sent to the device on the next kick
+            static auto submitRead(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<uint8_t> destination) -> xstd::expected<RequestID, DiskError> {
+                return instance().submitImpl(logicalBlockAddress, numberOfSectors, destination.data(), destination.size(), false);
+            }
+
+            static auto submitWrite(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<const uint8_t> source) -> xstd::expected<RequestID, DiskError> {
+                return instance().submitImpl(logicalBlockAddress, numberOfSectors, source.data(), source.size(), true);
+            }
+
+            // publishes all submitted requests and notifies the device once
+            static auto kick() -> void {
+                instance().kickImpl();
+            }
+
+            // waits until the request completes and releases it; returns the number of sectors transferred
+            static auto waitForCompletion(RequestID request) -> xstd::expected<uint32_t, DiskError> {
+                return instance().waitForCompletionImpl(request);
+            }
+
+            // submit a single request and wait for it, which kicks it to the device
+            static auto readSectors(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<uint8_t> destination) -> xstd::expected<uint32_t, DiskError>;
+            static auto writeSectors(uint32_t logicalBlockAddress, uint16_t numberOfSectors, xstd::span<const uint8_t> source) -> xstd::expected<uint32_t, DiskError>;
+
+            // makes the completed writes durable (VIRTIO_BLK_T_FLUSH), like flushCache in ata.hpp
+            static auto flushCache() -> bool {
+                return instance().flushCacheImpl();
+            }
+
+        private:
+            VirtioBlockDevice();
+
+            auto initializeQueue() -> bool;
+            auto allocateRequest() -> xstd::expected<RequestID, DiskError>;
+
+            auto submitImpl(uint32_t logicalBlockAddress, uint16_t numberOfSectors, const uint8_t* buffer, std::size_t size, bool write) -> xstd::expected<RequestID, DiskError>;
+            auto kickImpl() -> void;
+            auto waitForCompletionImpl(RequestID request) -> xstd::expected<uint32_t, DiskError>;
+            auto flushCacheImpl() -> bool;
+
+            static auto interrupt_handler() -> void;
+            auto processCompletions() -> void;
+
+            uint16_t ioBase{0};
+            uint16_t queueSize{0};
+            uint32_t usableRequestsMask{0};
+            bool flushSupported{false};         // VIRTIO_BLK_F_FLUSH negotiated: the device may cache writes
+            bool interruptDriven{false};        // an interrupt line is routed to the device, otherwise completions are polled
+
+            uint16_t availableIndex{0};         // available ring index including requests not yet kicked
+            uint16_t publishedIndex{0};         // available ring index the device has been told about
+            uint16_t lastUsedIndex{0};          // next used ring entry to be processed
+
+            uint32_t allocatedRequests{0};
+            volatile uint32_t completedRequests{0};
+            volatile uint32_t failedRequests{0};
+            xstd::array<uint16_t, 32> sectorCounts{};
+    };
+
+}
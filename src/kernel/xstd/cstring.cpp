@@ -19,4 +19,12 @@ namespace LiOS86::xstd {
         return dest;
     }
 
+    auto memset(void* dest, int ch, std::size_t count) -> void* {
+        auto destBytePtr = reinterpret_cast<unsigned char*>(dest);
+        while(count--) {
+            *(destBytePtr++) = static_cast<unsigned char>(ch);
+        }
+        return dest;
+    }
+
 }
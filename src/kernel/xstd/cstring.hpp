@@ -6,5 +6,6 @@ namespace LiOS86::xstd {
 
     auto strcmp(const char* lhs, const char* rhs) -> int;
     auto memcpy(void* dest, const void* src, std::size_t count) -> void*;
+    auto memset(void* dest, int ch, std::size_t count) -> void*;
 
 }
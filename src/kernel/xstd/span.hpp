@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+
+#include "../xstd/array.hpp"
+
+// The following is a partial implementation of std::span.
+// It is NOT fully compliant with the C++20 standard.
+//
+// Only spans of dynamic extent are supported (there is no Extent
+// template parameter). Construction is possible from a pointer and
+// an element count, from a C array, from xstd::array and from a span
+// of a compatible element type.
+// Byte views (as_bytes, as_writable_bytes), reverse iterators and
+// deduction guides for ranges are not implemented.
+
+namespace LiOS86::xstd {
+
+    template<typename T>
+    class span {
+        public:
+            using element_type = T;
+            using size_type = std::size_t;
+            using difference_type = std::ptrdiff_t;
+            using pointer = T*;
+            using reference = T&;
+
+            using iterator = T*;
+
+            constexpr span() = default;
+            constexpr span(T* first, size_type n) : ptr{first}, count{n} { }
+
+            template<std::size_t N>
+            constexpr span(T (&arr)[N]) : ptr{arr}, count{N} { }
+
+            template<typename U, std::size_t N>
+            constexpr span(xstd::array<U, N>& arr) : ptr{arr.data()}, count{N} { }
+
+            template<typename U, std::size_t N>
+            constexpr span(const xstd::array<U, N>& arr) : ptr{arr.data()}, count{N} { }
+
+            // allows e.g. span<const T> to be constructed from span<T>
+            template<typename U>
+            requires std::is_convertible_v<U(*)[], T(*)[]>
+            constexpr span(const span<U>& other) : ptr{other.data()}, count{other.size()} { }
+
+            constexpr auto operator[](size_type pos) const -> reference {
+                return ptr[pos];
+            }
+
+            constexpr auto front() const -> reference {
+                return ptr[0];
+            }
+
+            constexpr auto back() const -> reference {
+                return ptr[count-1];
+            }
+
+            constexpr auto data() const noexcept -> pointer {
+                return ptr;
+            }
+
+            constexpr auto begin() const noexcept -> iterator {
+                return ptr;
+            }
+
+            constexpr auto end() const noexcept -> iterator {
+                return ptr + count;
+            }
+
+            [[nodiscard]] constexpr auto empty() const noexcept -> bool {
+                return (count == 0);
+            }
+
+            constexpr auto size() const noexcept -> size_type {
+                return count;
+            }
+
+            constexpr auto size_bytes() const noexcept -> size_type {
+                return count * sizeof(T);
+            }
+
+            constexpr auto first(size_type n) const -> span {
+                return span(ptr, n);
+            }
+
+            constexpr auto last(size_type n) const -> span {
+                return span(ptr + (count - n), n);
+            }
+
+            constexpr auto subspan(size_type offset) const -> span {
+                return span(ptr + offset, count - offset);
+            }
+
+            constexpr auto subspan(size_type offset, size_type n) const -> span {
+                return span(ptr + offset, n);
+            }
+
+        private:
+            T* ptr{nullptr};
+            size_type count{0};
+    };
+
+}